@@ -3,9 +3,14 @@
 #include <pico/audio.h>
 #include <pico/audio_pwm.h>
 #include <pico/multicore.h>
+#include <pico/time.h>
 
 #include <vorbis/codec.h>
 
+#include "media_clock.h"
+#include "pcm_ring.h"
+#include "telemetry.h"
+
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
@@ -32,6 +37,26 @@ static bool o_eos = false;
 static audio_buffer_pool_t *pcm_buffer_pool[2];
 static struct producer_pool_blocking_give_connection pcm_connections[2];
 
+// decoded pcm, drained into the pwm driver by pump_audio
+static struct pcm_ring pcm_ring;
+
+// frames per give, small enough to resample into at most one fresh pwm buffer so a give never blocks
+#define PCM_PUMP_FRAMES 256
+#define PCM_PUMP_PERIOD_US 2000
+
+// buffered audio the pump waits for before the first give
+#define PCM_PRIME_FRAMES (PCM_RING_FRAMES / 2)
+
+static alarm_pool_t *pump_alarm_pool;
+static repeating_timer_t pump_timer;
+static bool pump_primed = false;
+
+// frames handed to the pwm driver so far, drives the media clock
+static uint32_t pump_frames_given = 0;
+
+// pcm ring writes so far, for telemetry
+static uint32_t pcm_buffers_written = 0;
+
 const float pcm_volume = .7f;
 
 #include "aud_file.h"
@@ -72,21 +97,83 @@ static void stream_pagein() {
     ogg_stream_pagein(&o_stream, &o_page);
 }
 
-uint32_t step_audio() {
+/* pcm ring -> pwm driver */
+
+static bool pwm_can_take() {
+    // the pwm side of every channel needs a free buffer, or the give would block
+    for (uint32_t ch = 0; ch < pcm_ring.channels; ch++) {
+        if (!pcm_connections[ch].core.consumer_pool->free_list)
+            return false;
+    }
+
+    return true;
+}
+
+// core1 timer irq, keeps the pwm driver fed out of the pcm ring
+static bool pump_audio(repeating_timer_t *rt) {
+    if (!pump_primed) {
+        if (pcm_ring_fill(&pcm_ring) < PCM_PRIME_FRAMES)
+            return true;
+
+        pump_primed = true;
+    }
+
+    while (pwm_can_take()) {
+        uint32_t frames;
+        const int16_t *in = pcm_ring_read_window(&pcm_ring, &frames);
+
+        if (!frames) {
+            // the pwm driver wants audio and the decoder fell behind
+            pcm_ring.underruns += 1;
+            break;
+        }
+
+        frames = MIN(frames, PCM_PUMP_FRAMES);
+
+        for (uint32_t ch = 0; ch < pcm_ring.channels; ch++) {
+            audio_buffer_t *pwm_buf = take_audio_buffer(pcm_buffer_pool[ch], false);
+            assert(pwm_buf);
+
+            int16_t *out = (int16_t *)pwm_buf->buffer->bytes;
+            for (uint32_t fi = 0; fi < frames; fi++)
+                out[fi] = in[fi * pcm_ring.channels + ch];
+
+            pwm_buf->sample_count = frames;
+            give_audio_buffer(pcm_buffer_pool[ch], pwm_buf);
+        }
+
+        pcm_ring_release(&pcm_ring, frames);
+
+        pump_frames_given += frames;
+        media_clock_publish(pump_frames_given);
+    }
+
+    return true;
+}
+
+/* vorbis -> pcm ring */
+
+// decode the next bit of audio into the pcm ring, sleeps while the ring is full
+void step_audio() {
     float **vb_buf;
     int samples_in = vorbis_synthesis_pcmout(&vb_dsp, &vb_buf);
 
     if (samples_in > 0) {
-        /* decoded pcm samples are buffered, give them to the pwm driver */
+        /* decoded pcm samples are buffered, interleave them into the pcm ring */
 
-        int samples_out = MIN(samples_in, 1024);
+        uint32_t samples_out;
+        int16_t *out = pcm_ring_write_window(&pcm_ring, &samples_out);
 
-        for (uint32_t ch = 0; ch < vb_info.channels; ch++) {
-            audio_buffer_t *pwm_buf = take_audio_buffer(pcm_buffer_pool[ch], true);
-            pwm_buf->sample_count = samples_out;
+        if (!samples_out) {
+            // full, the pump irq will make room
+            __wfe();
+            return;
+        }
 
+        samples_out = MIN(samples_out, (uint32_t)samples_in);
+
+        for (uint32_t ch = 0; ch < vb_info.channels; ch++) {
             float *in = vb_buf[ch];
-            int16_t *out = (int16_t *)pwm_buf->buffer->bytes;
 
             for (uint32_t si = 0; si < samples_out; si++) {
                 int32_t val = floorf(in[si] * 32767.f * pcm_volume + .5f);
@@ -97,13 +184,23 @@ uint32_t step_audio() {
                     val = -32768;
                 }
 
-                out[si] = val;
+                out[si * vb_info.channels + ch] = val;
             }
-
-            give_audio_buffer(pcm_buffer_pool[ch], pwm_buf);
         }
 
-        printf("a: rh %d sc %d\n", flash_seek, samples_out);
+        pcm_ring_commit(&pcm_ring, samples_out);
+        pcm_buffers_written += 1;
+
+        const struct telemetry_audio audio = {
+            .buffers = pcm_buffers_written,
+            .samples = samples_out,
+            .fill = pcm_ring_fill(&pcm_ring),
+            .low_water = pcm_ring.low_water,
+            .high_water = pcm_ring.high_water,
+            .underruns = pcm_ring.underruns,
+        };
+        telemetry_record_audio(&audio);
+
         vorbis_synthesis_read(&vb_dsp, samples_out);
     } else {
         /* out of decoded pcm, syntetize a packet */
@@ -130,15 +227,21 @@ uint32_t step_audio() {
     }
 }
 
+#ifdef BA_VIDEO_CORE1_SLICES
+extern void video_help_slices();
+#endif
+
 static void core1_loop() {
-    // sync with core0
-    // multicore_fifo_push_blocking(0);
-    // multicore_fifo_pop_blocking();
+    // sync with core0, it runs the video against our clock
+    media_clock_announce(vb_info.rate);
 
     while (true) {
-        uint32_t audio_us = step_audio();
+        step_audio();
 
-        // multicore_fifo_push_blocking(audio_us);
+#ifdef BA_VIDEO_CORE1_SLICES
+        // take some of core0's slices, if it's decoding a sliced frame
+        video_help_slices();
+#endif
     }
 }
 
@@ -183,6 +286,7 @@ static void setup_bitstream() {
                     assert(false && "vorbis header probably corrupt (pout)");
 
                 res = vorbis_synthesis_headerin(&vb_info, &vb_com, &o_packet);
+
                 if (res < 0)
                     assert(false && "vorbis header probably corrupt (syn)");
 
@@ -246,12 +350,18 @@ void setup_audio() {
     pcm_format.channel_count = 1;
     
     for (uint32_t ch = 0; ch < vb_info.channels; ch++) {
-        pcm_buffer_pool[ch] = audio_new_producer_pool(&pcm_buffer_format, 3, 1024);
+        pcm_buffer_pool[ch] = audio_new_producer_pool(&pcm_buffer_format, 2, PCM_PUMP_FRAMES);
         audio_pwm_channel_connect(pcm_buffer_pool[ch], &pcm_connections[ch], ch);
     }
+
+    pcm_ring_init(&pcm_ring, vb_info.channels);
     
     audio_pwm_set_enabled(true);
 
+    // the pump runs off a core1 alarm, so it keeps going while a packet decodes
+    pump_alarm_pool = alarm_pool_create_with_unused_hardware_alarm(4);
+    alarm_pool_add_repeating_timer_us(pump_alarm_pool, -PCM_PUMP_PERIOD_US, pump_audio, NULL, &pump_timer);
+
     // audio_setup is already running on core1, continue to loop
     core1_loop();
 }
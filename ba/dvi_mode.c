@@ -0,0 +1,295 @@
+#include "dvi_mode.h"
+
+#include <stddef.h>
+
+/* dvi modes */
+
+const struct dvi_mode dvi_modes[DVI_MODE_COUNT] = {
+    // name, pixel clock, h front porch / sync / back porch / active, v front porch / sync / back porch /
+    // active, h / v sync polarity, pixel repeat
+
+    // VESA 640x480@60, run at 25 MHz (25.175 nominal) off a 125 MHz HSTX clock
+    { "640x480@60",    25000, 16, 96, 48, 640, 10, 2, 33, 480, 0, 0, 1 },
+    { "640x480@60 x2", 25000, 16, 96, 48, 640, 10, 2, 33, 480, 0, 0, 2 },
+    { "640x480@60 x4", 25000, 16, 96, 48, 640, 10, 2, 33, 480, 0, 0, 4 },
+
+    // CEA-861 480p, non-square pixels
+    { "720x480@60",    27000, 16, 62, 60, 720,  9, 6, 30, 480, 0, 0, 1 },
+    { "720x480@60 x2", 27000, 16, 62, 60, 720,  9, 6, 30, 480, 0, 0, 2 },
+};
+
+int32_t dvi_layout_init(struct dvi_layout *l, const struct dvi_mode *m, const uint16_t extent[2], uint32_t flags) {
+    const uint32_t w = extent[0];
+    const uint32_t h = extent[1];
+    const uint32_t repeat = m->pixel_repeat;
+
+    if (!w || !h || (repeat != 1 && repeat != 2 && repeat != 4))
+        return -2;
+
+    uint32_t content_w;
+    uint32_t content_h;
+
+    if (flags & DVI_LAYOUT_DIRECT) {
+        // the repeat is the scale, 1bpp rows are whole words and can't be repeated
+        if (w % 4 || ((flags & DVI_LAYOUT_1BPP) && (w % 32 || repeat != 1)))
+            return -2;
+
+        content_w = w * repeat;
+        content_h = h * repeat;
+
+        if (content_w > m->h_active_pixels || content_h > m->v_active_lines)
+            return -2;
+    } else {
+        // largest aspect preserving fit, whole line ring words wide
+        if ((uint32_t)m->h_active_pixels * h <= (uint32_t)m->v_active_lines * w) {
+            content_w = m->h_active_pixels;
+            content_h = h * content_w / w;
+        } else {
+            content_h = m->v_active_lines;
+            content_w = w * content_h / h;
+        }
+
+        content_w -= content_w % (4 * repeat);
+
+        if (!content_w || !content_h)
+            return -2;
+    }
+
+    const uint32_t scale = content_w % w == 0 && content_h == h * (content_w / w) ? content_w / w : 0;
+
+    if (repeat > 1 && (!scale || scale % repeat))
+        return -2;
+
+    l->mode = m;
+    l->content[0] = content_w;
+    l->content[1] = content_h;
+    l->border[0] = (m->h_active_pixels - content_w) / 2;
+    l->border[1] = (m->v_active_lines - content_h) / 2;
+    l->scale = scale;
+    l->line_pixels = content_w / repeat;
+    l->flags = flags;
+
+    l->v_sync_start = m->v_front_porch;
+    l->v_sync_end = l->v_sync_start + m->v_sync_width;
+    l->v_active_start = l->v_sync_end + m->v_back_porch;
+    l->v_content_start = l->v_active_start + l->border[1];
+    l->v_content_end = l->v_content_start + content_h;
+    l->v_total_lines = l->v_active_start + m->v_active_lines;
+
+    return 0;
+}
+
+const struct dvi_mode *dvi_mode_pick(const uint16_t extent[2], uint32_t flags, struct dvi_layout *l) {
+    const struct dvi_mode *best = NULL;
+    uint32_t best_cover = 0;
+    uint32_t best_pixels = 0;
+
+    for (uint32_t i = 0; i < DVI_MODE_COUNT; i++) {
+        const struct dvi_mode *m = &dvi_modes[i];
+        struct dvi_layout cand;
+
+        if (dvi_layout_init(&cand, m, extent, flags) < 0)
+            continue;
+
+        // covered share of the active area in 1/65536ths, whole factor scales break ties in the low bit
+        const uint32_t cover = (uint32_t)(((uint64_t)cand.content[0] * cand.content[1] << 16) /
+            ((uint32_t)m->h_active_pixels * m->v_active_lines)) << 1 | (cand.scale != 0);
+        const uint32_t pixels = (uint32_t)cand.line_pixels * cand.content[1];
+
+        if (!best || cover > best_cover || (cover == best_cover && pixels < best_pixels)) {
+            best = m;
+            best_cover = cover;
+            best_pixels = pixels;
+            *l = cand;
+        }
+    }
+
+    return best;
+}
+
+/* command lists */
+
+// sync symbols on lane 0 (lanes 1 and 2 stay at CTRL_00) for the vsync / hsync pulses being on or off
+static uint32_t dvi_sync(const struct dvi_mode *m, bool vsync, bool hsync) {
+    static const uint32_t ctrl[4] = { TMDS_CTRL_00, TMDS_CTRL_01, TMDS_CTRL_10, TMDS_CTRL_11 };
+
+    const uint32_t v = vsync ? m->v_sync_polarity : !m->v_sync_polarity;
+    const uint32_t h = hsync ? m->h_sync_polarity : !m->h_sync_polarity;
+
+    return ctrl[v << 1 | h] | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20);
+}
+
+static void cmdlist_put(struct dvi_cmdlist *c, uint32_t word) {
+    c->words[c->count++] = word;
+}
+
+static void build_vblank(struct dvi_cmdlist *c, const struct dvi_mode *m, bool vsync) {
+    c->count = 0;
+    cmdlist_put(c, HSTX_CMD_RAW_REPEAT | m->h_front_porch);
+    cmdlist_put(c, dvi_sync(m, vsync, false));
+    cmdlist_put(c, HSTX_CMD_RAW_REPEAT | m->h_sync_width);
+    cmdlist_put(c, dvi_sync(m, vsync, true));
+    cmdlist_put(c, HSTX_CMD_RAW_REPEAT | (m->h_back_porch + m->h_active_pixels));
+    cmdlist_put(c, dvi_sync(m, vsync, false));
+    cmdlist_put(c, HSTX_CMD_NOP);
+}
+
+// porches and hsync of an active line, up to its first pixel
+static void build_hblank(struct dvi_cmdlist *c, const struct dvi_mode *m) {
+    c->count = 0;
+    cmdlist_put(c, HSTX_CMD_RAW_REPEAT | m->h_front_porch);
+    cmdlist_put(c, dvi_sync(m, false, false));
+    cmdlist_put(c, HSTX_CMD_NOP);
+    cmdlist_put(c, HSTX_CMD_RAW_REPEAT | m->h_sync_width);
+    cmdlist_put(c, dvi_sync(m, false, true));
+    cmdlist_put(c, HSTX_CMD_NOP);
+    cmdlist_put(c, HSTX_CMD_RAW_REPEAT | m->h_back_porch);
+    cmdlist_put(c, dvi_sync(m, false, false));
+}
+
+void dvi_build_cmdlists(struct dvi_cmdlists *c, const struct dvi_layout *l) {
+    const struct dvi_mode *m = l->mode;
+    const uint32_t right = m->h_active_pixels - l->content[0] - l->border[0];
+
+    build_vblank(&c->vblank_vsync_off, m, false);
+    build_vblank(&c->vblank_vsync_on, m, true);
+
+    build_hblank(&c->vactive, m);
+    if (l->border[0]) {
+        cmdlist_put(&c->vactive, HSTX_CMD_TMDS_REPEAT | l->border[0]);
+        cmdlist_put(&c->vactive, 0);
+    }
+    cmdlist_put(&c->vactive, HSTX_CMD_TMDS | l->content[0]);
+
+    build_hblank(&c->vborder, m);
+    cmdlist_put(&c->vborder, HSTX_CMD_TMDS_REPEAT | m->h_active_pixels);
+    cmdlist_put(&c->vborder, 0);
+
+    c->line_tail_count = 0;
+    if (right) {
+        c->line_tail[c->line_tail_count++] = HSTX_CMD_TMDS_REPEAT | right;
+        c->line_tail[c->line_tail_count++] = 0;
+    }
+}
+
+/* scanout chain */
+
+static void chain_put(struct dvi_chain *ch, uintptr_t read, uintptr_t write, uint32_t count, uint32_t ctrl) {
+    struct dvi_block *b = &ch->blocks[ch->count++];
+
+    b->read_addr = read;
+    b->write_addr = write;
+    b->transfer_count = count;
+    b->ctrl = ctrl;
+}
+
+uint32_t dvi_chain_size(const struct dvi_layout *l, const struct dvi_cmdlists *c) {
+    const uint32_t content_stride = 3 + (c->line_tail_count != 0);
+
+    return (l->v_total_lines - l->content[1]) + l->content[1] * content_stride + 1;
+}
+
+void dvi_chain_build(struct dvi_chain *ch, struct dvi_block *blocks, const struct dvi_layout *l,
+    const struct dvi_cmdlists *c, const struct dvi_chain_ctrl *ctrl, uintptr_t fifo,
+    uintptr_t restart_read, uintptr_t restart_write, const uint16_t extent[2], uint32_t fb_stride) {
+    ch->blocks = blocks;
+    ch->count = 0;
+    ch->content_stride = 3 + (c->line_tail_count != 0);
+    ch->content_lines = l->content[1];
+    ch->fb_extent[0] = extent[0];
+    ch->fb_extent[1] = extent[1];
+    ch->fb_stride = fb_stride;
+    ch->fb_bpp = l->flags & DVI_LAYOUT_1BPP ? 1 : 8;
+
+    for (uint32_t v = 0; v < l->v_total_lines; v++) {
+        const struct dvi_cmdlist *list;
+
+        switch (dvi_line_kind(l, v)) {
+        case DVI_LINE_VSYNC_ON:
+            list = &c->vblank_vsync_on;
+            break;
+        case DVI_LINE_VSYNC_OFF:
+            list = &c->vblank_vsync_off;
+            break;
+        case DVI_LINE_BORDER:
+            list = &c->vborder;
+            break;
+        default:
+            list = NULL;
+            break;
+        }
+
+        if (list) {
+            chain_put(ch, (uintptr_t)list->words, fifo, list->count, ctrl->words);
+            continue;
+        }
+
+        if (v == l->v_content_start)
+            ch->content_first = ch->count + 1;
+
+        chain_put(ch, (uintptr_t)c->vactive.words, fifo, c->vactive.count, ctrl->words);
+        chain_put(ch, 0, fifo, extent[0], ctrl->pixels);
+        chain_put(ch, 0, fifo, 0, ctrl->pixels);
+
+        if (c->line_tail_count)
+            chain_put(ch, (uintptr_t)c->line_tail, fifo, c->line_tail_count, ctrl->words);
+    }
+
+    chain_put(ch, restart_read, restart_write, 1, ctrl->restart);
+}
+
+void dvi_chain_point(struct dvi_chain *ch, const uint8_t *fb, const uint16_t origin[2]) {
+    const uint32_t w = ch->fb_extent[0];
+    const uint32_t h = ch->fb_extent[1];
+    const uint32_t bpp = ch->fb_bpp;
+
+    // pixels per transfer, a byte or a word
+    const uint32_t unit = bpp == 1 ? 32 : 1;
+
+    // a row from origin[0] on, then the part wrapped around to the left; unwrapped rows are split
+    // anyway (a word off the end), every block has to move something
+    const uint32_t split = origin[0] ? origin[0] : w - 32 / bpp;
+    const uint32_t first = origin[0] ? w - split : split;
+
+    struct dvi_block *b = &ch->blocks[ch->content_first];
+
+    for (uint32_t line = 0; line < ch->content_lines; line++, b += ch->content_stride) {
+        uint32_t row = line * h / ch->content_lines + origin[1];
+        if (row >= h)
+            row -= h;
+
+        const uint8_t *src = &fb[row * ch->fb_stride];
+
+        if (origin[0]) {
+            b[0].read_addr = (uintptr_t)&src[split * bpp / 8];
+            b[1].read_addr = (uintptr_t)src;
+        } else {
+            b[0].read_addr = (uintptr_t)src;
+            b[1].read_addr = (uintptr_t)&src[split * bpp / 8];
+        }
+
+        b[0].transfer_count = first / unit;
+        b[1].transfer_count = (w - first) / unit;
+    }
+}
+
+/* tmds expander */
+
+void dvi_expander_init(struct dvi_expander *x, const struct dvi_layout *l) {
+    const uint32_t pixel_repeat = l->mode->pixel_repeat;
+    const bool replicated = (l->flags & DVI_LAYOUT_DIRECT) && !(l->flags & DVI_LAYOUT_1BPP);
+
+    // a 1bpp pixel is a 1-bit chunk, read lsb first a shift at a time
+    const uint32_t chunk = l->flags & DVI_LAYOUT_1BPP ? 1 : replicated ? 8 : 8 / pixel_repeat;
+
+    // pixels are black or white, every lane reads the whole chunk (a lit byte is level 0xff on all
+    // three), its top bit rotated to bit 7, where the lane's bits are read from
+    for (uint32_t lane = 0; lane < 3; lane++) {
+        x->lane_nbits[lane] = chunk - 1;
+        x->lane_rot[lane] = (chunk + 24) % 32;
+    }
+
+    // every byte of a replicated word is the same pixel, any rotation reads it
+    x->enc_n_shifts = replicated ? pixel_repeat : (32 / chunk) % 32;
+    x->enc_shift = chunk;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* dvi modes */
+
+// Timings the HSTX DVI scanout can run, and the command lists and scaling layout a stream is shown
+// with in one of them. No pico headers, the generated lists are checked on the host (ba/tools/dvimodes).
+
+#define TMDS_CTRL_00 0x354u
+#define TMDS_CTRL_01 0x0abu
+#define TMDS_CTRL_10 0x154u
+#define TMDS_CTRL_11 0x2abu
+
+#define HSTX_CMD_RAW         (0x0u << 12)
+#define HSTX_CMD_RAW_REPEAT  (0x1u << 12)
+#define HSTX_CMD_TMDS        (0x2u << 12)
+#define HSTX_CMD_TMDS_REPEAT (0x3u << 12)
+#define HSTX_CMD_NOP         (0xfu << 12)
+
+#define HSTX_CMD_MASK  (0xfu << 12)
+#define HSTX_CMD_COUNT 0xfffu
+
+struct dvi_mode {
+    const char *name;
+
+    // the HSTX clock runs at 5x, one TMDS symbol per 5 cycles
+    uint32_t pixel_khz;
+
+    // in pixels / lines, a sync polarity of 1 is active high
+    uint16_t h_front_porch;
+    uint16_t h_sync_width;
+    uint16_t h_back_porch;
+    uint16_t h_active_pixels;
+
+    uint16_t v_front_porch;
+    uint16_t v_sync_width;
+    uint16_t v_back_porch;
+    uint16_t v_active_lines;
+
+    uint8_t h_sync_polarity;
+    uint8_t v_sync_polarity;
+
+    // times the HSTX expander shows each line ring pixel (1, 2 or 4)
+    uint8_t pixel_repeat;
+};
+
+#define DVI_MODE_COUNT 5
+extern const struct dvi_mode dvi_modes[DVI_MODE_COUNT];
+
+// widest active area in the table, sizes the line ring
+#define DVI_MAX_ACTIVE_PIXELS 720
+
+// Where a stream lands in a mode: the largest aspect preserving fit, centered. Borders are TMDS repeats
+// of a black pixel in the command lists, only the content goes through the line ring.
+struct dvi_layout {
+    const struct dvi_mode *mode;
+
+    // output pixels / lines covered by the stream, and the left / top border
+    uint16_t content[2];
+    uint16_t border[2];
+
+    // whole factor the extent is scaled up by, 0 if it isn't
+    uint16_t scale;
+
+    // line ring pixels per content line (content[0] / pixel_repeat, a multiple of 4)
+    uint16_t line_pixels;
+
+    // DVI_LAYOUT_* it was laid out with
+    uint32_t flags;
+
+    // scanline numbering of the frame, vblank (front porch, sync, back porch) first
+    uint16_t v_sync_start;
+    uint16_t v_sync_end;
+    uint16_t v_active_start;
+    uint16_t v_content_start;
+    uint16_t v_content_end;
+    uint16_t v_total_lines;
+};
+
+// layout flags: fb rows are scanned out as they are (line_pixels is the extent's width, the mode's
+// pixel repeat is the whole horizontal scale), see dvi_chain_build
+#define DVI_LAYOUT_DIRECT 1
+// along with DIRECT, the fbs are 1bpp (lsb first) and read a word (32 pixels) at a time; only
+// unrepeated modes, extents a multiple of 32 wide, lit pixels are grey (a bit per lane is level 0x80)
+#define DVI_LAYOUT_1BPP 2
+
+// returns: 0 - success, -2 - the mode can't show extent (a repeating mode only takes whole factor
+// scales by a multiple of its repeat, other ones would show uneven pixel widths)
+int32_t dvi_layout_init(struct dvi_layout *l, const struct dvi_mode *m, const uint16_t extent[2], uint32_t flags);
+
+// Lay extent out in the mode covering most of its active area, then whole factor scales, then the
+// fewest line ring pixels per frame (fewest bus reads), then table order. Returns the mode, or null
+// (l untouched) when no mode can show extent.
+const struct dvi_mode *dvi_mode_pick(const uint16_t extent[2], uint32_t flags, struct dvi_layout *l);
+
+/* command lists */
+
+// longest list the generator makes (vactive with a left border)
+#define DVI_CMDLIST_MAX 11
+
+struct dvi_cmdlist {
+    uint32_t words[DVI_CMDLIST_MAX];
+    uint32_t count;
+};
+
+// Lists for each kind of line; a content line is its vactive list followed by the line ring slot, which
+// ends in line_tail (the right border). Lists are padded with NOPs to keep the scanout DMA from rapidly
+// pingponging between short transfers.
+struct dvi_cmdlists {
+    struct dvi_cmdlist vblank_vsync_off;
+    struct dvi_cmdlist vblank_vsync_on;
+    struct dvi_cmdlist vactive;
+    struct dvi_cmdlist vborder;
+
+    uint32_t line_tail[2];
+    uint32_t line_tail_count;
+};
+
+void dvi_build_cmdlists(struct dvi_cmdlists *c, const struct dvi_layout *l);
+
+enum dvi_line {
+    DVI_LINE_VSYNC_OFF,
+    DVI_LINE_VSYNC_ON,
+    DVI_LINE_BORDER,
+    DVI_LINE_CONTENT,
+};
+
+// the list scanline v of a frame starts with
+static inline enum dvi_line dvi_line_kind(const struct dvi_layout *l, uint32_t v) {
+    if (v >= l->v_sync_start && v < l->v_sync_end)
+        return DVI_LINE_VSYNC_ON;
+    else if (v < l->v_active_start)
+        return DVI_LINE_VSYNC_OFF;
+    else if (v < l->v_content_start || v >= l->v_content_end)
+        return DVI_LINE_BORDER;
+
+    return DVI_LINE_CONTENT;
+}
+
+/* scanout chain */
+
+// A DMA control block, as a control channel writes it over the data channel's read / write address,
+// transfer count and CTRL_TRIG registers.
+struct dvi_block {
+    uintptr_t read_addr;
+    uintptr_t write_addr;
+    uint32_t transfer_count;
+    uint32_t ctrl;
+};
+
+// CTRL_TRIG values for the kinds of block, the DMA setup is up to the caller
+struct dvi_chain_ctrl {
+    // 32-bit cmd list transfers into the HSTX FIFO
+    uint32_t words;
+    // fb transfers into the HSTX FIFO: 8-bit ones (a pixel, narrow writes are replicated over the
+    // whole word) for 8bpp fbs, 32-bit ones (32 pixels) for 1bpp fbs (DVI_LAYOUT_1BPP)
+    uint32_t pixels;
+    // the last block, writing the chain's address over the control channel's READ_ADDR_TRIG
+    uint32_t restart;
+};
+
+// A whole frame as control blocks, line by line from the top of vblank: each line's cmd list, a content
+// line's fb row in two pixel blocks (wrapping around the fb origin) and the right border after it. A
+// content line's pixel blocks are at content_first + line * content_stride.
+struct dvi_chain {
+    struct dvi_block *blocks;
+    uint32_t count;
+
+    uint32_t content_first;
+    uint32_t content_stride;
+    uint16_t content_lines;
+
+    uint16_t fb_extent[2];
+    uint32_t fb_stride;
+    uint8_t fb_bpp;
+};
+
+// blocks a chain of l needs
+uint32_t dvi_chain_size(const struct dvi_layout *l, const struct dvi_cmdlists *c);
+
+// Build the chain for a direct layout (DVI_LAYOUT_DIRECT) of 8bpp fbs (1bpp ones with DVI_LAYOUT_1BPP)
+// of extent / stride into blocks, c has to stay put while it runs. The restart block copies the word at
+// restart_read (the chain's address) to restart_write. Pixel blocks are pointed at an fb with
+// dvi_chain_point before it runs.
+void dvi_chain_build(struct dvi_chain *ch, struct dvi_block *blocks, const struct dvi_layout *l,
+    const struct dvi_cmdlists *c, const struct dvi_chain_ctrl *ctrl, uintptr_t fifo,
+    uintptr_t restart_read, uintptr_t restart_write, const uint16_t extent[2], uint32_t fb_stride);
+
+// point the content lines at fb, wrapping around origin (see bv_stream.fb_origins); a 1bpp fb's
+// origin[0] has to be a multiple of 32, a whole word (see bv_stream_pin_origin_x)
+void dvi_chain_point(struct dvi_chain *ch, const uint8_t *fb, const uint16_t origin[2]);
+
+/* tmds expander */
+
+// HSTX TMDS expander setup for a layout. Pixels are 0x00 / 0xff bytes, 4 to a word; repeating ones
+// rotate through a byte's 8 / pixel_repeat bit chunks, each of which reads the same level. Every lane
+// reads a whole chunk: lit pixels are level 0xff unrepeated, 0xf0 / 0xc0 at a repeat of 2 / 4. Direct
+// layouts read a word per pixel (a replicated 8-bit write), shown pixel_repeat times at 0xff, or on
+// 1bpp fbs 32 pixels a word, a bit each (lit pixels are only level 0x80, see DVI_LAYOUT_1BPP).
+struct dvi_expander {
+    uint8_t lane_nbits[3];  // bits minus one
+    uint8_t lane_rot[3];
+    uint8_t enc_n_shifts;  // 0 is 32
+    uint8_t enc_shift;
+};
+
+void dvi_expander_init(struct dvi_expander *x, const struct dvi_layout *l);
@@ -8,11 +8,16 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "media_clock.h"
+#include "telemetry.h"
+
 extern void setup_video();
 extern void setup_audio();
 
 extern void setup_hstx();
 extern void step_video();
+extern void present_video(int32_t late_us);
+extern uint16_t video_framerate();
 
 int main() {
     stdio_init_all();
@@ -24,29 +29,29 @@ int main() {
     
     set_sys_clock_khz(288000, true);
 
-    clock_configure(
-        clk_hstx,
-        CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
-        CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS,
-        288000,
-        125000
-    );
-
+    // the dvi mode (and the hstx clock) follow the stream's extent
+    setup_video();
     setup_hstx();
     busy_wait_ms(2000);
 
     multicore_launch_core1(setup_audio);
-    setup_video();
 
-    uint32_t t;
-    while (true) {
-        t = time_us_32();
+    // frames are timed against the audio, which starts playing once core1 announces itself
+    media_clock_start();
 
-        // stream video
+    const uint32_t framerate = video_framerate();
+    uint32_t frame = 0;
+
+    while (true) {
+        // decode ahead into the back fb
         step_video();
 
-        // wait until correct framerate
-        uint32_t delta = (time_us_32() - t);
-        busy_wait_us_32((1000000 / 30) - delta);
+        // sleep until the frame is due, late frames go out on the next vblank
+        int32_t late_us = media_clock_sleep_until((uint64_t)frame * 1000000 / framerate);
+        present_video(late_us);
+
+        frame += 1;
+
+        telemetry_poll();
     }
 }
@@ -0,0 +1,76 @@
+#include "media_clock.h"
+
+#include <pico/multicore.h>
+#include <pico/time.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* core1 side */
+
+void media_clock_announce(uint32_t sample_rate) {
+    multicore_fifo_push_blocking(sample_rate);
+}
+
+void media_clock_publish(uint32_t samples) {
+    // counts are cumulative, dropping one while core0 isn't draining the fifo loses nothing
+    if (multicore_fifo_wready())
+        multicore_fifo_push_blocking(samples);
+}
+
+/* core0 side */
+
+static uint32_t clock_rate;
+
+// last published sample count and the local time it arrived at
+static uint32_t clock_samples;
+static uint64_t clock_rx_us;
+static bool clock_running;
+
+// the clock never goes backwards, even when a publish lands behind the extrapolation
+static uint64_t clock_last_us;
+
+void media_clock_start() {
+    clock_rate = multicore_fifo_pop_blocking();
+}
+
+static void drain_fifo() {
+    while (multicore_fifo_rvalid()) {
+        clock_samples = multicore_fifo_pop_blocking();
+        clock_rx_us = time_us_64();
+        clock_running = true;
+    }
+}
+
+uint64_t media_clock_us() {
+    drain_fifo();
+
+    if (!clock_running)
+        return 0; // audio hasn't started yet
+
+    uint64_t given_us = (uint64_t)clock_samples * 1000000 / clock_rate;
+    uint64_t t = given_us > MEDIA_CLOCK_AUDIO_LATENCY_US ? given_us - MEDIA_CLOCK_AUDIO_LATENCY_US : 0;
+
+    // run on the local timer between publishes
+    t += time_us_64() - clock_rx_us;
+
+    if (t < clock_last_us)
+        t = clock_last_us;
+    clock_last_us = t;
+
+    return t;
+}
+
+int32_t media_clock_sleep_until(uint64_t t_us) {
+    while (true) {
+        uint64_t now = media_clock_us();
+        if (now >= t_us)
+            return now - t_us;
+
+        // until audio runs the clock can't move by itself, wait for a publish
+        absolute_time_t wake = clock_running ? make_timeout_time_us(t_us - now) : at_the_end_of_time;
+
+        // a publish from core1 is a sev and wakes us early, re-check against the new count
+        best_effort_wfe_or_timeout(wake);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+/* media clock */
+
+// Playback time shared between the cores. core1 publishes the pcm samples it
+// handed to the pwm driver over the multicore fifo, core0 turns them into a
+// clock the video frames get presented against.
+
+// pcm still queued in the pwm driver's playback buffers once a give returns,
+// subtracted so the clock tracks what's audible (about 2 x 576 samples @ 44.1kHz)
+#define MEDIA_CLOCK_AUDIO_LATENCY_US 26000
+
+// core1: announce the pcm sample rate, blocks until core0 is listening
+void media_clock_announce(uint32_t sample_rate);
+
+// core1: publish the total count of pcm samples given to the pwm driver so far, never blocks
+void media_clock_publish(uint32_t samples);
+
+// core0: wait for the audio core's announce
+void media_clock_start();
+
+// core0: current playback time in us
+uint64_t media_clock_us();
+
+// core0: sleep until the playback time reaches t_us; returns how far past t_us it woke up
+int32_t media_clock_sleep_until(uint64_t t_us);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* pcm ring */
+
+// Single-producer / single-consumer ring of interleaved int16 pcm frames (a
+// sample for each channel). The decoder writes into it, the pwm pump drains
+// it, so a slow packet only eats into the buffered audio instead of stalling
+// the output.
+
+// depth in frames, must be a power of two (8192 frames ~ 185ms @ 44.1kHz)
+#ifndef PCM_RING_FRAMES
+#define PCM_RING_FRAMES 8192
+#endif
+
+#define PCM_RING_MAX_CHANNELS 2
+
+_Static_assert((PCM_RING_FRAMES & (PCM_RING_FRAMES - 1)) == 0, "PCM_RING_FRAMES must be a power of two");
+
+struct pcm_ring {
+    int16_t frames[PCM_RING_FRAMES * PCM_RING_MAX_CHANNELS];
+    uint32_t channels;
+
+    // free running frame counts, head is only written by the producer, tail by the consumer
+    uint32_t head;
+    uint32_t tail;
+
+    // fill level bounds seen since playback started and the times the consumer found it dry
+    uint32_t high_water;
+    uint32_t low_water;
+    uint32_t underruns;
+};
+
+static inline void pcm_ring_init(struct pcm_ring *r, uint32_t channels) {
+    r->channels = channels;
+
+    r->head = 0;
+    r->tail = 0;
+
+    r->high_water = 0;
+    r->low_water = PCM_RING_FRAMES;
+    r->underruns = 0;
+}
+
+static inline uint32_t pcm_ring_fill(const struct pcm_ring *r) {
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/* producer side */
+
+// contiguous free frames at the head; returns their first sample, frames are interleaved by r->channels
+static inline int16_t *pcm_ring_write_window(struct pcm_ring *r, uint32_t *frames) {
+    const uint32_t head = r->head;
+    const uint32_t space = PCM_RING_FRAMES - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+    const uint32_t until_wrap = PCM_RING_FRAMES - head % PCM_RING_FRAMES;
+
+    *frames = space < until_wrap ? space : until_wrap;
+    return &r->frames[(head % PCM_RING_FRAMES) * r->channels];
+}
+
+// publish frames written into the last write window
+static inline void pcm_ring_commit(struct pcm_ring *r, uint32_t frames) {
+    const uint32_t head = r->head + frames;
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+    const uint32_t fill = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (fill > r->high_water)
+        r->high_water = fill;
+}
+
+/* consumer side */
+
+// contiguous buffered frames at the tail; returns their first sample
+static inline const int16_t *pcm_ring_read_window(struct pcm_ring *r, uint32_t *frames) {
+    const uint32_t tail = r->tail;
+    const uint32_t fill = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+    const uint32_t until_wrap = PCM_RING_FRAMES - tail % PCM_RING_FRAMES;
+
+    if (fill < r->low_water)
+        r->low_water = fill;
+
+    *frames = fill < until_wrap ? fill : until_wrap;
+    return &r->frames[(tail % PCM_RING_FRAMES) * r->channels];
+}
+
+// hand frames of the last read window back to the producer
+static inline void pcm_ring_release(struct pcm_ring *r, uint32_t frames) {
+    __atomic_store_n(&r->tail, r->tail + frames, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,80 @@
+#include "telemetry.h"
+
+#ifdef BA_TELEMETRY
+
+#include <pico/platform.h>
+#include <pico/stdlib.h>
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+_Static_assert((TELEMETRY_RECORDS & (TELEMETRY_RECORDS - 1)) == 0, "TELEMETRY_RECORDS must be a power of two");
+
+#define TELEMETRY_DUMP_CMD 't'
+
+struct telemetry_ring {
+    uint32_t head;
+    struct telemetry_record records[TELEMETRY_RECORDS];
+};
+
+// one ring per core, each only ever written by its own core's thread
+static struct telemetry_ring rings[NUM_CORES];
+
+static struct telemetry_record *next_record(uint32_t kind) {
+    struct telemetry_ring *ring = &rings[get_core_num()];
+    struct telemetry_record *r = &ring->records[ring->head % TELEMETRY_RECORDS];
+
+    r->t_us = time_us_32();
+    r->kind = kind;
+
+    ring->head += 1;
+    return r;
+}
+
+void telemetry_record_frame(const struct telemetry_frame *frame) {
+    next_record(TELEMETRY_FRAME)->frame = *frame;
+}
+
+void telemetry_record_audio(const struct telemetry_audio *audio) {
+    next_record(TELEMETRY_AUDIO)->audio = *audio;
+}
+
+/* dump */
+
+static void dump_ring(uint32_t core) {
+    static struct telemetry_record snapshot[TELEMETRY_RECORDS];
+
+    // the other core keeps writing, the oldest few records may come out torn
+    const uint32_t head = rings[core].head;
+    memcpy(snapshot, rings[core].records, sizeof(snapshot));
+
+    const uint32_t count = head < TELEMETRY_RECORDS ? head : TELEMETRY_RECORDS;
+
+    for (uint32_t i = head - count; i != head; i++) {
+        const struct telemetry_record *r = &snapshot[i % TELEMETRY_RECORDS];
+
+        switch (r->kind) {
+        case TELEMETRY_FRAME:
+            printf("f,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRId32 ",%" PRIu32 "\n", core, r->t_us, r->frame.frame, r->frame.decode_us, r->frame.scale_us, r->frame.bits, r->frame.late_us, r->frame.late_frames);
+            break;
+        case TELEMETRY_AUDIO:
+            printf("a,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n", core, r->t_us, r->audio.buffers, r->audio.samples, r->audio.fill, r->audio.low_water, r->audio.high_water, r->audio.underruns);
+            break;
+        }
+    }
+}
+
+void telemetry_poll() {
+    if (getchar_timeout_us(0) != TELEMETRY_DUMP_CMD)
+        return;
+
+    printf("f,core,t_us,frame,decode_us,scale_us,bits,late_us,late_frames\n");
+    printf("a,core,t_us,buffers,samples,fill,low_water,high_water,underruns\n");
+
+    for (uint32_t core = 0; core < NUM_CORES; core++)
+        dump_ring(core);
+}
+
+#endif
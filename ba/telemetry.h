@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+/* runtime telemetry */
+
+// Each core appends fixed-size records to its own ring, nothing is printed
+// until a 't' arrives over stdio and telemetry_poll dumps both rings.
+// Only built with BA_TELEMETRY (non-release builds), otherwise every call
+// below compiles to nothing.
+
+#define TELEMETRY_RECORDS 256 // per core, must be a power of two
+
+enum telemetry_kind {
+    TELEMETRY_NONE = 0,
+    TELEMETRY_FRAME,
+    TELEMETRY_AUDIO,
+};
+
+// a presented video frame (core0)
+struct telemetry_frame {
+    uint32_t frame;
+    uint32_t bits;     // bitstream consumed by its decode
+    uint32_t decode_us;
+    uint32_t scale_us; // scanline expansion while the previous frame was on-screen
+    int32_t late_us;   // presented after its timestamp by, negative when early
+    uint32_t late_frames;
+};
+
+// a decoded chunk of audio written into the pcm ring (core1)
+struct telemetry_audio {
+    uint32_t buffers;  // pcm ring writes so far
+    uint32_t samples;
+    uint32_t fill;     // pcm ring fill after the write, in frames
+    uint32_t low_water;
+    uint32_t high_water;
+    uint32_t underruns;
+};
+
+struct telemetry_record {
+    uint32_t t_us;
+    uint32_t kind;
+
+    union {
+        struct telemetry_frame frame;
+        struct telemetry_audio audio;
+    };
+};
+
+#ifdef BA_TELEMETRY
+
+#include <pico/time.h>
+
+#define telemetry_now() time_us_32()
+
+void telemetry_record_frame(const struct telemetry_frame *frame);
+void telemetry_record_audio(const struct telemetry_audio *audio);
+
+// check stdio for the dump command, call from core0's main loop
+void telemetry_poll();
+
+#else
+
+#define telemetry_now() 0u
+
+#define telemetry_record_frame(frame) ((void)(frame))
+#define telemetry_record_audio(audio) ((void)(audio))
+#define telemetry_poll() ((void)0)
+
+#endif
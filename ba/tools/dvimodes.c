@@ -0,0 +1,533 @@
+#include "dvi_mode.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// dvimodes - lays stream extents out in the dvi mode table and checks the generated command lists
+//
+// usage: dvimodes [WxH ...]
+//
+// Prints the mode picked for each extent (a built-in set by default), then plays a whole frame of every
+// mode that can show it through a model of the HSTX command expander and TMDS lanes: each line has to come
+// out as the mode's porches, syncs (at their polarity) and active pixels, with the line ring's pixels
+// repeated and bordered as laid out. Direct layouts are also played as a DMA control block chain reading
+// an 8bpp fb (and a 1bpp one where it can) at a few origins, the chain may only raise an IRQ at its end.
+// Exits 1 on any mismatch.
+
+static const uint16_t default_extents[][2] = {
+    { 160, 120 }, { 240, 180 }, { 320, 240 }, { 360, 240 }, { 480, 360 },
+    { 512, 384 }, { 640, 480 }, { 720, 480 }, { 1024, 768 }, { 4096, 64 }, { 8, 4096 },
+};
+
+static uint32_t failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        failures += 1; \
+        printf("  FAIL: "); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        return; \
+    } \
+} while (0)
+
+static uint32_t rotr(uint32_t x, uint32_t n) {
+    n %= 32;
+    return n ? x >> n | x << (32 - n) : x;
+}
+
+/* hstx model */
+
+#define SYM_RAW  0
+#define SYM_TMDS 1
+
+// an output symbol, a raw control word or the 8-bit values of lanes 0 / 1 / 2
+struct symbol {
+    uint8_t kind;
+    uint32_t raw;
+    uint8_t lanes[3];
+};
+
+struct hstx_model {
+    struct dvi_expander x;
+    struct symbol *out;
+    uint32_t out_count;
+    uint32_t out_cap;
+};
+
+static void tmds_pixel(const struct hstx_model *h, uint32_t view, struct symbol *s) {
+    s->kind = SYM_TMDS;
+    s->raw = 0;
+
+    for (uint32_t lane = 0; lane < 3; lane++) {
+        const uint32_t bits = h->x.lane_nbits[lane] + 1;
+        const uint32_t v = rotr(view, h->x.lane_rot[lane]) & 0xff;
+
+        s->lanes[lane] = v & (0xffu << (8 - bits));
+    }
+}
+
+static bool emit(struct hstx_model *h, struct symbol s) {
+    if (h->out_count == h->out_cap)
+        return false;
+
+    h->out[h->out_count++] = s;
+    return true;
+}
+
+// run words through the expander; returns false on a cmd running off the end or past out_cap
+static bool hstx_run(struct hstx_model *h, const uint32_t *words, uint32_t count) {
+    const uint32_t n_shifts = h->x.enc_n_shifts ? h->x.enc_n_shifts : 32;
+    uint32_t i = 0;
+
+    while (i < count) {
+        const uint32_t cmd = words[i] & HSTX_CMD_MASK;
+        const uint32_t n = words[i] & HSTX_CMD_COUNT;
+        i++;
+
+        struct symbol s = { 0 };
+
+        switch (cmd) {
+        case HSTX_CMD_RAW_REPEAT:
+            if (i >= count)
+                return false;
+            s.kind = SYM_RAW;
+            s.raw = words[i++];
+            for (uint32_t k = 0; k < n; k++)
+                if (!emit(h, s))
+                    return false;
+            break;
+        case HSTX_CMD_RAW:
+            for (uint32_t k = 0; k < n; k++) {
+                if (i >= count)
+                    return false;
+                s.kind = SYM_RAW;
+                s.raw = words[i++];
+                if (!emit(h, s))
+                    return false;
+            }
+            break;
+        case HSTX_CMD_TMDS:
+            for (uint32_t k = 0; k < n; k++) {
+                if (k % n_shifts == 0 && i++ >= count)
+                    return false;
+                tmds_pixel(h, rotr(words[i - 1], (k % n_shifts) * h->x.enc_shift), &s);
+                if (!emit(h, s))
+                    return false;
+            }
+            break;
+        case HSTX_CMD_TMDS_REPEAT:
+            if (i >= count)
+                return false;
+            tmds_pixel(h, words[i++], &s);
+            for (uint32_t k = 0; k < n; k++)
+                if (!emit(h, s))
+                    return false;
+            break;
+        case HSTX_CMD_NOP:
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* checks */
+
+// lane 0 control symbol for the hsync / vsync levels (c0 / c1), lanes 1 and 2 at 00
+static uint32_t expect_sync(uint32_t vlevel, uint32_t hlevel) {
+    static const uint32_t ctrl[4] = { 0x354, 0x0ab, 0x154, 0x2ab };
+    return ctrl[vlevel << 1 | hlevel] | 0x354u << 10 | 0x354u << 20;
+}
+
+// test pattern of the line ring, a byte per pixel
+static bool pattern_lit(uint32_t line, uint32_t pixel) {
+    return (pixel * 7 + line * 3) % 5 < 2;
+}
+
+static bool symbol_lit(const struct symbol *s) {
+    return s->lanes[0] && s->lanes[1] && s->lanes[2];
+}
+
+static bool symbol_black(const struct symbol *s) {
+    return !s->lanes[0] && !s->lanes[1] && !s->lanes[2];
+}
+
+static void check_list(const struct dvi_cmdlist *c, const char *name) {
+    CHECK(c->count <= DVI_CMDLIST_MAX, "%s list has %u words", name, c->count);
+}
+
+// symbol stream of a whole frame, and the words it's expanded from
+struct frame_model {
+    struct symbol *out;
+    uint32_t *words;
+    uint32_t word_count;
+    uint32_t word_cap;
+};
+
+static bool frame_push(struct frame_model *f, uint32_t word) {
+    if (f->word_count == f->word_cap)
+        return false;
+
+    f->words[f->word_count++] = word;
+    return true;
+}
+
+// frame pixel shown at content line / pixel of a layout
+typedef bool (*lit_fn)(const struct dvi_layout *l, const uint16_t extent[2], uint32_t line, uint32_t pixel);
+
+static bool line_ring_lit(const struct dvi_layout *l, const uint16_t extent[2], uint32_t line, uint32_t pixel) {
+    (void)l;
+    (void)extent;
+    return pattern_lit(line, pixel);
+}
+
+static bool fb_lit(const struct dvi_layout *l, const uint16_t extent[2], uint32_t line, uint32_t pixel) {
+    return pattern_lit(line * extent[1] / l->content[1], pixel);
+}
+
+// Expand the frame's words and check every line's porches, syncs and active pixels; a line ring / fb pixel
+// is shown pixel_repeat times.
+static void check_symbols(const struct dvi_layout *l, const uint16_t extent[2], struct frame_model *f, lit_fn lit) {
+    const struct dvi_mode *m = l->mode;
+    const uint32_t h_blank = m->h_front_porch + m->h_sync_width + m->h_back_porch;
+    const uint32_t h_total = h_blank + m->h_active_pixels;
+    const uint32_t repeat = m->pixel_repeat;
+
+    struct hstx_model h = { .out = f->out, .out_cap = h_total * l->v_total_lines };
+    dvi_expander_init(&h.x, l);
+
+    // lanes read a whole chunk of a lit byte: 0xff unrepeated or replicated, one bit of it on 1bpp fbs
+    const bool replicated = (l->flags & DVI_LAYOUT_DIRECT) && !(l->flags & DVI_LAYOUT_1BPP);
+    const uint32_t chunk = l->flags & DVI_LAYOUT_1BPP ? 1 : replicated ? 8 : 8 / repeat;
+    const uint8_t lit_level = 0xff << (8 - chunk);
+
+    CHECK(hstx_run(&h, f->words, f->word_count), "cmds run off the frame or past its symbols");
+    CHECK(h.out_count == h.out_cap, "%u symbols, the mode has %u", h.out_count, h.out_cap);
+
+    uint32_t vsync_lines = 0;
+    uint32_t active_lines = 0;
+    uint32_t content_lines = 0;
+
+    for (uint32_t v = 0; v < l->v_total_lines; v++) {
+        const enum dvi_line kind = dvi_line_kind(l, v);
+        const bool vsync = kind == DVI_LINE_VSYNC_ON;
+        const bool active = kind == DVI_LINE_BORDER || kind == DVI_LINE_CONTENT;
+        const uint32_t vlevel = vsync ? m->v_sync_polarity : !m->v_sync_polarity;
+
+        vsync_lines += vsync;
+        active_lines += active;
+        content_lines += kind == DVI_LINE_CONTENT;
+
+        for (uint32_t x = 0; x < h_total; x++) {
+            const struct symbol *s = &f->out[v * h_total + x];
+
+            if (x < h_blank || !active) {
+                const bool hsync = x >= m->h_front_porch && x < m->h_front_porch + m->h_sync_width;
+                const uint32_t hlevel = hsync ? m->h_sync_polarity : !m->h_sync_polarity;
+
+                CHECK(s->kind == SYM_RAW && s->raw == expect_sync(vlevel, hlevel),
+                    "line %u px %u: sync symbol %05x, expected %05x", v, x, s->raw, expect_sync(vlevel, hlevel));
+                continue;
+            }
+
+            CHECK(s->kind == SYM_TMDS, "line %u px %u: control symbol in the active area", v, x);
+
+            const uint32_t ax = x - h_blank;
+            const bool in_content = kind == DVI_LINE_CONTENT && ax >= l->border[0] && ax < l->border[0] + l->content[0];
+
+            if (!in_content) {
+                CHECK(symbol_black(s), "line %u px %u: border isn't black", v, x);
+            } else if (lit(l, extent, v - l->v_content_start, (ax - l->border[0]) / repeat)) {
+                CHECK(symbol_lit(s) && s->lanes[0] == lit_level && s->lanes[1] == lit_level && s->lanes[2] == lit_level,
+                    "line %u px %u: lit pixel reads %02x %02x %02x", v, x, s->lanes[0], s->lanes[1], s->lanes[2]);
+            } else {
+                CHECK(symbol_black(s), "line %u px %u: black pixel reads %02x %02x %02x",
+                    v, x, s->lanes[0], s->lanes[1], s->lanes[2]);
+            }
+        }
+
+        // vsync pulse right after the front porch lines
+        if (vsync)
+            CHECK(v >= m->v_front_porch && v < m->v_front_porch + m->v_sync_width, "line %u: vsync out of place", v);
+    }
+
+    CHECK(vsync_lines == m->v_sync_width, "%u vsync lines, the mode has %u", vsync_lines, m->v_sync_width);
+    CHECK(active_lines == m->v_active_lines, "%u active lines, the mode has %u", active_lines, m->v_active_lines);
+    CHECK(content_lines == l->content[1], "%u content lines, laid out %u", content_lines, l->content[1]);
+}
+
+static void frame_alloc(struct frame_model *f, const struct dvi_layout *l) {
+    const struct dvi_mode *m = l->mode;
+    const uint32_t h_total = m->h_front_porch + m->h_sync_width + m->h_back_porch + m->h_active_pixels;
+
+    f->out = malloc(sizeof(*f->out) * h_total * l->v_total_lines);
+    f->word_cap = (DVI_CMDLIST_MAX + DVI_MAX_ACTIVE_PIXELS + 2) * l->v_total_lines;
+    f->words = malloc(sizeof(*f->words) * f->word_cap);
+    f->word_count = 0;
+}
+
+static void frame_free(struct frame_model *f) {
+    free(f->out);
+    free(f->words);
+}
+
+// IRQ scanout, the lists posted line by line, a content line's pixels from the line ring
+static void check_frame(const struct dvi_mode *m, const uint16_t extent[2]) {
+    struct dvi_layout l;
+    if (dvi_layout_init(&l, m, extent, 0) < 0)
+        return;
+
+    const uint32_t repeat = m->pixel_repeat;
+
+    printf("  %-14s %ux%u at %u,%u, scale %u, %u line ring px\n", m->name,
+        l.content[0], l.content[1], l.border[0], l.border[1], l.scale, l.line_pixels);
+
+    CHECK(l.content[0] <= m->h_active_pixels && l.content[1] <= m->v_active_lines, "content past the active area");
+    CHECK(l.line_pixels * repeat == l.content[0] && l.line_pixels % 4 == 0, "line ring px don't fill whole words");
+    CHECK(l.line_pixels <= DVI_MAX_ACTIVE_PIXELS, "line ring px past DVI_MAX_ACTIVE_PIXELS");
+    CHECK(repeat == 1 || (l.scale && l.scale % repeat == 0), "repeat %u at scale %u", repeat, l.scale);
+    CHECK(l.content[0] == m->h_active_pixels || l.content[1] == m->v_active_lines, "content doesn't touch the edges");
+
+    // aspect within a line ring word of the stream's
+    const int64_t aspect_err = (int64_t)l.content[0] * extent[1] - (int64_t)l.content[1] * extent[0];
+    CHECK(llabs(aspect_err) < (int64_t)(4 * repeat + 1) * extent[1] + extent[0], "aspect off by %lld", (long long)aspect_err);
+
+    struct dvi_cmdlists c;
+    dvi_build_cmdlists(&c, &l);
+
+    check_list(&c.vblank_vsync_off, "vblank_vsync_off");
+    check_list(&c.vblank_vsync_on, "vblank_vsync_on");
+    check_list(&c.vactive, "vactive");
+    check_list(&c.vborder, "vborder");
+
+    struct frame_model f;
+    frame_alloc(&f, &l);
+
+    for (uint32_t v = 0; v < l.v_total_lines; v++) {
+        const enum dvi_line kind = dvi_line_kind(&l, v);
+        const struct dvi_cmdlist *list =
+            kind == DVI_LINE_VSYNC_ON ? &c.vblank_vsync_on :
+            kind == DVI_LINE_VSYNC_OFF ? &c.vblank_vsync_off :
+            kind == DVI_LINE_BORDER ? &c.vborder : &c.vactive;
+
+        for (uint32_t i = 0; i < list->count; i++)
+            frame_push(&f, list->words[i]);
+
+        // a content line's second transfer, the line ring slot
+        if (kind == DVI_LINE_CONTENT) {
+            for (uint32_t w = 0; w < l.line_pixels / 4; w++) {
+                uint32_t word = 0;
+                for (uint32_t px = 0; px < 4; px++)
+                    word |= (pattern_lit(v - l.v_content_start, w * 4 + px) ? 0xffu : 0) << (px * 8);
+                frame_push(&f, word);
+            }
+            for (uint32_t i = 0; i < c.line_tail_count; i++)
+                frame_push(&f, c.line_tail[i]);
+        }
+    }
+
+    check_symbols(&l, extent, &f, line_ring_lit);
+    frame_free(&f);
+}
+
+/* chain scanout */
+
+#define CTRL_WORDS   0x11
+#define CTRL_PIXELS  0x22
+#define CTRL_RESTART 0x33
+
+static uint32_t fake_fifo;
+static uintptr_t fake_ctrl_read_addr;
+
+// walk the chain the way the control and data channels would, into f's words; the restart block has
+// to copy the chain's address (at restart_read) over the control channel's read address
+static void run_chain(const struct dvi_chain *ch, const uint8_t *fb, uint32_t fb_size, uintptr_t restart_read, struct frame_model *f) {
+    for (uint32_t i = 0; i < ch->count; i++) {
+        const struct dvi_block *b = &ch->blocks[i];
+        const bool last = i + 1 == ch->count;
+
+        // only the last block may raise an IRQ
+        CHECK((b->ctrl == CTRL_RESTART) == last, "block %u: ctrl %x", i, b->ctrl);
+
+        if (last) {
+            CHECK(b->read_addr == restart_read && b->write_addr == (uintptr_t)&fake_ctrl_read_addr && b->transfer_count == 1,
+                "restart block doesn't restart the control channel");
+            CHECK(*(const uintptr_t *)b->read_addr == (uintptr_t)ch->blocks, "restart block restarts elsewhere");
+            continue;
+        }
+
+        CHECK(b->write_addr == (uintptr_t)&fake_fifo, "block %u doesn't write the fifo", i);
+        CHECK(b->transfer_count, "block %u: empty transfer", i);
+
+        if (b->ctrl == CTRL_PIXELS && ch->fb_bpp == 1) {
+            // whole words, lsb first
+            const uint8_t *src = (const uint8_t *)b->read_addr;
+            CHECK(src >= fb && src + b->transfer_count * 4 <= fb + fb_size, "block %u reads past the fb", i);
+            CHECK((src - fb) % 4 == 0, "block %u reads an unaligned word", i);
+
+            for (uint32_t k = 0; k < b->transfer_count; k++) {
+                const uint8_t *word = &src[k * 4];
+                CHECK(frame_push(f, word[0] | word[1] << 8 | word[2] << 16 | (uint32_t)word[3] << 24), "frame past its words");
+            }
+        } else if (b->ctrl == CTRL_PIXELS) {
+            const uint8_t *src = (const uint8_t *)b->read_addr;
+            CHECK(src >= fb && src + b->transfer_count <= fb + fb_size, "block %u reads past the fb", i);
+
+            for (uint32_t k = 0; k < b->transfer_count; k++)
+                CHECK(frame_push(f, src[k] * 0x01010101u), "frame past its words");
+        } else {
+            CHECK(b->ctrl == CTRL_WORDS, "block %u: ctrl %x", i, b->ctrl);
+
+            const uint32_t *src = (const uint32_t *)b->read_addr;
+            for (uint32_t k = 0; k < b->transfer_count; k++)
+                CHECK(frame_push(f, src[k]), "frame past its words");
+        }
+    }
+}
+
+static void check_chain(const struct dvi_mode *m, const uint16_t extent[2], uint32_t flags) {
+    struct dvi_layout l;
+    if (dvi_layout_init(&l, m, extent, flags) < 0)
+        return;
+
+    const bool packed = flags & DVI_LAYOUT_1BPP;
+
+    printf("  %-14s %ux%u at %u,%u direct%s\n", m->name, l.content[0], l.content[1], l.border[0], l.border[1],
+        packed ? " 1bpp" : "");
+
+    CHECK(l.line_pixels == extent[0] && l.scale == m->pixel_repeat, "direct layout scales the fb");
+
+    struct dvi_cmdlists c;
+    dvi_build_cmdlists(&c, &l);
+
+    const uint32_t w = extent[0];
+    const uint32_t h = extent[1];
+    const uint32_t stride = packed ? w / 8 : w;
+    const struct dvi_chain_ctrl ctrl = { CTRL_WORDS, CTRL_PIXELS, CTRL_RESTART };
+
+    struct dvi_chain ch;
+    const uint32_t block_count = dvi_chain_size(&l, &c);
+    struct dvi_block *blocks = malloc(sizeof(*blocks) * block_count);
+    uintptr_t head = (uintptr_t)blocks;
+
+    dvi_chain_build(&ch, blocks, &l, &c, &ctrl, (uintptr_t)&fake_fifo, (uintptr_t)&head,
+        (uintptr_t)&fake_ctrl_read_addr, extent, stride);
+
+    uint8_t *fb = malloc(stride * h);
+    struct frame_model f;
+    frame_alloc(&f, &l);
+
+    // 1bpp origins move a word at a time (bv_stream_pin_origin_x keeps the decoder's at 0)
+    const uint16_t origins[][2] = { { 0, 0 }, { 4, 1 }, { 5 % w, 3 % h }, { w - 1, h - 1 } };
+    const uint16_t packed_origins[][2] = { { 0, 0 }, { 0, 1 }, { 32 % w, 3 % h }, { w - 32, h - 1 } };
+
+    for (uint32_t o = 0; o < sizeof(origins) / sizeof(origins[0]); o++) {
+        const uint16_t *origin = packed ? packed_origins[o] : origins[o];
+
+        // frame pixel x, y lives at x + origin[0], y + origin[1], wrapped
+        memset(fb, 0, stride * h);
+
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                const uint32_t fb_x = (x + origin[0]) % w;
+                uint8_t *row = &fb[(y + origin[1]) % h * stride];
+
+                if (packed)
+                    row[fb_x / 8] |= pattern_lit(y, x) << (fb_x % 8);
+                else
+                    row[fb_x] = pattern_lit(y, x) ? 0xff : 0;
+            }
+        }
+
+        dvi_chain_point(&ch, fb, origin);
+
+        CHECK(ch.count == block_count, "%u blocks, sized for %u", ch.count, block_count);
+
+        const uint32_t failed = failures;
+        f.word_count = 0;
+        run_chain(&ch, fb, stride * h, (uintptr_t)&head, &f);
+
+        if (failures == failed)
+            check_symbols(&l, extent, &f, fb_lit);
+        if (failures != failed) {
+            printf("  (origin %u,%u)\n", origin[0], origin[1]);
+            break;
+        }
+    }
+
+    frame_free(&f);
+    free(fb);
+    free(blocks);
+}
+
+static bool parse_extent(const char *arg, uint16_t extent[2]) {
+    unsigned w, h;
+    char end;
+
+    if (sscanf(arg, "%ux%u%c", &w, &h, &end) != 2 || !w || !h || w > 0xffff || h > 0xffff)
+        return false;
+
+    extent[0] = w;
+    extent[1] = h;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint32_t extent_count = argc > 1 ? (uint32_t)argc - 1 : sizeof(default_extents) / sizeof(default_extents[0]);
+    uint16_t (*extents)[2] = calloc(extent_count, sizeof(*extents));
+
+    for (uint32_t i = 0; i < extent_count; i++) {
+        if (argc == 1) {
+            extents[i][0] = default_extents[i][0];
+            extents[i][1] = default_extents[i][1];
+        } else if (!parse_extent(argv[i + 1], extents[i])) {
+            fprintf(stderr, "usage: %s [WxH ...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (uint32_t i = 0; i < extent_count; i++) {
+        struct dvi_layout l;
+        const struct dvi_mode *m = dvi_mode_pick(extents[i], 0, &l);
+
+        if (m)
+            printf("%ux%u: %s, %ux%u at %u,%u\n", extents[i][0], extents[i][1], m->name,
+                l.content[0], l.content[1], l.border[0], l.border[1]);
+        else
+            printf("%ux%u: no mode\n", extents[i][0], extents[i][1]);
+
+        m = dvi_mode_pick(extents[i], DVI_LAYOUT_DIRECT, &l);
+
+        if (m)
+            printf("%ux%u direct: %s, %ux%u at %u,%u\n", extents[i][0], extents[i][1], m->name,
+                l.content[0], l.content[1], l.border[0], l.border[1]);
+
+        m = dvi_mode_pick(extents[i], DVI_LAYOUT_DIRECT | DVI_LAYOUT_1BPP, &l);
+
+        if (m)
+            printf("%ux%u direct 1bpp: %s, %ux%u at %u,%u\n", extents[i][0], extents[i][1], m->name,
+                l.content[0], l.content[1], l.border[0], l.border[1]);
+
+        for (uint32_t k = 0; k < DVI_MODE_COUNT; k++) {
+            check_frame(&dvi_modes[k], extents[i]);
+            check_chain(&dvi_modes[k], extents[i], DVI_LAYOUT_DIRECT);
+            check_chain(&dvi_modes[k], extents[i], DVI_LAYOUT_DIRECT | DVI_LAYOUT_1BPP);
+        }
+    }
+
+    free(extents);
+
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+
+    printf("all lists ok\n");
+    return 0;
+}
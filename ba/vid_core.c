@@ -6,11 +6,12 @@
 #include <string.h>
 #include <stdio.h>
 
-static uint8_t *active_fb = 0x20000000;
-static uint8_t dvi_fb[640 * 180];
+static uint8_t *volatile active_fb = 0x20000000;
+static uint16_t active_origin[2];
 
 /* dvi driver */
 
+#include <hardware/clocks.h>
 #include <hardware/dma.h>
 #include <hardware/gpio.h>
 #include <hardware/irq.h>
@@ -18,95 +19,16 @@ static uint8_t dvi_fb[640 * 180];
 #include <hardware/structs/hstx_ctrl.h>
 #include <hardware/structs/hstx_fifo.h>
 
-// ----------------------------------------------------------------------------
-// DVI constants
-
-#define TMDS_CTRL_00 0x354u
-#define TMDS_CTRL_01 0x0abu
-#define TMDS_CTRL_10 0x154u
-#define TMDS_CTRL_11 0x2abu
-
-#define SYNC_V0_H0 (TMDS_CTRL_00 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
-#define SYNC_V0_H1 (TMDS_CTRL_01 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
-#define SYNC_V1_H0 (TMDS_CTRL_10 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
-#define SYNC_V1_H1 (TMDS_CTRL_11 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
-
-#define MODE_H_SYNC_POLARITY 0
-#define MODE_H_FRONT_PORCH   16
-#define MODE_H_SYNC_WIDTH    96
-#define MODE_H_BACK_PORCH    48
-#define MODE_H_ACTIVE_PIXELS 640
-
-#define MODE_V_SYNC_POLARITY 0
-#define MODE_V_FRONT_PORCH   10
-#define MODE_V_SYNC_WIDTH    2
-#define MODE_V_BACK_PORCH    33
-#define MODE_V_ACTIVE_LINES  480
-
-/* #define MODE_H_SYNC_POLARITY 0
-#define MODE_H_FRONT_PORCH   8
-#define MODE_H_SYNC_WIDTH    16
-#define MODE_H_BACK_PORCH    24
-#define MODE_H_ACTIVE_PIXELS 240
-
-#define MODE_V_SYNC_POLARITY 1
-#define MODE_V_FRONT_PORCH   3
-#define MODE_V_SYNC_WIDTH    4
-#define MODE_V_BACK_PORCH    6
-#define MODE_V_ACTIVE_LINES  180 */
-
-#define MODE_H_TOTAL_PIXELS ( \
-    MODE_H_FRONT_PORCH + MODE_H_SYNC_WIDTH + \
-    MODE_H_BACK_PORCH  + MODE_H_ACTIVE_PIXELS \
-)
-#define MODE_V_TOTAL_LINES  ( \
-    MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + \
-    MODE_V_BACK_PORCH  + MODE_V_ACTIVE_LINES \
-)
-
-#define HSTX_CMD_RAW         (0x0u << 12)
-#define HSTX_CMD_RAW_REPEAT  (0x1u << 12)
-#define HSTX_CMD_TMDS        (0x2u << 12)
-#define HSTX_CMD_TMDS_REPEAT (0x3u << 12)
-#define HSTX_CMD_NOP         (0xfu << 12)
+#include "dvi_mode.h"
 
 // ----------------------------------------------------------------------------
 // HSTX command lists
 
-// Lists are padded with NOPs to be >= HSTX FIFO size, to avoid DMA rapidly
-// pingponging and tripping up the IRQs.
-
-static uint32_t vblank_line_vsync_off[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-    SYNC_V1_H1,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-    SYNC_V1_H0,
-    HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
-    SYNC_V1_H1,
-    HSTX_CMD_NOP
-};
-
-static uint32_t vblank_line_vsync_on[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-    SYNC_V0_H1,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-    SYNC_V0_H0,
-    HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
-    SYNC_V0_H1,
-    HSTX_CMD_NOP
-};
-
-static uint32_t vactive_line[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-    SYNC_V1_H1,
-    HSTX_CMD_NOP,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-    SYNC_V1_H0,
-    HSTX_CMD_NOP,
-    HSTX_CMD_RAW_REPEAT | MODE_H_BACK_PORCH,
-    SYNC_V1_H1,
-    HSTX_CMD_TMDS       | MODE_H_ACTIVE_PIXELS
-};
+// The mode is picked for the stream's extent in setup_video, its lists are
+// generated from the mode table in setup_hstx.
+
+static struct dvi_layout dvi_layout;
+static struct dvi_cmdlists dvi_lists;
 
 // ----------------------------------------------------------------------------
 // DMA logic
@@ -125,10 +47,24 @@ static uint32_t ch_num = 0;
 // This is the third scanline overall (-> =2 because zero-based).
 static uint v_scanline = DMACH_NUM;
 
-// During the vertical active period, we take two IRQs per scanline: one to
-// post the command list, and another to post the pixels.
+// During the content lines, we take two IRQs per scanline: one to post the
+// command list, and another to post the pixels. Border lines are all in
+// their command list.
 static bool vactive_cmdlist_posted = false;
 
+// line ring words posted per content line, the pixels and the right border
+static uint32_t line_words;
+
+// Swaps in the next decoded frame, called from the IRQ at the start of vblank.
+static void vblank_present();
+
+// Expands the pixels of a content line into the line ring, called from the
+// IRQ when the line's pixels get posted.
+static const uint8_t *scanline_pixels(uint32_t content_line);
+
+// Fills in the right border behind each line ring slot's pixels.
+static void setup_line_ring();
+
 void __time_critical_func(dma_irq_handler)() {
     // ch_num indicates the channel that just finished, which is the one
     // we're about to reload.
@@ -137,44 +73,130 @@ void __time_critical_func(dma_irq_handler)() {
 
     ch_num = (ch_num + 1) % DMACH_NUM;
 
-    if (v_scanline >= MODE_V_FRONT_PORCH && v_scanline < (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH)) {
-        ch->read_addr = (uintptr_t)vblank_line_vsync_on;
-        ch->transfer_count = count_of(vblank_line_vsync_on);
-    } else if (v_scanline < MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH) {
-        ch->read_addr = (uintptr_t)vblank_line_vsync_off;
-        ch->transfer_count = count_of(vblank_line_vsync_off);
+    const enum dvi_line line = dvi_line_kind(&dvi_layout, v_scanline);
+
+    if (line == DVI_LINE_VSYNC_ON) {
+        ch->read_addr = (uintptr_t)dvi_lists.vblank_vsync_on.words;
+        ch->transfer_count = dvi_lists.vblank_vsync_on.count;
+    } else if (line == DVI_LINE_VSYNC_OFF) {
+        ch->read_addr = (uintptr_t)dvi_lists.vblank_vsync_off.words;
+        ch->transfer_count = dvi_lists.vblank_vsync_off.count;
+    } else if (line == DVI_LINE_BORDER) {
+        ch->read_addr = (uintptr_t)dvi_lists.vborder.words;
+        ch->transfer_count = dvi_lists.vborder.count;
     } else if (!vactive_cmdlist_posted) {
-        ch->read_addr = (uintptr_t)vactive_line;
-        ch->transfer_count = count_of(vactive_line);
+        ch->read_addr = (uintptr_t)dvi_lists.vactive.words;
+        ch->transfer_count = dvi_lists.vactive.count;
         vactive_cmdlist_posted = true;
     } else {
-        uint32_t prescale_scanline = (v_scanline - (MODE_V_TOTAL_LINES - MODE_V_ACTIVE_LINES)) * 180 / MODE_V_ACTIVE_LINES;
+        uint32_t content_line = v_scanline - dvi_layout.v_content_start;
 
-        ch->read_addr = (uintptr_t)&dvi_fb[prescale_scanline * MODE_H_ACTIVE_PIXELS];
-        ch->transfer_count = MODE_H_ACTIVE_PIXELS / sizeof(uint32_t);
+        ch->read_addr = (uintptr_t)scanline_pixels(content_line);
+        ch->transfer_count = line_words;
         vactive_cmdlist_posted = false;
     }
 
     if (!vactive_cmdlist_posted) {
-        v_scanline = (v_scanline + 1) % MODE_V_TOTAL_LINES;
+        v_scanline = (v_scanline + 1) % dvi_layout.v_total_lines;
+
+        if (v_scanline == 0)
+            vblank_present();
     }
 }
 
+#ifdef BA_VIDEO_CB_SCANOUT
+// ----------------------------------------------------------------------------
+// Control block scanout
+
+// Streams that fit a mode at a whole factor (DVI_LAYOUT_DIRECT) are scanned
+// out without per-line IRQs: the whole frame is a chain of DMA control blocks
+// (see dvi_chain_build), which the control channel loads into the data
+// channel's registers one at a time, the data channel chaining back to it
+// after each. The fbs go straight into the HSTX FIFO, the chain's last block
+// restarts the control channel and is the only one raising an IRQ, once per
+// frame at the top of vblank.
+//
+// The fbs are 8bpp, a byte (replicated over a word) per pixel, when both fit
+// CB_FB_BUDGET, any whole factor the mode repeats pixels by. Only with
+// BA_VIDEO_CB_1BPP, larger streams keep the decoder's 1bpp fbs and are read
+// a word (32 pixels) at a time, shown 1:1 in an unrepeated mode; rows have
+// to be a multiple of 32 wide and the decoder keeps the fbs' origin[0] at 0
+// (bv_stream_pin_origin_x), a word can't start at any pixel. A 1-bit lane
+// only reaches TMDS level 0x80, lit 1bpp pixels are grey.
+//
+// Streams up to 81920 pixels (eg. 320x240, at x2) take the 8bpp chain. The
+// shipped 480x360 stream goes through the line ring, scaled to the whole
+// screen, unless BA_VIDEO_CB_1BPP sends it down the 1bpp chain (1:1 at 80,60
+// in 640x480@60). Every stream without BA_VIDEO_CB_SCANOUT takes the ring.
+
+#define DMACH_CB_DATA 0
+#define DMACH_CB_CTRL 1
+
+// both 8bpp fbs have to fit this
+#define CB_FB_BUDGET (160 * 1024)
+
+_Static_assert(sizeof(struct dvi_block) == 4 * sizeof(uint32_t), "a dvi_block is the data channel's AL0 registers");
+
+static bool cb_scanout = false;
+
+static struct dvi_chain cb_chain;
+static struct dvi_block *cb_chain_head;
+
+// Builds the chain and sets up the two channels.
+static void setup_cb_dma();
+
+// Points the content lines at the active fb if it changed since.
+static void cb_point();
+
+void __time_critical_func(cb_irq_handler)() {
+    dma_hw->intr = 1u << DMACH_CB_DATA;
+
+    // the control channel is back at the top of the chain, the first content
+    // line is a vblank away
+    vblank_present();
+    cb_point();
+}
+#endif
+
 void setup_hstx() {
-    // Configure HSTX's TMDS encoder for RGB332
+    const struct dvi_mode *mode = dvi_layout.mode;
+
+    dvi_build_cmdlists(&dvi_lists, &dvi_layout);
+    setup_line_ring();
+    line_words = dvi_layout.line_pixels / sizeof(uint32_t) + dvi_lists.line_tail_count;
+
+    // One TMDS symbol every 5 HSTX cycles (see below), the 640x480 modes
+    // run at 125 MHz, which gives 250 Mbps, very close to the bit clock for
+    // 480p 60Hz (252 MHz). If we want the exact rate then we'll have to
+    // reconfigure PLLs.
+    clock_configure(
+        clk_hstx,
+        CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
+        CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS,
+        clock_get_hz(clk_sys) / 1000,
+        mode->pixel_khz * 5
+    );
+
+    // Configure HSTX's TMDS encoder for RGB332, repeating pixels rotate
+    // through each byte in smaller chunks, replicated ones are a word each,
+    // 1bpp ones a bit each (see dvi_expander_init)
+    struct dvi_expander x;
+    dvi_expander_init(&x, &dvi_layout);
+
     hstx_ctrl_hw->expand_tmds =
-        2  << HSTX_CTRL_EXPAND_TMDS_L2_NBITS_LSB |
-        0  << HSTX_CTRL_EXPAND_TMDS_L2_ROT_LSB   |
-        2  << HSTX_CTRL_EXPAND_TMDS_L1_NBITS_LSB |
-        29 << HSTX_CTRL_EXPAND_TMDS_L1_ROT_LSB   |
-        1  << HSTX_CTRL_EXPAND_TMDS_L0_NBITS_LSB |
-        26 << HSTX_CTRL_EXPAND_TMDS_L0_ROT_LSB;
-
-    // Pixels (TMDS) come in 4 8-bit chunks. Control symbols (RAW) are an
-    // entire 32-bit word.
+        x.lane_nbits[2] << HSTX_CTRL_EXPAND_TMDS_L2_NBITS_LSB |
+        x.lane_rot[2]   << HSTX_CTRL_EXPAND_TMDS_L2_ROT_LSB   |
+        x.lane_nbits[1] << HSTX_CTRL_EXPAND_TMDS_L1_NBITS_LSB |
+        x.lane_rot[1]   << HSTX_CTRL_EXPAND_TMDS_L1_ROT_LSB   |
+        x.lane_nbits[0] << HSTX_CTRL_EXPAND_TMDS_L0_NBITS_LSB |
+        x.lane_rot[0]   << HSTX_CTRL_EXPAND_TMDS_L0_ROT_LSB;
+
+    // Pixels (TMDS) come in 4 8-bit chunks, times the pixel repeat (or a
+    // word per pixel, or 32 bits). Control symbols (RAW) are an entire
+    // 32-bit word.
     hstx_ctrl_hw->expand_shift =
-        4 << HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB |
-        8 << HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB |
+        x.enc_n_shifts << HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB |
+        x.enc_shift    << HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB |
         1 << HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB |
         0 << HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB;
 
@@ -188,11 +210,6 @@ void setup_hstx() {
         2u << HSTX_CTRL_CSR_SHIFT_LSB |
         HSTX_CTRL_CSR_EN_BITS;
 
-    // Note we are leaving the HSTX clock at the SDK default of 125 MHz; since
-    // we shift out two bits per HSTX clock cycle, this gives us an output of
-    // 250 Mbps, which is very close to the bit clock for 480p 60Hz (252 MHz).
-    // If we want the exact rate then we'll have to reconfigure PLLs.
-
     // HSTX outputs 0 through 7 appear on GPIO 12 through 19.
     // Pinout on Pico DVI sock:
     //
@@ -223,6 +240,15 @@ void setup_hstx() {
         gpio_set_function(i, 0); // HSTX
     }
 
+    bus_ctrl_hw->priority = BUSCTRL_BUS_PRIORITY_DMA_W_BITS | BUSCTRL_BUS_PRIORITY_DMA_R_BITS;
+
+#ifdef BA_VIDEO_CB_SCANOUT
+    if (cb_scanout) {
+        setup_cb_dma();
+        return;
+    }
+#endif
+
     // All channels are set up identically, to transfer a whole scanline and
     // then chain to the next channel. Each time a channel finishes, we
     // reconfigure the one that just finished, meanwhile the next channel
@@ -238,8 +264,8 @@ void setup_hstx() {
             i,
             &c,
             &hstx_fifo_hw->fifo,
-            vblank_line_vsync_off,
-            count_of(vblank_line_vsync_off),
+            dvi_lists.vblank_vsync_off.words,
+            dvi_lists.vblank_vsync_off.count,
             false
         );
         dma_channel_claim(i);
@@ -252,78 +278,434 @@ void setup_hstx() {
     irq_set_enabled(DMA_IRQ_NUM(DVI_DMA_IRQ), true);
     irq_set_priority(DMA_IRQ_NUM(DVI_DMA_IRQ), 4);
 
-    bus_ctrl_hw->priority = BUSCTRL_BUS_PRIORITY_DMA_W_BITS | BUSCTRL_BUS_PRIORITY_DMA_R_BITS;
-
     dma_channel_start(0);
 }
 
 /* bv decoder */
 
 #include <bv/bvdec.h>
+#include <bv/bvscale.h>
 #include "vid_file.h"
-
-static uint32_t flash_seek = 0;
+#include "telemetry.h"
 
 static struct bv_stream bv_s;
 static uint8_t *bv_fbs[2];
 
-static void print_frame() {
-    const uint32_t y_step = bv_s.extent[1] / 8, x_step = bv_s.extent[0] / 32;
-    const uint32_t row_step = bv_s.extent[0] / 8;
+// Content lines are expanded from the on-screen fb into a small ring just
+// ahead of the DMA, repeated lines reuse the last expanded slot. Each slot
+// ends in the right border's cmd.
+#define LINE_RING_SIZE 4
 
-    for (uint32_t y = 0; y < bv_s.extent[1]; y += y_step) {
-        for (uint32_t x = 0; x < bv_s.extent[0]; x += x_step) {
-            uint8_t b = active_fb[x + y * bv_s.extent[0]];
-            if (b) printf("#"); else printf(" ");
-        }
-        printf("\n");
+static uint32_t line_ring[LINE_RING_SIZE][DVI_MAX_ACTIVE_PIXELS / sizeof(uint32_t) + 2];
+static uint32_t line_slot = 0;
+static int32_t line_src_row = -1;
+
+static struct bv_scaler bv_sc;
+static volatile bool bv_sc_ready = false;
+
+// set by present_video once the decoded frame is due, the swap happens at the following vblank
+static volatile bool present_armed = false;
+
+// telemetry, scanline expansion time of the current / last refresh and the last decode
+static uint32_t scale_us_acc = 0;
+static volatile uint32_t scale_us_last = 0;
+
+static uint32_t decode_us_last = 0;
+static uint32_t decode_bits_last = 0;
+static uint32_t late_frames = 0;
+
+#ifdef BA_VIDEO_DMA_FEED
+// Stream bad_bv out of flash into the bv read buffer with a spare DMA channel instead of decoding it
+// through XIP, so the bitstream doesn't evict code from the XIP cache. The decoder only ever waits on
+// it at startup, one chunk is in flight while the rest of the buffer is decoded.
+#define DMACH_FEED 6
+#define FEED_CHUNK 512
+
+// the final frame isn't terminated by a flip, zero padding decodes as one
+#define FEED_TAIL_PAD 5
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+static dma_channel_config feed_cfg;
+static uint32_t feed_seek = 0;
+static uint32_t feed_inflight = 0;
+
+// commit a landed chunk and start the next one; polled from the decode loop, never blocks
+static void feed_service() {
+    if (feed_inflight) {
+        if (dma_channel_is_busy(DMACH_FEED))
+            return;
+
+        bv_stream_commit(&bv_s, feed_inflight);
+        feed_seek += feed_inflight;
+        feed_inflight = 0;
+    }
+
+    if (bv_s.input_ended)
+        return;
+
+    uint32_t space;
+    uint8_t *window = bv_stream_write_window(&bv_s, &space);
+
+    if (feed_seek < bad_bv_len) {
+        if (!space)
+            return;
+
+        feed_inflight = MIN(MIN(space, FEED_CHUNK), bad_bv_len - feed_seek);
+        dma_channel_configure(DMACH_FEED, &feed_cfg, window, &bad_bv[feed_seek], feed_inflight, true);
+    } else if (space >= FEED_TAIL_PAD) {
+        memset(window, 0, FEED_TAIL_PAD);
+        bv_stream_commit(&bv_s, FEED_TAIL_PAD);
+        bv_stream_end_input(&bv_s);
+    }
+}
+
+static void setup_feed() {
+    dma_channel_claim(DMACH_FEED);
+
+    feed_cfg = dma_channel_get_default_config(DMACH_FEED);
+    channel_config_set_transfer_data_size(&feed_cfg, DMA_SIZE_8);
+    channel_config_set_read_increment(&feed_cfg, true);
+    channel_config_set_write_increment(&feed_cfg, true);
+
+    // the header has to be resident for configure
+    while (bv_stream_configure(&bv_s) == -1)
+        feed_service();
+}
+#endif
+
+#ifdef BA_VIDEO_CORE1_SLICES
+// Sliced frames are decoded on both cores: core0 hands the slices out and claims them along with
+// core1, which picks them up between audio steps (video_help_slices). A claim is a CAS on one word
+// holding the frame's generation, slice count and next slice: core1 interrupted (by the audio timer)
+// between its load and its CAS fails the CAS once core0 moved on to another frame (a generation only
+// repeats after 65536 frames), and a frame isn't done while a slice claimed in it is still decoding,
+// so slices_done only ever counts the current frame's slices.
+#define SLICE_CLAIM_NEXT(c)  ((c) & 0xff)
+#define SLICE_CLAIM_COUNT(c) ((c) >> 8 & 0xff)
+#define SLICE_CLAIM_GEN(c)   ((c) >> 16)
+
+_Static_assert(BV_SLICE_MAX <= 0xff, "slice counts fit a claim word's byte");
+
+// generation << 16 | slice count << 8 | next slice
+static uint32_t slice_claim = 0;
+static uint32_t slices_done = 0;
+
+// decode one of the frame's slices if any is left; returns false when they're all claimed
+static bool claim_slice() {
+    uint32_t c = __atomic_load_n(&slice_claim, __ATOMIC_ACQUIRE);
+
+    if (SLICE_CLAIM_NEXT(c) >= SLICE_CLAIM_COUNT(c))
+        return false;
+
+    if (__atomic_compare_exchange_n(&slice_claim, &c, c + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        bv_stream_decslice(&bv_s, SLICE_CLAIM_NEXT(c));
+        __atomic_fetch_add(&slices_done, 1, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+// core1, between audio steps
+void video_help_slices() {
+    while (claim_slice())
+        ;
+}
+
+// decode the next frame's slices (if it's sliced) on both cores, decframe finishes the frame
+static void decode_slices() {
+    int32_t count;
+
+#ifdef BA_VIDEO_DMA_FEED
+    while ((count = bv_stream_slice_frame(&bv_s)) == -1 && !bv_s.input_ended)
+        feed_service();
+#else
+    count = bv_stream_slice_frame(&bv_s);
+#endif
+
+    if (count <= 0)
+        return;
+
+    const uint32_t gen = SLICE_CLAIM_GEN(__atomic_load_n(&slice_claim, __ATOMIC_RELAXED)) + 1;
+
+    // only core0 hands frames out, every claim of the last one has landed in slices_done
+    __atomic_store_n(&slices_done, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slice_claim, gen << 16 | (uint32_t)count << 8, __ATOMIC_RELEASE);
+
+    while (claim_slice())
+        ;
+
+    // the slices core1 claimed last
+    while (__atomic_load_n(&slices_done, __ATOMIC_ACQUIRE) < (uint32_t)count)
+        tight_loop_contents();
+}
+#endif
+
+static void __time_critical_func(vblank_present)() {
+    if (present_armed && bv_stream_commit_swap(&bv_s)) {
+        active_fb = bv_stream_active_fb(&bv_s);
+        memcpy(active_origin, bv_stream_active_origin(&bv_s), sizeof(active_origin));
+        present_armed = false;
+    }
+
+    scale_us_last = scale_us_acc;
+    scale_us_acc = 0;
+
+    line_src_row = -1;
+}
+
+static void setup_line_ring() {
+    const uint32_t words = dvi_layout.line_pixels / sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < LINE_RING_SIZE; i++)
+        memcpy(&line_ring[i][words], dvi_lists.line_tail, dvi_lists.line_tail_count * sizeof(uint32_t));
+}
+
+static const uint8_t *__time_critical_func(scanline_pixels)(uint32_t content_line) {
+    if (!bv_sc_ready)
+        return (const uint8_t *)line_ring[0]; // still blank
+
+    uint16_t src_row = bv_scaler_src_row(&bv_sc, content_line);
+
+    if (src_row != line_src_row) {
+        line_slot = (line_slot + 1) % LINE_RING_SIZE;
+        line_src_row = src_row;
+
+        uint32_t t = telemetry_now();
+        bv_scale_row(&bv_sc, active_fb, active_origin, src_row, (uint8_t *)line_ring[line_slot]);
+        scale_us_acc += telemetry_now() - t;
     }
 
-    printf("\n");
+    return (const uint8_t *)line_ring[line_slot];
+}
+
+#ifdef BA_VIDEO_CB_SCANOUT
+// fb and origin the chain's content lines point at
+static const uint8_t *cb_fb = NULL;
+static uint16_t cb_origin[2];
+
+static void __time_critical_func(cb_point)() {
+    if (active_fb == cb_fb && !memcmp(active_origin, cb_origin, sizeof(cb_origin)))
+        return;
+
+    // re-pointing counts as scaling
+    uint32_t t = telemetry_now();
+    dvi_chain_point(&cb_chain, active_fb, active_origin);
+    scale_us_acc += telemetry_now() - t;
+
+    cb_fb = active_fb;
+    memcpy(cb_origin, active_origin, sizeof(cb_origin));
 }
 
+static void setup_cb_dma() {
+    cb_chain_head = malloc(dvi_chain_size(&dvi_layout, &dvi_lists) * sizeof(struct dvi_block));
+
+    dma_channel_claim(DMACH_CB_DATA);
+    dma_channel_claim(DMACH_CB_CTRL);
+
+    // Data channel blocks go into the HSTX FIFO at its pace and chain back to
+    // the control channel, quietly (no IRQ).
+    dma_channel_config c = dma_channel_get_default_config(DMACH_CB_DATA);
+    channel_config_set_chain_to(&c, DMACH_CB_CTRL);
+    channel_config_set_high_priority(&c, true);
+    channel_config_set_dreq(&c, DREQ_HSTX);
+    channel_config_set_irq_quiet(&c, true);
+
+    struct dvi_chain_ctrl ctrl;
+    ctrl.words = channel_config_get_ctrl_value(&c);
+
+    // 1bpp fbs are read a word at a time, 8bpp ones a byte
+    if (!(dvi_layout.flags & DVI_LAYOUT_1BPP))
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    ctrl.pixels = channel_config_get_ctrl_value(&c);
+
+    // The restart block is a single unpaced word over the control channel's
+    // READ_ADDR_TRIG, it doesn't chain (a channel chained to itself doesn't)
+    // and raises the frame IRQ.
+    c = dma_channel_get_default_config(DMACH_CB_DATA);
+    channel_config_set_high_priority(&c, true);
+    ctrl.restart = channel_config_get_ctrl_value(&c);
+
+    dvi_chain_build(&cb_chain, cb_chain_head, &dvi_layout, &dvi_lists, &ctrl,
+        (uintptr_t)&hstx_fifo_hw->fifo, (uintptr_t)&cb_chain_head,
+        (uintptr_t)&dma_hw->ch[DMACH_CB_CTRL].al3_read_addr_trig, bv_s.extent, bv_s.fb_stride);
+    cb_point();
+
+    // The control channel copies a block (4 words) at a time over the data
+    // channel's READ_ADDR, WRITE_ADDR, TRANS_COUNT and CTRL_TRIG, the last of
+    // which starts it. Writes wrap around those 16 bytes.
+    c = dma_channel_get_default_config(DMACH_CB_CTRL);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 4);
+    channel_config_set_high_priority(&c, true);
+
+    dma_channel_configure(
+        DMACH_CB_CTRL,
+        &c,
+        &dma_hw->ch[DMACH_CB_DATA].read_addr,
+        cb_chain_head,
+        sizeof(struct dvi_block) / sizeof(uint32_t),
+        false
+    );
+
+    dma_channel_set_irq0_enabled(DMACH_CB_DATA, true);
+
+    irq_set_exclusive_handler(DMA_IRQ_NUM(DVI_DMA_IRQ), cb_irq_handler);
+    irq_set_enabled(DMA_IRQ_NUM(DVI_DMA_IRQ), true);
+    irq_set_priority(DMA_IRQ_NUM(DVI_DMA_IRQ), 4);
+
+    dma_channel_start(DMACH_CB_CTRL);
+}
+#endif
+
+// decode the next frame into the back fb, it stays off-screen until present_video
 void step_video() {
-    while (true) {
-        int32_t res = bv_stream_decframe(&bv_s);
-
-        if (res < 0) {
-            uint32_t to_read = MIN(1024, bad_bv_len - flash_seek);
-            assert(to_read);
-            
-            bv_stream_read(&bv_s, &bad_bv[flash_seek], to_read);
-            flash_seek += to_read;
-            
-            continue;
-        }
-        
-        print_frame();
-        printf("v: rh %d bh %d f %d\n", bv_s.buf_head, bv_s.bit_head, bv_s.frame_index);
-        
-        for (uint32_t y = 0; y < 180; y++) {
-            for (uint32_t x = 0; x < bv_s.extent[0]; x++) {
-                uint32_t postscale_pixel = x * MODE_H_ACTIVE_PIXELS / bv_s.extent[0], postscale_size = (x + 1) * MODE_H_ACTIVE_PIXELS / bv_s.extent[0];
-                memset(&dvi_fb[y * MODE_H_ACTIVE_PIXELS + postscale_pixel], active_fb[y * bv_s.extent[0] + x], postscale_size - postscale_pixel);
-            }   
+    // the last decoded frame is in the back fb until it got presented at vblank
+    // (present_video must have been called for it)
+    while (bv_stream_swap_pending(&bv_s))
+        __wfi();
+
+    const uint32_t t = telemetry_now();
+    const uint32_t bit_head = bv_s.bit_head;
+
+    // decode the next frame into the back fb while the current one is scanned out
+#ifdef BA_VIDEO_DMA_FEED
+    int32_t res;
+
+    feed_service();
+#ifdef BA_VIDEO_CORE1_SLICES
+    decode_slices();
+#endif
+    while ((res = bv_stream_decframe(&bv_s)) == -1 && !bv_s.input_ended)
+        feed_service();
+#else
+#ifdef BA_VIDEO_CORE1_SLICES
+    decode_slices();
+#endif
+    int32_t res = bv_stream_decframe(&bv_s);
+#endif
+
+    decode_us_last = telemetry_now() - t;
+    decode_bits_last = bv_s.bit_head - bit_head;
+
+    if (res < 0) {
+#ifdef BA_VIDEO_DMA_FEED
+        // seeking needs the stream attached, a fed stream stays on its last frame
+#else
+        // bad_bv is attached whole, -1 only happens at the end of the stream;
+        // loop back to the start when it's indexed, stay on the last frame otherwise
+        if (bv_stream_seek(&bv_s, 0) == 0) {
+            // the record is for the first frame, decoded from the top of the stream
+            const uint32_t seek_head = bv_s.bit_head;
+            bv_stream_decframe(&bv_s);
+
+            decode_us_last = telemetry_now() - t;
+            decode_bits_last = bv_s.bit_head - seek_head;
         }
-
-        break;
+#endif
+        return;
     }
 }
 
+uint16_t video_framerate() {
+    return bv_s.framerate ? bv_s.framerate : 30;
+}
+
+// show the last decoded frame from the next vblank on, late_us is how far past its timestamp that is
+void present_video(int32_t late_us) {
+    present_armed = true;
+
+    // more than half a frame behind counts as late
+    if (late_us > 500000 / video_framerate())
+        late_frames += 1;
+
+    const struct telemetry_frame frame = {
+        .frame = bv_s.frame_index,
+        .bits = decode_bits_last,
+        .decode_us = decode_us_last,
+        .scale_us = scale_us_last,
+        .late_us = late_us,
+        .late_frames = late_frames,
+    };
+    telemetry_record_frame(&frame);
+}
+
+// lay the stream out in BA_DVI_MODE when it can show it, in the best mode for it otherwise
+static bool pick_dvi_layout(uint32_t flags) {
+#ifdef BA_DVI_MODE
+    if (dvi_layout_init(&dvi_layout, &dvi_modes[BA_DVI_MODE], bv_s.extent, flags) == 0)
+        return true;
+#endif
+    return dvi_mode_pick(bv_s.extent, flags, &dvi_layout) != NULL;
+}
+
 void setup_video() {
     bv_stream_init(&bv_s);
+    bv_stream_set_format(&bv_s, BV_FB_1BPP);
 
-    bv_stream_read(&bv_s, bad_bv, 1024);
-    flash_seek = 1024;
+#ifdef BA_VIDEO_DMA_FEED
+    setup_feed();
+#else
+    // decode straight out of XIP flash, no copies into the read buffer
+    bv_stream_attach_memory(&bv_s, bad_bv, bad_bv_len);
 
     bv_stream_configure(&bv_s);
+
+    // one pass over the stream at boot, a verified stream decodes without bounds checks
+    uint32_t bad_bit;
+    if (bv_stream_verify(&bv_s, &bad_bit) < 0)
+        printf("bv_stream: verify failed at bit %lu, decoding with bounds checks\n", (unsigned long)bad_bit);
+#endif
     printf("bv_stream: ex %dx%d fr %d\n", bv_s.extent[0], bv_s.extent[1], bv_s.framerate);
 
+    // the dvi mode is picked for the extent before setup_hstx starts the scanout
+#ifdef BA_VIDEO_CB_SCANOUT
+    // fbs scanned out as they are, at 8bpp when both fit and a mode shows the stream at a whole factor,
+    // opted in at 1bpp when a mode shows it 1:1
+    if ((uint32_t)bv_s.extent[0] * bv_s.extent[1] * 2 <= CB_FB_BUDGET && pick_dvi_layout(DVI_LAYOUT_DIRECT)) {
+        cb_scanout = true;
+        bv_stream_set_format(&bv_s, BV_FB_8BPP);
+    }
+#ifdef BA_VIDEO_CB_1BPP
+    else if (pick_dvi_layout(DVI_LAYOUT_DIRECT | DVI_LAYOUT_1BPP)) {
+        cb_scanout = true;
+        bv_stream_pin_origin_x(&bv_s, true);
+    }
+#endif
+
+    if (!cb_scanout)
+#endif
+    if (!pick_dvi_layout(0)) {
+        // nothing to show, the scanout runs blank
+        const uint16_t active[2] = { dvi_modes[0].h_active_pixels, dvi_modes[0].v_active_lines };
+        dvi_layout_init(&dvi_layout, &dvi_modes[0], active, 0);
+    }
+
+    printf("dvi: %s, %dx%d at %d,%d\n", dvi_layout.mode->name,
+        dvi_layout.content[0], dvi_layout.content[1], dvi_layout.border[0], dvi_layout.border[1]);
+
     bv_fbs[0] = malloc(bv_s.fb_size);
-    // bv_fbs[1] = malloc(bv_s.fb_size);
+    bv_fbs[1] = malloc(bv_s.fb_size);
     memset(bv_fbs[0], 0, bv_s.fb_size);
-    // memset(bv_fbs[1], 0, bv_s.fb_size);
+    memset(bv_fbs[1], 0, bv_s.fb_size);
 
     bv_stream_bind(&bv_s, bv_fbs);
     active_fb = bv_stream_active_fb(&bv_s);
+
+#ifdef BA_VIDEO_CB_SCANOUT
+    // the chain reads the fbs, there's nothing to scale
+    if (cb_scanout)
+        return;
+#endif
+
+    // scanlines are streamed straight out of the fb from now on
+    if (bv_scaler_init(&bv_sc, &bv_s, dvi_layout.line_pixels, dvi_layout.content[1]) < 0) {
+        printf("bv_stream: can't scale %dx%d to the dvi mode\n", bv_s.extent[0], bv_s.extent[1]);
+        return;
+    }
+
+    bv_sc_ready = true;
 }
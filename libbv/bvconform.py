@@ -0,0 +1,348 @@
+# bvconform - encodes clips every way bvenc can and checks that bvdec (every path bvbench drives) and
+# bvplay.py decode each frame back as it went in, and that bvenc.py and the native encoder agree
+#
+# usage: python3 bvconform.py [--build dir] [--raw frames.raw WxH] [--baseline dir [--record]]
+#   --build     host build of libbv (bvbench, libbvenc.so)
+#   --raw       also check a clip of a byte per pixel frames
+#   --baseline  hold bvdec's per-frame decode times to ones recorded there with --record
+
+import io
+import os
+import sys
+import math
+import zlib
+import random
+import argparse
+import tempfile
+import contextlib
+import subprocess
+
+from bitarray import bitarray
+from dataclasses import dataclass
+
+# bvplay decodes onto an offscreen surface, no window
+os.environ.setdefault("SDL_VIDEODRIVER", "dummy")
+os.environ.setdefault("PYGAME_HIDE_SUPPORT_PROMPT", "1")
+
+import bvenc
+
+# == conformance config ==
+
+# every clip is encoded each of these ways, BitVState fields on top of the defaults
+CONF_ENCODINGS = [
+    ("plain", dict(bv_tileset_updates=False, bv_skips=False)),
+    ("moves", dict(bv_skips=False)),
+    ("skips", dict()),
+    ("coded", dict(bv_coded=True)),
+    ("sliced", dict(bv_slices=4)),
+]
+
+# bvdec paths, as bvbench flags
+CONF_DECODERS = [
+    ("streamed", []),
+    ("streamed 4bpp", ["-f", "4"]),
+    ("streamed 1bpp double", ["-d", "-f", "1"]),
+    ("feeder", ["-t", "-d"]),
+    ("memory", ["-m"]),
+    ("memory checked 1bpp", ["-m", "-c", "-f", "1"]),
+    ("memory 1bpp pinned", ["-m", "-d", "-f", "1", "-x"]),
+    ("streamed 8bpp pinned", ["-x"]),
+    ("slices", ["-p", "4"]),
+    ("memory slices 4bpp", ["-m", "-d", "-p", "2", "-f", "4"]),
+]
+
+# decode times are kept for these encodings and paths
+CONF_BENCH_ENCODINGS = ["skips", "coded"]
+CONF_BENCHES = [
+    ("streamed", []),
+    ("memory", ["-m"]),
+]
+
+@dataclass(slots=True)
+class ConfClip:
+    name: str
+    extent: tuple[int, int]
+    frames: list[bitarray]
+    flips: list[tuple[int, int]]
+    keyframe_interval: int = 300
+
+# == clips ==
+
+def _conf_synth_clip(name: str, wh: tuple[int, int], frame_count: int, pan: bool = False, cuts: bool = False, keyframe_interval: int = 300) -> ConfClip:
+    # a dithered disc moving over a texture, the texture scrolls along the flips when panning and changes
+    # pattern every 12 frames with cuts; a little noise so no two frames are alike
+    rng = random.Random(name)
+    steps = [(2, 0), (0, 1), (-3, -1), (1, 2), (0, 0), (-1, 3)]
+
+    frames, flips = [], []
+    pan_x = pan_y = 0
+
+    for frame_i in range(frame_count):
+        if frame_i:
+            step = steps[frame_i // 8 % len(steps)] if pan else (0, 0)
+            flips.append(step)
+
+            pan_x += step[0]
+            pan_y += step[1]
+
+        scene = frame_i // 12 if cuts else 0
+        cx = wh[0] / 2 + math.cos(frame_i / 10) * wh[0] / 4
+        cy = wh[1] / 2 + math.sin(frame_i / 7) * wh[1] / 4
+        r = wh[1] / 4 + math.sin(frame_i / 5) * wh[1] / 8
+
+        frame = bitarray(wh[0] * wh[1])
+        frame.setall(0)
+
+        for y in range(wh[1]):
+            for x in range(wh[0]):
+                d = (x - cx) ** 2 + (y - cy) ** 2
+                px, py = x - pan_x + 4096, y - pan_y + 4096
+
+                disc = d < r * r and (x * (1 + scene % 3) + y) % (2 + scene % 4) == 0
+                ring = d < r * r * 1.69 and (x + y) % 2 == 0
+                texture = (px // (8 + scene % 3 * 8) + py // 8) % 3 == 0 and (px ^ py) % 3 == 0
+
+                frame[x + y * wh[0]] = disc or ring or texture or rng.random() < 0.005
+
+        frames.append(frame)
+
+    return ConfClip(name, wh, frames, flips, keyframe_interval)
+
+def conf_synth_clips() -> list[ConfClip]:
+    return [
+        _conf_synth_clip("shapes", (160, 96), 40, keyframe_interval=15),
+        _conf_synth_clip("pan", (160, 96), 40, pan=True),
+        _conf_synth_clip("cuts", (128, 64), 48, pan=True, cuts=True, keyframe_interval=24),
+        # past the move cmd's reach, always skips
+        _conf_synth_clip("wide", (640, 48), 12, pan=True),
+    ]
+
+def conf_load_raw_clip(path: str, wh: tuple[int, int], frame_count: int, native) -> ConfClip:
+    # a byte per pixel (zero is black) row by row, like bvroundtrip -r takes; flips are estimated
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    frame_size = wh[0] * wh[1]
+    white = bytes([0] + [1] * 255)
+    frames = []
+
+    for frame_i in range(min(frame_count, len(data) // frame_size)):
+        frame = bitarray()
+        frame.pack(data[frame_i * frame_size:(frame_i + 1) * frame_size].translate(white))
+        frames.append(frame)
+
+    if not frames:
+        raise IOError(f"{path} has no {wh[0]}x{wh[1]} frames")
+
+    state = bvenc.BitVState(bv_extent=wh)
+    with _conf_quiet():
+        flips = bvenc.enc_estimate_motion(state, frames, native)
+
+    return ConfClip(os.path.basename(path), wh, frames, flips)
+
+# == encoders ==
+
+@contextlib.contextmanager
+def _conf_quiet():
+    # the encoders report every frame
+    with contextlib.redirect_stdout(io.StringIO()), contextlib.redirect_stderr(io.StringIO()):
+        yield
+
+def _conf_state(clip: ConfClip, fields: dict) -> bvenc.BitVState:
+    return bvenc.BitVState(bv_extent=clip.extent, bv_keyframe_interval=clip.keyframe_interval, **fields)
+
+def conf_encode(clip: ConfClip, fields: dict, native, path: str) -> str | None:
+    # encodes with bvenc.py to path, and with the native encoder if there is one; returns how they differ
+    state = _conf_state(clip, fields)
+
+    with _conf_quiet():
+        tile_set = bvenc.enc_build_tile_set(state, clip.frames, clip.flips)
+        bits, keyframes = bvenc.enc_encode_frames(state, clip.frames, clip.flips, tile_set)
+        bvenc.enc_output_stream(state, tile_set, bits, keyframes, path)
+
+    if not native:
+        return None
+
+    with _conf_quiet():
+        bvenc.enc_encode_native(native, _conf_state(clip, fields), clip.frames, clip.flips, path + ".native")
+
+    with open(path, 'rb') as f:
+        py_bytes = f.read()
+    with open(path + ".native", 'rb') as f:
+        native_bytes = f.read()
+
+    if py_bytes == native_bytes:
+        return None
+
+    at = next((i for i in range(min(len(py_bytes), len(native_bytes))) if py_bytes[i] != native_bytes[i]), None)
+    return f"native output differs at byte {at if at is not None else min(len(py_bytes), len(native_bytes))} ({len(native_bytes)} vs {len(py_bytes)} bytes)"
+
+# == decoders ==
+
+def _conf_frame_hash(frame: bitarray) -> int:
+    # bvbench -H's hash, CRC-32 of a byte per pixel
+    return zlib.crc32(frame.unpack())
+
+def conf_bvplay_hashes(path: str) -> list[int] | str | None:
+    # frame hashes out of bvplay.py or why there are none, None without pygame
+    try:
+        import pygame
+        import bvplay
+    except ImportError:
+        return None
+
+    state, bits = bvplay.bv_open_stream(path)
+    surf = pygame.Surface(state.bv_extent, 0, 32)
+    white = bytes([0] + [1] * 255)
+
+    hashes = []
+    try:
+        for _ in bvplay.bv_decode_frames(state, bits, surf):
+            raw = surf.get_buffer().raw
+            pitch = surf.get_pitch()
+
+            # a byte of each 32 bit pixel, any channel is 0 or 0xff
+            pixels = b''.join(raw[y * pitch:y * pitch + state.bv_extent[0] * 4:4] for y in range(state.bv_extent[1]))
+            hashes.append(zlib.crc32(pixels.translate(white)))
+
+    except (IndexError, ValueError) as e:
+        return f"failed after {len(hashes)} frames: {e!r}"
+
+    return hashes
+
+def conf_bvdec_hashes(bvbench: str, flags: list[str], path: str) -> list[int] | str:
+    # frame hashes out of bvdec through bvbench, or why there are none
+    hashes_path = path + ".hashes"
+    res = subprocess.run([bvbench, *flags, "-H", hashes_path, path], capture_output=True, text=True)
+
+    if res.returncode:
+        return f"bvbench failed: {res.stderr.strip()}"
+
+    with open(hashes_path) as f:
+        return [int(line.split()[1], 16) for line in f]
+
+def _conf_compare(expected: list[int], hashes: list[int]) -> str | None:
+    if len(hashes) != len(expected):
+        return f"{len(hashes)} frames, expected {len(expected)}"
+
+    at = next((i for i, (a, b) in enumerate(zip(expected, hashes)) if a != b), None)
+    return None if at is None else f"frame {at} differs"
+
+# == decode time baseline ==
+
+def conf_bench(bvbench: str, flags: list[str], path: str, times_path: str, record: bool, runs: int, threshold: int) -> str | None:
+    # records the per-frame decode times, or holds them against the recorded ones
+    if record:
+        args = [bvbench, *flags, "-o", times_path, path, str(runs)]
+    elif os.path.exists(times_path):
+        args = [bvbench, *flags, "-b", times_path, "-r", str(threshold), path, str(runs)]
+    else:
+        return f"no baseline at {times_path}"
+
+    res = subprocess.run(args, capture_output=True, text=True)
+    if not res.returncode:
+        return None
+
+    summary = next((line for line in res.stdout.splitlines() if line.startswith("baseline:")), None)
+    return summary.split(':', 1)[1].strip() if summary else res.stderr.strip()
+
+# == bvconform frontend ==
+
+def conf_run(args) -> int:
+    bvbench = os.path.join(args.build, "bvbench")
+    if not os.path.exists(bvbench):
+        print(f"bvconform: {bvbench} not found, build libbv for the host first")
+        return 1
+
+    bvenc.BV_ENC_LIB = os.path.join(args.build, "libbvenc.so")
+    native = bvenc.enc_load_native()
+    if not native:
+        print(f"bvconform: {bvenc.BV_ENC_LIB} not found, only checking bvenc.py's output")
+
+    clips = conf_synth_clips()
+    for path, extent in args.raw or []:
+        wh = tuple(int(v) for v in extent.split('x'))
+        clips.append(conf_load_raw_clip(path, wh, args.frames, native))
+
+    if args.baseline:
+        os.makedirs(args.baseline, exist_ok=True)
+
+    failures = 0
+    bvplay_skipped = False
+
+    with tempfile.TemporaryDirectory() as tmp:
+        out_dir = args.out or tmp
+        os.makedirs(out_dir, exist_ok=True)
+
+        for clip in clips:
+            # the encoders' model of the output, every frame as it went in
+            expected = [_conf_frame_hash(f) for f in clip.frames]
+
+            for enc_name, fields in CONF_ENCODINGS:
+                path = os.path.join(out_dir, f"{clip.name}-{enc_name}.bv")
+                problems = []
+
+                if problem := conf_encode(clip, fields, native, path):
+                    problems.append(f"encoder: {problem}")
+
+                with open(path, 'rb') as f:
+                    header = f.read(6)
+
+                version, coded = header[4], header[5] & bvenc.BV_FLAG_CODED
+
+                # bvplay previews plain streams only
+                if not coded:
+                    hashes = conf_bvplay_hashes(path)
+                    bvplay_skipped |= hashes is None
+
+                    if hashes is not None:
+                        problem = hashes if isinstance(hashes, str) else _conf_compare(expected, hashes)
+
+                        if problem:
+                            problems.append(f"bvplay.py: {problem}")
+
+                for dec_name, flags in CONF_DECODERS:
+                    hashes = conf_bvdec_hashes(bvbench, flags, path)
+                    problem = hashes if isinstance(hashes, str) else _conf_compare(expected, hashes)
+
+                    if problem:
+                        problems.append(f"bvdec {dec_name}: {problem}")
+
+                if args.baseline and enc_name in CONF_BENCH_ENCODINGS:
+                    for bench_name, flags in CONF_BENCHES:
+                        times_path = os.path.join(args.baseline, f"{clip.name}-{enc_name}-{bench_name}.times")
+
+                        if problem := conf_bench(bvbench, flags, path, times_path, args.record, args.runs, args.threshold):
+                            problems.append(f"decode time {bench_name}: {problem}")
+
+                print(f"{clip.name:<12} {enc_name:<7} v{version} {len(clip.frames):>4} frames  {'ok' if not problems else 'FAILED'}")
+                for problem in problems:
+                    print(f"    {problem}")
+
+                failures += len(problems)
+
+    if bvplay_skipped:
+        print("bvconform: pygame not found, bvplay.py wasn't checked")
+
+    if args.record:
+        print(f"bvconform: decode times recorded in {args.baseline}")
+
+    print(f"bvconform: {failures} failures" if failures else "bvconform: all decoders agree")
+    return 1 if failures else 0
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="Encodes clips every way bvenc can and checks every decoder gets the frames back")
+    parser.add_argument("--build", default="build", help="host build of libbv, with bvbench and libbvenc.so")
+    parser.add_argument("--raw", nargs=2, action="append", metavar=("FRAMES", "WxH"), help="also check a clip of a byte per pixel frames")
+    parser.add_argument("--frames", type=int, default=60, help="frames taken from each raw clip")
+    parser.add_argument("--out", help="keep the encoded streams here")
+    parser.add_argument("--baseline", help="directory of per-frame decode times to hold bvdec to")
+    parser.add_argument("--record", action="store_true", help="record the baseline instead of checking it")
+    parser.add_argument("--runs", type=int, default=5, help="bvbench runs per decode time")
+    parser.add_argument("--threshold", type=int, default=10, help="percent decoding may slow down past the baseline")
+
+    args = parser.parse_args()
+    if args.record and not args.baseline:
+        parser.error("--record needs --baseline")
+
+    sys.exit(conf_run(args))
@@ -1,3 +1,5 @@
+import os
+import ctypes
 import pygame
 import struct
 import bitarray.util as bitutil
@@ -15,6 +17,32 @@ BV_MOVE = bitarray("01")
 
 BV_STILE = bitarray("1")
 
+# extended cmds are flips with an x shift of -128, the y byte selects the cmd
+BV_EXT_ESCAPE = -128
+BV_EXT_KEYFRAME = 0
+BV_EXT_TILESET = 1
+BV_EXT_END = 2
+BV_EXT_SLICES = 3
+
+# == bv stream header ==
+
+BV_VERSION = 5
+BV_FLAG_INDEX = 1
+BV_FLAG_CODED = 2
+
+BV_TILESET_SIZE = 256
+BV_TILESET_UPDATE_MAX = 16
+
+BV_SLICE_MAX = 16
+BV_SLICE_ROW_BITS, BV_SLICE_SIZE_BITS = 5, 20
+BV_SLICE_WIDE_ROW_BITS, BV_SLICE_WIDE_SIZE_BITS = 8, 25
+
+# from version 5 the move cmd is a skip, a zigzagged raster distance as an order BV_SKIP_ORDER
+# Exp-Golomb code; moves only address supertiles up to BV_MOVE_MAX_EXTENT
+BV_SKIP_ORDER = 5
+BV_SKIP_PREFIX_MAX = 20
+BV_MOVE_MAX_EXTENT = 512
+
 # == encoder internals ==
 
 @dataclass(slots=True)
@@ -22,6 +50,23 @@ class BitVState:
     bv_extent: tuple[int, int]
     bv_framerate: int = 30
 
+    # frames between self-contained keyframes, 0 to only have frame 0
+    bv_keyframe_interval: int = 300
+
+    # replace tileset entries between keyframes, and how many were
+    bv_tileset_updates: bool = True
+    bv_tileset_update_count: int = 0
+
+    # range code the frames (smaller, slower to decode)
+    bv_coded: bool = False
+
+    # cut frames into up to this many slices for parallel decoding (not while coded), and how many were
+    bv_slices: int = 0
+    bv_sliced_frame_count: int = 0
+
+    # skip cmds instead of moves (version 5), always on past BV_MOVE_MAX_EXTENT
+    bv_skips: bool = True
+
 def _enc_quantize_image(path: str) -> tuple[tuple[int, int], bitarray]:
     # load image
     img = pygame.image.load(path)
@@ -97,24 +142,144 @@ def _enc_offset_frame(src_frame: bitarray, x: int, y: int, wh: tuple[int, int])
 
     return frame
 
+# == motion estimation ==
+
+# largest shift the motion search tries, either way on both axes (BV_MOTION_RANGE in bvenc.h)
+BV_MOTION_RANGE = 16
+
+def _enc_pack_rows(frame: bitarray, wh: tuple[int, int]) -> list[int]:
+    # a row per int, bit x is pixel x
+    return [bitutil.ba2int(frame[y * wh[0]:(y + 1) * wh[0]][::-1]) for y in range(wh[1])]
+
+def _enc_pack_low(rows: list[int], wh: tuple[int, int]) -> list[int]:
+    # a pixel per tile, set when any of the tile's pixels are
+    low = []
+
+    for ty in range(wh[1] // 4):
+        tiles = rows[ty * 4] | rows[ty * 4 + 1] | rows[ty * 4 + 2] | rows[ty * 4 + 3]
+        row = 0
+
+        for tx in range(wh[0] // 4):
+            if (tiles >> tx * 4) & 0xf:
+                row |= 1 << tx
+
+        low.append(row)
+
+    return low
+
+def _enc_shift_rows(rows: list[int], x: int, y: int, w: int) -> list[int]:
+    # same as _enc_offset_frame, the rows and columns shifted in keep their old pixels
+    h = len(rows)
+    mask = (1 << w) - 1
+
+    if x > 0:
+        stale = (1 << x) - 1
+    else:
+        stale = mask & ~((1 << (w + x)) - 1)
+
+    shifted = []
+
+    for r in range(h):
+        src = rows[r - y] if (y > 0 and r >= y) or (y < 0 and r < h + y) else rows[r]
+
+        if x > 0:
+            src = ((src << x) & mask & ~stale) | (src & stale)
+        elif x < 0:
+            src = ((src >> -x) & ~stale) | (src & stale)
+
+        shifted.append(src)
+
+    return shifted
+
+def _enc_motion_cost(prev: list[int], curr: list[int], x: int, y: int, w: int, tiles: bool) -> int:
+    # damaged 4x4 tiles left by shifting prev when tiles is set, differing pixels otherwise
+    shifted = _enc_shift_rows(prev, x, y, w)
+
+    if not tiles:
+        return sum((a ^ b).bit_count() for a, b in zip(shifted, curr))
+
+    tile_lsbs = int("0001" * (w // 4), 2)
+    cost = 0
+
+    for gy in range(0, len(curr) - 3, 4):
+        diff = 0
+        for r in range(gy, gy + 4):
+            diff |= shifted[r] ^ curr[r]
+
+        cost += ((diff | diff >> 1 | diff >> 2 | diff >> 3) & tile_lsbs).bit_count()
+
+    return cost
+
 def _enc_estimate_motion(state: BitVState, prev_f: bitarray, curr_f: bitarray) -> tuple[int, int]:
-    return (0, 0)# check frames over the max motion window
-    min_err = float("inf")
-    motion = None
+    # same search as bv_encoder_estimate_motion, every tile step on a pixel per tile downscale,
+    # then every shift around the best one at full resolution; no shift wins ties
+    wh = state.bv_extent
+    low_wh = (wh[0] // 4, wh[1] // 4)
+
+    range_x = min(BV_MOTION_RANGE, wh[0] - 1)
+    range_y = min(BV_MOTION_RANGE, wh[1] - 1)
+
+    prev = _enc_pack_rows(prev_f, wh)
+    curr = _enc_pack_rows(curr_f, wh)
+
+    # coarse
+
+    prev_low = _enc_pack_low(prev, wh)
+    curr_low = _enc_pack_low(curr, wh)
+
+    coarse = (0, 0)
+    min_err = _enc_motion_cost(prev_low, curr_low, 0, 0, low_wh[0], False)
+
+    for y in range(-(range_y // 4), range_y // 4 + 1):
+        for x in range(-(range_x // 4), range_x // 4 + 1):
+            err = _enc_motion_cost(prev_low, curr_low, x, y, low_wh[0], False)
+            if err < min_err:
+                min_err = err
+                coarse = (x * 4, y * 4)
 
-    for y in range(-16, 16, 2):
-        for x in range(-16, 16, 2):
-            offset_prev_f = _enc_offset_frame(prev_f, x, y, state.bv_extent)
+    # fine
 
-            err = bitutil.count_xor(offset_prev_f, curr_f)
+    motion = (0, 0)
+    min_err = _enc_motion_cost(prev, curr, 0, 0, wh[0], True)
+
+    for y in range(coarse[1] - 3, coarse[1] + 4):
+        for x in range(coarse[0] - 3, coarse[0] + 4):
+            if abs(x) > range_x or abs(y) > range_y:
+                continue
+
+            err = _enc_motion_cost(prev, curr, x, y, wh[0], True)
             if err < min_err:
                 min_err = err
                 motion = (x, y)
 
     return motion
 
+def _enc_estimate_motion_native(lib: ctypes.CDLL, state: BitVState, bit_frames: list[bitarray]) -> list[tuple[int, int]]:
+    encoder = ctypes.create_string_buffer(lib.bv_encoder_sizeof())
+
+    if lib.bv_encoder_init(encoder, state.bv_extent[0], state.bv_extent[1], state.bv_framerate) < 0:
+        raise ValueError(f"can't encode a {state.bv_extent[0]}x{state.bv_extent[1]} stream")
+
+    flips = []
+    flip = (ctypes.c_int8 * 2)()
+    prev_f = bit_frames[0].unpack()
+
+    for frame in tqdm(bit_frames[1:], desc="estimating motion", unit="frames"):
+        curr_f = frame.unpack()
+
+        lib.bv_encoder_estimate_motion(encoder, prev_f, curr_f, flip)
+        flips.append((flip[0], flip[1]))
+
+        prev_f = curr_f
+
+    lib.bv_encoder_deinit(encoder)
+    return flips
+
 # tries to encode frame to frame motion, returns bv_flip commands with global motion info 
-def enc_estimate_motion(state: BitVState, bit_frames: list[bitarray]) -> list[tuple[int, int]]:
+def enc_estimate_motion(state: BitVState, bit_frames: list[bitarray], lib: ctypes.CDLL | None = None) -> list[tuple[int, int]]:
+    if lib:
+        return _enc_estimate_motion_native(lib, state, bit_frames)
+
     worker_pool = Pool()
     task_awaits = []
 
@@ -153,7 +318,8 @@ def _enc_detect_reuse(src: bitarray, dst: bitarray, wh: tuple[int, int]) -> dict
 
     for stile_loc, stile in damaged_supertiles.items():
         base_x, base_y = (stile_loc[0] * 16, stile_loc[1] * 16)
-        for (tile_x, tile_y) in stile:
+        # raster order within the supertile, so ties in the tileset don't depend on set ordering
+        for (tile_x, tile_y) in sorted(stile, key=lambda t: (t[1], t[0])):
             tile_data = bitarray()
             for y in range(4):
                 row_index = (base_x + tile_x * 4) + (base_y + tile_y * 4 + y) * wh[0]
@@ -201,7 +367,131 @@ def enc_build_tile_set(state: BitVState, bit_frames: list[bitarray], flips: list
 
     return tile_set
 
-def _enc_encode_diff(src: bitarray, dst: bitarray, wh: tuple[int, int], tile_set: dict[frozenbitarray, int]) -> bitarray:
+# == tileset updates ==
+
+# tileset updates look this many frames ahead (up to the next keyframe), a tile missing the tileset
+# replaces the entry drawn the least in there when it's drawn BV_TILESET_GAIN more times (bvenc.h)
+BV_TILESET_LOOKAHEAD = 20
+BV_TILESET_GAIN = 5
+
+def _enc_tile_value(tile: frozenbitarray) -> int:
+    # bit x + y * 4 is pixel x, y of the tile, like the header's tileset
+    return bitutil.ba2int(tile[::-1])
+
+def _enc_update_tile_set(state: BitVState, frame_i: int, tile_uses: list[dict[frozenbitarray, int]], live_tiles: list, tile_set: dict[frozenbitarray, int], tile_used: list[int]) -> list[tuple[int, frozenbitarray]]:
+    # same pick as bv_encoder's update_tileset, the frame's tiles missing the tileset that are drawn
+    # the most in the lookahead replace the entries drawn the least (then least recently)
+    end = min(frame_i + BV_TILESET_LOOKAHEAD, len(tile_uses))
+    if state.bv_keyframe_interval > 0:
+        end = min(end, (frame_i // state.bv_keyframe_interval + 1) * state.bv_keyframe_interval)
+
+    ahead = {}
+    for uses in tile_uses[frame_i:end]:
+        for tile, count in uses.items():
+            ahead[tile] = ahead.get(tile, 0) + count
+
+    misses = []
+    for tile in tile_uses[frame_i]:
+        if tile in tile_set:
+            tile_used[tile_set[tile]] = frame_i
+        else:
+            misses.append(tile)
+
+    misses.sort(key=lambda t: (-ahead[t], _enc_tile_value(t)))
+    victims = sorted(range(BV_TILESET_SIZE), key=lambda slot: (ahead.get(live_tiles[slot], 0), tile_used[slot], slot))
+
+    updates = []
+    for tile, slot in zip(misses[:BV_TILESET_UPDATE_MAX], victims):
+        if ahead[tile] < ahead.get(live_tiles[slot], 0) + BV_TILESET_GAIN:
+            break
+
+        updates.append((slot, tile))
+
+    for slot, tile in updates:
+        if live_tiles[slot] is not None:
+            del tile_set[live_tiles[slot]]
+
+        live_tiles[slot] = tile
+        tile_set[tile] = slot
+        tile_used[slot] = frame_i
+
+    return updates
+
+def _enc_plan_tile_sets(state: BitVState, bit_frames: list[bitarray], flips: list[tuple[int, int]], tile_set: dict[frozenbitarray, int]) -> list[tuple[dict[frozenbitarray, int], list[tuple[int, frozenbitarray]]]]:
+    # the tileset each frame is encoded with and the updates leading up to it, keyframes start over
+    # from the header's tileset
+    tile_uses = [{}] * len(bit_frames)
+
+    if state.bv_tileset_updates:
+        # the scan pass' reuse, frame by frame
+        worker_pool = Pool()
+        task_awaits = [worker_pool.apply_async(_enc_detect_reuse, (bitarray(len(bit_frames[0])), bit_frames[0], state.bv_extent))]
+
+        for frame_i in range(1, len(bit_frames)):
+            src_f = _enc_offset_frame(bit_frames[frame_i - 1], *flips[frame_i - 1], state.bv_extent)
+            task_awaits.append(worker_pool.apply_async(_enc_detect_reuse, (src_f, bit_frames[frame_i], state.bv_extent)))
+
+        tile_uses = [task.get() for task in tqdm(task_awaits, desc="planning tileset updates", unit="frames")]
+
+    plans = []
+
+    for frame_i in range(len(bit_frames)):
+        updates = []
+
+        if _enc_is_keyframe(state, frame_i):
+            # the lowest ranked entries are the first to go
+            live_set = dict(tile_set)
+            live_tiles = list(tile_set.keys()) + [None] * (BV_TILESET_SIZE - len(tile_set))
+            tile_used = [-slot - 1 for slot in range(BV_TILESET_SIZE)]
+
+            frame_set = dict(live_set)
+
+        elif state.bv_tileset_updates:
+            updates = _enc_update_tile_set(state, frame_i, tile_uses, live_tiles, live_set, tile_used)
+
+            if updates:
+                frame_set = dict(live_set)
+
+        plans.append((frame_set, updates))
+
+    state.bv_tileset_update_count = sum(len(updates) for _, updates in plans)
+    return plans
+
+# a frame is only cut into as many slices as give each this many damaged supertiles
+BV_SLICE_MIN_SUPERTILES = 8
+
+def _enc_plan_slices(damaged_supertiles: dict, wh: tuple[int, int], slices: int) -> list[int]:
+    # first supertile row of each slice, cut so they hold about as many damaged tiles; [] if not sliced
+    st_h = (wh[1] + 15) // 16
+    count = min(slices, BV_SLICE_MAX, len(damaged_supertiles) // BV_SLICE_MIN_SUPERTILES, st_h)
+
+    if count < 2:
+        return []
+
+    weights = [0] * st_h
+    for (_, st_y), damaged_tiles in damaged_supertiles.items():
+        weights[st_y] += len(damaged_tiles)
+
+    total = sum(weights)
+    rows = [0]
+    row = 0
+    weight_sum = 0
+
+    for i in range(1, count):
+        weight_sum += weights[row]
+        row += 1
+
+        # leave a row for each slice after this one
+        while row < st_h - (count - i) and weight_sum * count < i * total:
+            weight_sum += weights[row]
+            row += 1
+
+        rows.append(row)
+
+    return rows
+
+# encodes the frame diff, returns its bits and whether it was sliced
+def _enc_encode_diff(src: bitarray, dst: bitarray, wh: tuple[int, int], tile_set: dict[frozenbitarray, int], slices: int = 0, skips: bool = True) -> tuple[bitarray, bool]:
     # == encode tile diffs ==
 
     diff = src ^ dst
@@ -214,19 +504,29 @@ def _enc_encode_diff(src: bitarray, dst: bitarray, wh: tuple[int, int], tile_set
                 damaged_tiles = damaged_supertiles.setdefault((x // 16, y // 16), set())
                 damaged_tiles.add((x % 16 // 4, y % 16 // 4))
 
-    cursor = (0, 0)
+    st_w = (wh[0] + 15) // 16
 
-    def move_to_next_supertile(bits: bitarray) -> tuple[int, int]:
+    def move_to_next_supertile(bits: bitarray, supertiles: dict, cursor: tuple[int, int]) -> tuple[int, int]:
         cmd_bits = BV_MOVE.copy()
-        next_supertile_loc = next(iter(damaged_supertiles))
+        next_supertile_loc = next(iter(supertiles))
+
+        if skips:
+            # zigzagged raster distance, then Exp-Golomb
+            skip = (next_supertile_loc[0] + next_supertile_loc[1] * st_w) - (cursor[0] + cursor[1] * st_w)
+            value = (2 * skip - 1 if skip > 0 else -2 * skip) + (1 << BV_SKIP_ORDER)
+            width = value.bit_length() - 1
 
-        cmd_bits += bitutil.int2ba(next_supertile_loc[0], 5, endian='little')
-        cmd_bits += bitutil.int2ba(next_supertile_loc[1], 5, endian='little')
+            cmd_bits += bitutil.zeros(width - BV_SKIP_ORDER) + bitarray("1")
+            cmd_bits += bitutil.int2ba(value & ((1 << width) - 1), width, endian='little')
+
+        else:
+            cmd_bits += bitutil.int2ba(next_supertile_loc[0], 5, endian='little')
+            cmd_bits += bitutil.int2ba(next_supertile_loc[1], 5, endian='little')
 
         bits += cmd_bits
         return next_supertile_loc
 
-    def draw_supertile(bits: bitarray, damaged_tiles: set, adjecency_prefix: bitarray) -> None:
+    def draw_supertile(bits: bitarray, cursor: tuple[int, int], damaged_tiles: set, adjecency_prefix: bitarray) -> None:
         cmd_bits = BV_STILE + adjecency_prefix
         tile_bits = bitarray()
 
@@ -268,88 +568,481 @@ def _enc_encode_diff(src: bitarray, dst: bitarray, wh: tuple[int, int], tile_set
 
         bits += cmd_bits + cv_bitmask + tile_bits
 
-    while damaged_supertiles:
-        if not cursor in damaged_supertiles:
-            cursor = move_to_next_supertile(bits)
+    def draw_supertiles(bits: bitarray, supertiles: dict, cursor: tuple[int, int]) -> None:
+        while supertiles:
+            if not cursor in supertiles:
+                cursor = move_to_next_supertile(bits, supertiles, cursor)
 
-        tiles = damaged_supertiles.pop(cursor)
-        
-        # check for adjecent supertiles
-        if (cursor[0] + 1, cursor[1]) in damaged_supertiles:
-            draw_supertile(bits, tiles, bitarray("00"))
-            cursor = (cursor[0] + 1, cursor[1])
+            tiles = supertiles.pop(cursor)
+            
+            # check for adjecent supertiles
+            if (cursor[0] + 1, cursor[1]) in supertiles:
+                draw_supertile(bits, cursor, tiles, bitarray("00"))
+                cursor = (cursor[0] + 1, cursor[1])
 
-        elif (cursor[0] - 1, cursor[1]) in damaged_supertiles:
-            draw_supertile(bits, tiles, bitarray("01"))
-            cursor = (cursor[0] - 1, cursor[1])
+            elif (cursor[0] - 1, cursor[1]) in supertiles:
+                draw_supertile(bits, cursor, tiles, bitarray("01"))
+                cursor = (cursor[0] - 1, cursor[1])
 
-        elif (cursor[0], cursor[1] + 1) in damaged_supertiles:
-            draw_supertile(bits, tiles, bitarray("10"))
-            cursor = (cursor[0], cursor[1] + 1)
+            elif (cursor[0], cursor[1] + 1) in supertiles:
+                draw_supertile(bits, cursor, tiles, bitarray("10"))
+                cursor = (cursor[0], cursor[1] + 1)
 
-        else:
-            # no matter if adjecent tile is bellow *or* not, move down, if no tile is bellow a move cmd will follow
-            draw_supertile(bits, tiles, bitarray("11"))
-            cursor = (cursor[0], cursor[1] - 1)
+            else:
+                # no matter if adjecent tile is bellow *or* not, move down, if no tile is bellow a move cmd will follow
+                draw_supertile(bits, cursor, tiles, bitarray("11"))
+                cursor = (cursor[0], cursor[1] - 1)
+
+    slice_rows = _enc_plan_slices(damaged_supertiles, wh, slices)
+
+    if slice_rows:
+        # slices cmd, its table (sizes filled in once the slices are drawn) then the slices, each only
+        # chains into supertiles of its own rows
+        bits += BV_FLIP
+        bits += bitutil.int2ba(BV_EXT_ESCAPE, 8, endian='little', signed=True)
+        bits += bitutil.int2ba(BV_EXT_SLICES, 8, endian='little')
+        bits += bitutil.int2ba(len(slice_rows) - 1, 4, endian='little')
+
+        slice_bits = []
+        for i, row_lo in enumerate(slice_rows):
+            row_hi = slice_rows[i + 1] if i + 1 < len(slice_rows) else (wh[1] + 15) // 16
+            band = {loc: tiles for loc, tiles in damaged_supertiles.items() if row_lo <= loc[1] < row_hi}
+
+            slice_bits.append(bitarray())
+            draw_supertiles(slice_bits[-1], band, (0, row_lo))
+
+        # the entries got wider along with skips
+        row_bits, size_bits = (BV_SLICE_WIDE_ROW_BITS, BV_SLICE_WIDE_SIZE_BITS) if skips else (BV_SLICE_ROW_BITS, BV_SLICE_SIZE_BITS)
+
+        for row_lo, band_bits in zip(slice_rows, slice_bits):
+            bits += bitutil.int2ba(row_lo, row_bits, endian='little') + bitutil.int2ba(len(band_bits), size_bits, endian='little')
+
+        for band_bits in slice_bits:
+            bits += band_bits
+
+    else:
+        draw_supertiles(bits, damaged_supertiles, (0, 0))
 
     # == encode feedback ==
 
     print(f"comp {round(len(bits) / len(dst) * 100, 2)}; base {len(dst)}; codec {len(bits)}")
   
-    return bits
+    return (bits, bool(slice_rows))
 
-def enc_encode_frames(state: BitVState, bit_frames: list[bitarray], flips: list[tuple[int, int]], tile_set: dict[frozenbitarray, int]) -> bitarray:
+def _enc_is_keyframe(state: BitVState, frame_i: int) -> bool:
+    return frame_i == 0 or (state.bv_keyframe_interval > 0 and frame_i % state.bv_keyframe_interval == 0)
+
+# encodes all frames, returns the frame bitstream and (frame, bit offset) of every keyframe
+def enc_encode_frames(state: BitVState, bit_frames: list[bitarray], flips: list[tuple[int, int]], tile_set: dict[frozenbitarray, int]) -> tuple[bitarray, list[tuple[int, int]]]:
     bits = bitarray()
-    prev_f = bit_frames[0]
+    blank_f = bitarray(len(bit_frames[0]))
+    blank_f.setall(0)
+
+    plans = _enc_plan_tile_sets(state, bit_frames, flips, tile_set)
 
     worker_pool = Pool()
     task_awaits = []
 
-    # insert bitstream tile set
-    for t in tile_set.keys():
-        bits += t
+    # coded streams aren't sliced, the coder runs through the whole frame
+    slices = 0 if state.bv_coded else state.bv_slices
+
+    # moves can't address every supertile past BV_MOVE_MAX_EXTENT
+    state.bv_skips = state.bv_skips or max(state.bv_extent) > BV_MOVE_MAX_EXTENT
 
     # write initial frame
-    bits += _enc_encode_diff(bitarray(len(prev_f)), prev_f, state.bv_extent, tile_set)
+    keyframes = [(0, 0)]
+    diff_bits, sliced = _enc_encode_diff(blank_f, bit_frames[0], state.bv_extent, tile_set, slices, state.bv_skips)
+
+    bits += diff_bits
+    state.bv_sliced_frame_count = int(sliced)
 
-    # dispatch frame diff tasks
+    # dispatch frame diff tasks, keyframes are diffed against a blank frame
     for frame_i in range(1, len(bit_frames)):
-        src_f = _enc_offset_frame(bit_frames[frame_i - 1], *flips[frame_i - 1], state.bv_extent)
+        if _enc_is_keyframe(state, frame_i):
+            src_f = blank_f
+        else:
+            src_f = _enc_offset_frame(bit_frames[frame_i - 1], *flips[frame_i - 1], state.bv_extent)
         dst_f = bit_frames[frame_i]
         
-        task_awaits.append(worker_pool.apply_async(_enc_encode_diff, (src_f, dst_f, state.bv_extent, tile_set)))
+        task_awaits.append(worker_pool.apply_async(_enc_encode_diff, (src_f, dst_f, state.bv_extent, plans[frame_i][0], slices, state.bv_skips)))
 
     # assemble final bitstream
     for frame_i in trange(1, len(bit_frames), desc="encoding frames", unit="frames"):
-        # write flip cmd
         flip_cmd = BV_FLIP.copy()
-        flip_cmd += bitutil.int2ba(flips[frame_i - 1][0], 8, endian='little', signed=True)
-        flip_cmd += bitutil.int2ba(flips[frame_i - 1][1], 8, endian='little', signed=True)
 
-        bits += flip_cmd
+        if _enc_is_keyframe(state, frame_i):
+            # write keyframe cmd, ends the previous frame without a shift
+            flip_cmd += bitutil.int2ba(BV_EXT_ESCAPE, 8, endian='little', signed=True)
+            flip_cmd += bitutil.int2ba(BV_EXT_KEYFRAME, 8, endian='little')
+
+            bits += flip_cmd
+            keyframes.append((frame_i, len(bits)))
+
+        else:
+            # write flip cmd
+            flip_cmd += bitutil.int2ba(flips[frame_i - 1][0], 8, endian='little', signed=True)
+            flip_cmd += bitutil.int2ba(flips[frame_i - 1][1], 8, endian='little', signed=True)
+
+            bits += flip_cmd
+
+        # write tileset update, the frame's diff already indexes the new entries
+        updates = plans[frame_i][1]
+
+        if updates:
+            update_cmd = BV_FLIP.copy()
+            update_cmd += bitutil.int2ba(BV_EXT_ESCAPE, 8, endian='little', signed=True)
+            update_cmd += bitutil.int2ba(BV_EXT_TILESET, 8, endian='little')
+            update_cmd += bitutil.int2ba(len(updates) - 1, 4, endian='little')
+
+            for slot, tile in updates:
+                update_cmd += bitutil.int2ba(slot, 8, endian='little') + tile
+
+            bits += update_cmd
         
         # write frame diff
-        bits += task_awaits[frame_i - 1].get()
+        diff_bits, sliced = task_awaits[frame_i - 1].get()
+
+        bits += diff_bits
+        state.bv_sliced_frame_count += sliced
+
+    worker_pool.close()
+    worker_pool.join()
+
+    return (bits, keyframes)
+
+# == range coding ==
+
+# coded streams range code the same cmds with adaptive binary contexts, laid out like bv_structs.h's
+BV_PROB_BITS = 11
+BV_PROB_MOVE = 5
+
+BV_CTX_CMD = 0
+BV_CTX_ADJ = BV_CTX_CMD + 3 * 2
+BV_CTX_MASK = BV_CTX_ADJ + 4
+BV_CTX_TILE_OP = BV_CTX_MASK + 16 * 4
+BV_CTX_TILE_INDEX = BV_CTX_TILE_OP + 4 * 3
+BV_CTX_TILE_BITS = BV_CTX_TILE_INDEX + 256
+BV_CTX_MOVE = BV_CTX_TILE_BITS + 16 * 4
+BV_CTX_SKIP = BV_CTX_MOVE + 2 * 32
+BV_CTX_COUNT = BV_CTX_SKIP + BV_SKIP_PREFIX_MAX
+
+BV_OP_BLACK, BV_OP_WHITE, BV_OP_INDEXED, BV_OP_INLINE = range(4)
+
+# LZMA's range encoder, one per keyframe
+@dataclass(slots=True)
+class _EncRangeCoder:
+    out: bytearray
+    low: int = 0
+    range: int = 0xffffffff
+    cache: int = 0
+    cache_size: int = 1
+
+    prev_cmd: int = 0
+    prev_op: int = BV_OP_BLACK
+    probs: list[int] = None
+
+    def __post_init__(self):
+        self.probs = [1 << (BV_PROB_BITS - 1)] * BV_CTX_COUNT
+
+def _enc_rc_shift_low(rc: _EncRangeCoder) -> None:
+    # the top byte goes out once no carry can run into it anymore
+    if rc.low < 0xff000000 or rc.low >= 1 << 32:
+        carry = rc.low >> 32
+        byte = rc.cache
+
+        while rc.cache_size:
+            rc.out.append((byte + carry) & 0xff)
+            byte = 0xff
+            rc.cache_size -= 1
+
+        rc.cache = (rc.low >> 24) & 0xff
+
+    rc.cache_size += 1
+    rc.low = (rc.low & 0x00ffffff) << 8
+
+def _enc_rc_normalize(rc: _EncRangeCoder) -> None:
+    if rc.range < 1 << 24:
+        rc.range = (rc.range << 8) & 0xffffffff
+        _enc_rc_shift_low(rc)
+
+def _enc_rc_bit(rc: _EncRangeCoder, ctx: int, bit: int) -> None:
+    prob = rc.probs[ctx]
+    bound = (rc.range >> BV_PROB_BITS) * prob
+
+    if not bit:
+        rc.range = bound
+        rc.probs[ctx] = prob + (((1 << BV_PROB_BITS) - prob) >> BV_PROB_MOVE)
+    else:
+        rc.low += bound
+        rc.range -= bound
+        rc.probs[ctx] = prob - (prob >> BV_PROB_MOVE)
+
+    _enc_rc_normalize(rc)
+
+def _enc_rc_direct(rc: _EncRangeCoder, value: int, width: int) -> None:
+    for i in reversed(range(width)):
+        rc.range >>= 1
+        if (value >> i) & 1:
+            rc.low += rc.range
+
+        _enc_rc_normalize(rc)
+
+def _enc_rc_tree(rc: _EncRangeCoder, ctx: int, value: int, width: int) -> None:
+    node = 1
+
+    for i in reversed(range(width)):
+        bit = (value >> i) & 1
+
+        _enc_rc_bit(rc, ctx + node, bit)
+        node = (node << 1) | bit
+
+def _enc_rc_flush(rc: _EncRangeCoder) -> None:
+    for _ in range(5):
+        _enc_rc_shift_low(rc)
+
+def _enc_rc_cmd(rc: _EncRangeCoder, kind: int) -> None:
+    ctx = BV_CTX_CMD + rc.prev_cmd * 2
+
+    _enc_rc_bit(rc, ctx, kind == 0)
+    if kind:
+        _enc_rc_bit(rc, ctx + 1, kind == 1)
+
+    rc.prev_cmd = kind
+
+def _enc_transcode_supertile(rc: _EncRangeCoder, read_bits) -> None:
+    adj_prefix = read_bits(2)
+    cv_mask = read_bits(16)
+
+    _enc_rc_cmd(rc, 0)
+    _enc_rc_tree(rc, BV_CTX_ADJ, adj_prefix, 2)
+
+    for t in range(16):
+        left = (cv_mask >> (t - 1)) & 1 if t % 4 else 1
+        above = (cv_mask >> (t - 4)) & 1 if t >= 4 else 1
+
+        _enc_rc_bit(rc, BV_CTX_MASK + t * 4 + left * 2 + above, (cv_mask >> t) & 1)
+
+    for t in range(16):
+        if not (cv_mask >> t) & 1:
+            continue
+
+        op_ctx = BV_CTX_TILE_OP + rc.prev_op * 3
+        op_bits = read_bits(2)
+
+        if op_bits & 1:
+            _enc_rc_bit(rc, op_ctx, 1)
+            _enc_rc_bit(rc, op_ctx + 1, op_bits >> 1)
+
+            rc.prev_op = BV_OP_WHITE if op_bits >> 1 else BV_OP_BLACK
+
+        elif op_bits & 2:
+            _enc_rc_bit(rc, op_ctx, 0)
+            _enc_rc_bit(rc, op_ctx + 2, 1)
+            _enc_rc_tree(rc, BV_CTX_TILE_INDEX, read_bits(8), 8)
+
+            rc.prev_op = BV_OP_INDEXED
+
+        else:
+            _enc_rc_bit(rc, op_ctx, 0)
+            _enc_rc_bit(rc, op_ctx + 2, 0)
+
+            tile = read_bits(16)
 
-    return bits
+            for i in range(16):
+                left = (tile >> (i - 1)) & 1 if i % 4 else 0
+                above = (tile >> (i - 4)) & 1 if i >= 4 else 0
 
-def enc_output_stream(state: BitVState, bv_bitstream: bitarray) -> bitarray:
+                _enc_rc_bit(rc, BV_CTX_TILE_BITS + i * 4 + left * 2 + above, (tile >> i) & 1)
+
+            rc.prev_op = BV_OP_INLINE
+
+# range codes the frame bitstream cmd by cmd, returns the coded frames and the byte each keyframe's
+# coder starts at; the stream ends with BV_EXT_END
+def _enc_transcode(bv_bitstream: bitarray, keyframes: list[tuple[int, int]], skips: bool) -> tuple[bytes, list[int]]:
+    out = bytearray()
+    offsets = []
+    pos = 0
+
+    def read_bits(width: int) -> int:
+        nonlocal pos
+
+        value = 0
+        for i in range(width):
+            if pos + i < len(bv_bitstream) and bv_bitstream[pos + i]:
+                value |= 1 << i
+
+        pos += width
+        return value
+
+    rc = None
+
+    while pos < len(bv_bitstream):
+        if rc is None:
+            # each coder starts at a keyframe
+            assert keyframes[len(offsets)][1] == pos
+
+            offsets.append(len(out))
+            rc = _EncRangeCoder(out)
+
+        if read_bits(1):
+            _enc_transcode_supertile(rc, read_bits)
+            continue
+
+        if read_bits(1):
+            _enc_rc_cmd(rc, 1)
+
+            if not skips:
+                _enc_rc_tree(rc, BV_CTX_MOVE, read_bits(5), 5)
+                _enc_rc_tree(rc, BV_CTX_MOVE + 32, read_bits(5), 5)
+                continue
+
+            # a context per prefix bit, the low bits are plain
+            zeros = 0
+            while not read_bits(1):
+                _enc_rc_bit(rc, BV_CTX_SKIP + zeros, 0)
+                zeros += 1
+
+            _enc_rc_bit(rc, BV_CTX_SKIP + zeros, 1)
+            _enc_rc_direct(rc, read_bits(zeros + BV_SKIP_ORDER), zeros + BV_SKIP_ORDER)
+            continue
+
+        flip_x, flip_y = read_bits(8), read_bits(8)
+
+        _enc_rc_cmd(rc, 2)
+        _enc_rc_direct(rc, flip_x, 8)
+        _enc_rc_direct(rc, flip_y, 8)
+
+        if flip_x == BV_EXT_ESCAPE & 0xff and flip_y == BV_EXT_TILESET:
+            count = read_bits(4)
+            _enc_rc_direct(rc, count, 4)
+
+            for _ in range(count + 1):
+                _enc_rc_direct(rc, read_bits(8), 8)
+                _enc_rc_direct(rc, read_bits(16), 16)
+
+        elif flip_x == BV_EXT_ESCAPE & 0xff and flip_y == BV_EXT_KEYFRAME:
+            _enc_rc_flush(rc)
+            rc = None
+
+    if rc is None:
+        rc = _EncRangeCoder(out)
+
+    _enc_rc_cmd(rc, 2)
+    _enc_rc_direct(rc, BV_EXT_ESCAPE & 0xff, 8)
+    _enc_rc_direct(rc, BV_EXT_END, 8)
+    _enc_rc_flush(rc)
+
+    return (bytes(out), offsets)
+
+# == stream output ==
+
+def enc_output_stream(state: BitVState, tile_set: dict[frozenbitarray, int], bv_bitstream: bitarray, keyframes: list[tuple[int, int]], path: str = "out.bv") -> None:
     bitstream = bitarray(endian='little')
 
     # write stream header
 
-    bv_header = b'BitV\x00\x00'
+    # players without tileset updates (or coding, slices, skips) still take streams that have none
+    bv_version = 5 if state.bv_skips else 4 if state.bv_sliced_frame_count else 3 if state.bv_coded else 2 if state.bv_tileset_update_count else 1
+    bv_flags = BV_FLAG_INDEX | (BV_FLAG_CODED if state.bv_coded else 0)
+
+    bv_header = b'BitV' + struct.pack("<BB", bv_version, bv_flags)
     bv_header += struct.pack("<HHH", state.bv_extent[0], state.bv_extent[1], state.bv_framerate)
 
     bitstream.frombytes(bv_header)
+
+    # write tile set, always all 256 entries
+
+    for t in tile_set.keys():
+        bitstream += t
+
+    bitstream += bitutil.zeros(16 * (BV_TILESET_SIZE - len(tile_set)))
+
+    # write keyframe index, offsets are from the start of the stream
+
+    frames_head = len(bitstream) + (4 + len(keyframes) * 8) * 8
+
+    if state.bv_coded:
+        coded_frames, coded_offsets = _enc_transcode(bv_bitstream, keyframes, state.bv_skips)
+        keyframes = [(frame_i, offset * 8) for (frame_i, _), offset in zip(keyframes, coded_offsets)]
+
+    bv_index = struct.pack("<I", len(keyframes))
+    for frame_i, bit_offset in keyframes:
+        bv_index += struct.pack("<II", frame_i, frames_head + bit_offset)
+
+    bitstream.frombytes(bv_index)
     
     # write bitframes
 
-    bitstream += bv_bitstream
+    if state.bv_coded:
+        bitstream.frombytes(coded_frames)
+    else:
+        bitstream += bv_bitstream
 
-    with open("out.bv", 'wb') as f:
+    with open(path, 'wb') as f:
         bitstream.tofile(f)
 
+# == native encoder ==
+
+# libbvenc (built with libbv's host tools) encodes the exact same stream, only much faster
+BV_ENC_LIB = os.environ.get("BV_ENC_LIB", "libbvenc.so")
+
+def enc_load_native() -> ctypes.CDLL | None:
+    try:
+        lib = ctypes.CDLL(BV_ENC_LIB)
+    except OSError:
+        return None
+
+    lib.bv_encoder_sizeof.restype = ctypes.c_uint32
+    lib.bv_encoder_init.restype = ctypes.c_int32
+    lib.bv_encoder_init.argtypes = [ctypes.c_void_p, ctypes.c_uint16, ctypes.c_uint16, ctypes.c_uint16]
+    lib.bv_encoder_set_keyframe_interval.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    lib.bv_encoder_set_tileset_updates.argtypes = [ctypes.c_void_p, ctypes.c_bool]
+    lib.bv_encoder_set_coded.argtypes = [ctypes.c_void_p, ctypes.c_bool]
+    lib.bv_encoder_set_slices.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    lib.bv_encoder_set_skips.argtypes = [ctypes.c_void_p, ctypes.c_bool]
+    lib.bv_encoder_scan_frame.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p]
+    lib.bv_encoder_build_tileset.argtypes = [ctypes.c_void_p]
+    lib.bv_encoder_encode_frame.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p]
+    lib.bv_encoder_output_size.restype = ctypes.c_uint32
+    lib.bv_encoder_output_size.argtypes = [ctypes.c_void_p]
+    lib.bv_encoder_output.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.bv_encoder_deinit.argtypes = [ctypes.c_void_p]
+    lib.bv_encoder_estimate_motion.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p]
+
+    return lib
+
+# builds the tile set, encodes all frames and writes the stream in one go, like the python path does
+def enc_encode_native(lib: ctypes.CDLL, state: BitVState, bit_frames: list[bitarray], flips: list[tuple[int, int]], path: str = "out.bv") -> None:
+    encoder = ctypes.create_string_buffer(lib.bv_encoder_sizeof())
+
+    if lib.bv_encoder_init(encoder, state.bv_extent[0], state.bv_extent[1], state.bv_framerate) < 0:
+        raise ValueError(f"can't encode a {state.bv_extent[0]}x{state.bv_extent[1]} stream")
+
+    lib.bv_encoder_set_keyframe_interval(encoder, state.bv_keyframe_interval)
+    lib.bv_encoder_set_tileset_updates(encoder, state.bv_tileset_updates)
+    lib.bv_encoder_set_coded(encoder, state.bv_coded)
+    lib.bv_encoder_set_slices(encoder, state.bv_slices)
+    lib.bv_encoder_set_skips(encoder, state.bv_skips)
+
+    # a byte per pixel, flips are the shift of the previous frame
+    frames = [f.unpack() for f in bit_frames]
+    frame_flips = [(ctypes.c_int8 * 2)(0, 0)] + [(ctypes.c_int8 * 2)(*f) for f in flips]
+
+    for frame, flip in zip(tqdm(frames, desc="building tile sets", unit="frames"), frame_flips):
+        lib.bv_encoder_scan_frame(encoder, frame, flip)
+
+    lib.bv_encoder_build_tileset(encoder)
+
+    for frame, flip in zip(tqdm(frames, desc="encoding frames", unit="frames"), frame_flips):
+        lib.bv_encoder_encode_frame(encoder, frame, flip)
+
+    out = ctypes.create_string_buffer(lib.bv_encoder_output_size(encoder))
+    lib.bv_encoder_output(encoder, out)
+    lib.bv_encoder_deinit(encoder)
+
+    with open(path, 'wb') as f:
+        f.write(out.raw)
+
 # == libbv frontend ==
 
 if __name__ == '__main__':
@@ -363,11 +1056,19 @@ if __name__ == '__main__':
 
         paths.append(path)
     
+    bv_native = enc_load_native()
+
     bv_state, bv_bitframes = enc_quantize_image_seq(paths)
-    bv_flips = enc_estimate_motion(bv_state, bv_bitframes)
-    bv_set = enc_build_tile_set(bv_state, bv_bitframes, bv_flips)
-    bv_stream = enc_encode_frames(bv_state, bv_bitframes, bv_flips, bv_set)
+    bv_flips = enc_estimate_motion(bv_state, bv_bitframes, bv_native)
     
     print(bv_state)
 
-    enc_output_stream(bv_state, bv_stream)
+    if bv_native:
+        enc_encode_native(bv_native, bv_state, bv_bitframes, bv_flips)
+    else:
+        print(f"{BV_ENC_LIB} not found, encoding in python")
+
+        bv_set = enc_build_tile_set(bv_state, bv_bitframes, bv_flips)
+        bv_stream, bv_keyframes = enc_encode_frames(bv_state, bv_bitframes, bv_flips, bv_set)
+
+        enc_output_stream(bv_state, bv_set, bv_stream, bv_keyframes)
@@ -0,0 +1,370 @@
+import sys
+import struct
+
+import bitarray.util as bitutil
+
+from bitarray import bitarray
+from dataclasses import dataclass
+
+# == bvmx container ==
+
+BVMX_VERSION = 1
+
+BVMX_STREAM_VIDEO = 0
+BVMX_STREAM_AUDIO = 1
+
+BV_HEADER_SIZE = 4 + 2 + 6 + 2 * 256
+BV_FLAG_INDEX = 1
+BV_FLAG_CODED = 2
+
+BV_EXT_ESCAPE = 0x80
+BV_EXT_KEYFRAME = 0
+BV_EXT_TILESET = 1
+BV_EXT_END = 2
+BV_EXT_SLICES = 3
+
+# version 5 streams skip instead of moving, and have wider slice entries
+BV_SKIP_VERSION = 5
+BV_SKIP_ORDER = 5
+BV_SKIP_PREFIX_MAX = 20
+
+# range coder contexts, laid out like bv_structs.h's
+BV_PROB_BITS = 11
+BV_PROB_MOVE = 5
+
+BV_CTX_CMD = 0
+BV_CTX_ADJ = BV_CTX_CMD + 3 * 2
+BV_CTX_MASK = BV_CTX_ADJ + 4
+BV_CTX_TILE_OP = BV_CTX_MASK + 16 * 4
+BV_CTX_TILE_INDEX = BV_CTX_TILE_OP + 4 * 3
+BV_CTX_TILE_BITS = BV_CTX_TILE_INDEX + 256
+BV_CTX_MOVE = BV_CTX_TILE_BITS + 16 * 4
+BV_CTX_SKIP = BV_CTX_MOVE + 2 * 32
+BV_CTX_COUNT = BV_CTX_SKIP + BV_SKIP_PREFIX_MAX
+
+BV_OP_BLACK, BV_OP_WHITE, BV_OP_INDEXED, BV_OP_INLINE = range(4)
+
+@dataclass(slots=True)
+class MuxChunk:
+    stream: int
+    pts_us: int
+    data: bytes
+
+# == bv stream splitting ==
+
+def _mux_bv_frame_ends(bits: bitarray, version: int) -> list[int]:
+    # bit offset just past the flip (or extended cmd) closing each frame
+    frame_ends = []
+    seek_head = 0
+
+    skips = version >= BV_SKIP_VERSION
+    slice_entry_bits = 8 + 25 if skips else 5 + 20
+
+    while seek_head + 2 <= len(bits):
+        if bits[seek_head]:
+            # supertile, 2 bit adjacency + 16 bit coverage mask then a cmd per covered tile
+            cv_bitmask = bits[seek_head + 3:seek_head + 19]
+            seek_head += 19
+
+            for covered in cv_bitmask:
+                if not covered:
+                    continue
+
+                if bits[seek_head]:
+                    seek_head += 2 # uniform
+                elif bits[seek_head + 1]:
+                    seek_head += 10 # tileset
+                else:
+                    seek_head += 18 # inline
+
+        elif bits[seek_head + 1]:
+            if not skips:
+                seek_head += 12 # move
+                continue
+
+            # skip, the Exp-Golomb prefix's zero bits then as many (plus the order) past its one bit
+            zeros = 0
+            while zeros < BV_SKIP_PREFIX_MAX and seek_head + 2 + zeros < len(bits) and not bits[seek_head + 2 + zeros]:
+                zeros += 1
+
+            seek_head += 2 + zeros + 1 + zeros + BV_SKIP_ORDER
+
+        else:
+            flip = bits[seek_head + 2:seek_head + 18]
+            seek_head += 18 # flip / extended
+
+            if len(flip) == 16 and flip.tobytes() == bytes((BV_EXT_ESCAPE, BV_EXT_TILESET)):
+                # tileset update, the frame goes on after its entries
+                count = bits[seek_head:seek_head + 4]
+                if len(count) < 4:
+                    break
+
+                seek_head += 4 + (bitutil.ba2int(count) + 1) * 24
+                continue
+
+            if len(flip) == 16 and flip.tobytes() == bytes((BV_EXT_ESCAPE, BV_EXT_SLICES)):
+                # slices, their cmds are walked like any other after the table
+                count = bits[seek_head:seek_head + 4]
+                if len(count) < 4:
+                    break
+
+                seek_head += 4 + (bitutil.ba2int(count) + 1) * slice_entry_bits
+                continue
+
+            if seek_head <= len(bits):
+                frame_ends.append(seek_head)
+
+    return frame_ends
+
+# LZMA's range decoder, only walks the cmds (bvdec's coded_read_cmd without keeping them)
+class _MuxRangeDecoder:
+    def __init__(self, data: bytes, pos: int, version: int):
+        self.data = data
+        self.version = version
+        self.range = 0xffffffff
+        self.code = int.from_bytes(self._bytes(pos, 5), 'big') & 0xffffffff
+        self.in_pos = pos + 5
+
+        self.prev_cmd = 0
+        self.prev_op = BV_OP_BLACK
+        self.probs = [1 << (BV_PROB_BITS - 1)] * BV_CTX_COUNT
+
+    def _bytes(self, pos: int, count: int) -> bytes:
+        return self.data[pos:pos + count].ljust(count, b'\0')
+
+    def _normalize(self) -> None:
+        if self.range < 1 << 24:
+            self.range <<= 8
+            self.code = ((self.code << 8) | self._bytes(self.in_pos, 1)[0]) & 0xffffffff
+            self.in_pos += 1
+
+    def bit(self, ctx: int) -> int:
+        prob = self.probs[ctx]
+        bound = (self.range >> BV_PROB_BITS) * prob
+
+        if self.code < bound:
+            self.range = bound
+            self.probs[ctx] = prob + (((1 << BV_PROB_BITS) - prob) >> BV_PROB_MOVE)
+            bit = 0
+        else:
+            self.range -= bound
+            self.code -= bound
+            self.probs[ctx] = prob - (prob >> BV_PROB_MOVE)
+            bit = 1
+
+        self._normalize()
+        return bit
+
+    def direct(self, width: int) -> int:
+        value = 0
+
+        for _ in range(width):
+            self.range >>= 1
+            bit = int(self.code >= self.range)
+            if bit:
+                self.code -= self.range
+
+            value = (value << 1) | bit
+            self._normalize()
+
+        return value
+
+    def tree(self, ctx: int, width: int) -> int:
+        node = 1
+
+        for _ in range(width):
+            node = (node << 1) | self.bit(ctx + node)
+
+        return node - (1 << width)
+
+    def supertile(self) -> None:
+        self.tree(BV_CTX_ADJ, 2)
+
+        cv_mask = 0
+        for t in range(16):
+            left = (cv_mask >> (t - 1)) & 1 if t % 4 else 1
+            above = (cv_mask >> (t - 4)) & 1 if t >= 4 else 1
+
+            cv_mask |= self.bit(BV_CTX_MASK + t * 4 + left * 2 + above) << t
+
+        for t in range(16):
+            if not (cv_mask >> t) & 1:
+                continue
+
+            op_ctx = BV_CTX_TILE_OP + self.prev_op * 3
+
+            if self.bit(op_ctx):
+                self.prev_op = BV_OP_WHITE if self.bit(op_ctx + 1) else BV_OP_BLACK
+            elif self.bit(op_ctx + 2):
+                self.tree(BV_CTX_TILE_INDEX, 8)
+                self.prev_op = BV_OP_INDEXED
+            else:
+                tile = 0
+                for i in range(16):
+                    left = (tile >> (i - 1)) & 1 if i % 4 else 0
+                    above = (tile >> (i - 4)) & 1 if i >= 4 else 0
+
+                    tile |= self.bit(BV_CTX_TILE_BITS + i * 4 + left * 2 + above) << i
+
+                self.prev_op = BV_OP_INLINE
+
+    # walks one cmd, returns the flip (or extended cmd) bytes if it ended the frame
+    def cmd(self) -> tuple[int, int] | None:
+        ctx = BV_CTX_CMD + self.prev_cmd * 2
+
+        if self.bit(ctx):
+            self.prev_cmd = 0
+            self.supertile()
+            return None
+
+        if self.bit(ctx + 1):
+            self.prev_cmd = 1
+
+            if self.version < BV_SKIP_VERSION:
+                self.tree(BV_CTX_MOVE, 5)
+                self.tree(BV_CTX_MOVE + 32, 5)
+                return None
+
+            zeros = 0
+            while zeros < BV_SKIP_PREFIX_MAX and not self.bit(BV_CTX_SKIP + zeros):
+                zeros += 1
+
+            self.direct(zeros + BV_SKIP_ORDER)
+            return None
+
+        self.prev_cmd = 2
+        flip = (self.direct(8), self.direct(8))
+
+        if flip == (BV_EXT_ESCAPE, BV_EXT_TILESET):
+            count = self.direct(4) + 1
+            self.direct(count * 24)
+            return None
+
+        return flip
+
+def _mux_coded_frame_ends(data: bytes, frames_head: int, version: int) -> list[int]:
+    # byte offset just past the last coded byte of each frame, every keyframe starts a new coder there
+    frame_ends = []
+    decoder = _MuxRangeDecoder(data, frames_head, version)
+
+    while decoder.in_pos <= len(data):
+        flip = decoder.cmd()
+        if flip is None:
+            continue
+
+        if decoder.in_pos > len(data):
+            break
+
+        frame_ends.append(decoder.in_pos)
+
+        if flip == (BV_EXT_ESCAPE, BV_EXT_END):
+            break
+        if flip == (BV_EXT_ESCAPE, BV_EXT_KEYFRAME):
+            decoder = _MuxRangeDecoder(data, decoder.in_pos, version)
+
+    return frame_ends
+
+def mux_split_bv(path: str) -> list[MuxChunk]:
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if data[0:4] != b'BitV':
+        raise IOError(f"{path} is not a BitV file")
+
+    version, flags = struct.unpack("<BB", data[4:6])
+    framerate = struct.unpack("<H", data[10:12])[0] or 30
+
+    frames_head = BV_HEADER_SIZE
+    if version >= 1 and flags & BV_FLAG_INDEX:
+        frames_head += 4 + struct.unpack("<I", data[frames_head:frames_head + 4])[0] * 8
+
+    # header (and index) first, then the bytes completing each frame; frames sharing a byte go
+    # with the later one, the tail (final unterminated frame) goes last
+
+    chunks = [MuxChunk(BVMX_STREAM_VIDEO, 0, data[:frames_head])]
+    byte_head = frames_head
+
+    if version >= 3 and flags & BV_FLAG_CODED:
+        frame_ends = [(end - frames_head) * 8 for end in _mux_coded_frame_ends(data, frames_head, version)]
+    else:
+        bits = bitarray(endian='little')
+        bits.frombytes(data[frames_head:])
+
+        frame_ends = _mux_bv_frame_ends(bits, version)
+
+    for frame_i, frame_end in enumerate(frame_ends):
+        next_head = frames_head + (frame_end + 7) // 8
+        if next_head == byte_head:
+            continue
+
+        chunks.append(MuxChunk(BVMX_STREAM_VIDEO, frame_i * 1000000 // framerate, data[byte_head:next_head]))
+        byte_head = next_head
+
+    if byte_head < len(data):
+        chunks.append(MuxChunk(BVMX_STREAM_VIDEO, len(frame_ends) * 1000000 // framerate, data[byte_head:]))
+
+    return chunks
+
+# == ogg page splitting ==
+
+def mux_split_ogg(path: str) -> list[MuxChunk]:
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    chunks = []
+    rate = 0
+    granule_last = 0
+    seek_head = 0
+
+    while seek_head < len(data):
+        if data[seek_head:seek_head + 4] != b'OggS':
+            raise IOError(f"{path} is not an ogg file (or it's corrupt at {seek_head})")
+
+        granule = struct.unpack("<q", data[seek_head + 6:seek_head + 14])[0]
+        segments = data[seek_head + 26]
+        body_size = sum(data[seek_head + 27:seek_head + 27 + segments])
+        page_size = 27 + segments + body_size
+
+        if not rate:
+            # the first page holds the vorbis identification header
+            body = data[seek_head + 27 + segments:seek_head + page_size]
+            if body[1:7] != b'vorbis':
+                raise IOError(f"{path} is not an ogg vorbis file")
+
+            rate = struct.unpack("<I", body[12:16])[0]
+
+        # a page is presented from the granule the last one ended on
+        chunks.append(MuxChunk(BVMX_STREAM_AUDIO, granule_last * 1000000 // rate, data[seek_head:seek_head + page_size]))
+
+        if granule > 0:
+            granule_last = granule
+
+        seek_head += page_size
+
+    return chunks
+
+# == muxer ==
+
+def mux_output_container(streams: list[list[MuxChunk]], path: str = "out.bvmx") -> None:
+    # stable, so each stream keeps its order and ties go to the earlier stream (video)
+    chunks = sorted((c for s in streams for c in s), key=lambda c: c.pts_us)
+
+    with open(path, 'wb') as f:
+        f.write(b'BVMX' + struct.pack("<BBH", BVMX_VERSION, 0, 0))
+
+        for c in chunks:
+            f.write(struct.pack("<BBHII", c.stream, 0, 0, c.pts_us, len(c.data)))
+            f.write(c.data)
+
+# == bvmux frontend ==
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print(f"usage: {sys.argv[0]} <in.bv> <in.ogg> [out.bvmx]")
+        exit(1)
+
+    video = mux_split_bv(sys.argv[1])
+    audio = mux_split_ogg(sys.argv[2])
+
+    mux_output_container([video, audio], sys.argv[3] if len(sys.argv) > 3 else "out.bvmx")
+    print(f"muxed {len(video)} video and {len(audio)} audio chunks")
@@ -10,6 +10,22 @@ from dataclasses import dataclass
 
 BV_INSPECT = False
 
+# == bv stream format ==
+
+BV_VERSION = 5
+BV_FLAG_INDEX = 1
+BV_FLAG_CODED = 2
+
+BV_EXT_ESCAPE = -128
+BV_EXT_KEYFRAME = 0
+BV_EXT_TILESET = 1
+BV_EXT_SLICES = 3
+
+# version 5 streams skip instead of moving, and have wider slice entries
+BV_SKIP_VERSION = 5
+BV_SKIP_ORDER = 5
+BV_SKIP_PREFIX_MAX = 20
+
 # == decoder internals ==
 
 @dataclass(slots=True)
@@ -20,14 +36,31 @@ class BitVState:
     bv_extent: tuple[int, int]
     bv_framerate: int = 30
 
+    # the header's tileset, keyframes go back to it
+    bv_header_table: dict = None
+
+    # (frame, bit offset into the frame bitstream) of every keyframe, empty when unindexed
+    bv_keyframes: list[tuple[int, int]] = None
+
+    bv_version: int = 1
+
+    # (bit offset, first supertile row) of the slices still ahead in the frame
+    bv_slice_starts: list[tuple[int, int]] = None
+
 def bv_open_stream(path: str) -> tuple[BitVState, bitarray]:
     with open(path, 'rb') as f:
-        if f.read(6) != b'BitV\x00\x00':
+        if f.read(4) != b'BitV':
             raise IOError("file is not a BitV file")
 
+        version, flags = struct.unpack("<BB", f.read(2))
+        if flags & BV_FLAG_CODED:
+            raise IOError("range coded BitV streams aren't supported, encode without coding to preview")
+        if version > BV_VERSION:
+            raise IOError(f"unsupported BitV version {version}")
+
         state_data = f.read(6)
         state_tuple = struct.unpack("<HHH", state_data)
-        state = BitVState((0, 0), {}, state_tuple[0:2], state_tuple[2])
+        state = BitVState((0, 0), {}, state_tuple[0:2], state_tuple[2], bv_keyframes=[], bv_version=version, bv_slice_starts=[])
 
         bv_table_data = f.read(2 * 256)
         for i in range(256):
@@ -36,6 +69,17 @@ def bv_open_stream(path: str) -> tuple[BitVState, bitarray]:
             
             state.bv_table[i] = tile
 
+        state.bv_header_table = dict(state.bv_table)
+
+        if flags & BV_FLAG_INDEX:
+            index_count = struct.unpack("<I", f.read(4))[0]
+            frames_head = f.tell() + index_count * 8
+
+            # index offsets are from the start of the file, make them relative to the frame bitstream
+            for _ in range(index_count):
+                frame_i, bit_offset = struct.unpack("<II", f.read(8))
+                state.bv_keyframes.append((frame_i, bit_offset - frames_head * 8))
+
         stream = bitarray(endian='little')
         stream.fromfile(f)
 
@@ -107,6 +151,117 @@ def bv_draw_supertile(bits: bitarray, state: BitVState, seek_head: int, win_buf:
 
     return seek_head
 
+def bv_decode_cmd(bits: bitarray, state: BitVState, seek_head: int, win_buf: pygame.BufferProxy, win_surf) -> tuple[int, bool]:
+    # walks the cmd at seek_head, returns where the next one starts and whether this one was the flip (or
+    # extended cmd) ending the frame, seek_head is then on its 16 bits
+
+    if state.bv_slice_starts and seek_head == state.bv_slice_starts[0][0]:
+        # slices start over at the left of their first row
+        state.bv_cursor = (0, state.bv_slice_starts.pop(0)[1])
+
+    skips = state.bv_version >= BV_SKIP_VERSION
+
+    if bits[seek_head]:
+        # draw supertile
+        return (bv_draw_supertile(bits, state, seek_head + 1, win_buf, win_surf), False)
+
+    cmd_b1 = bits[seek_head + 1]
+    seek_head += 2
+
+    if cmd_b1 and skips:
+        # skip cmd, an Exp-Golomb coded zigzagged raster distance
+
+        zeros = 0
+        while zeros < BV_SKIP_PREFIX_MAX and not bits[seek_head + zeros]:
+            zeros += 1
+
+        width = zeros + BV_SKIP_ORDER
+        value = (bitutil.ba2int(bits[seek_head + zeros + 1:seek_head + zeros + 1 + width]) | (1 << width)) - (1 << BV_SKIP_ORDER)
+        skip = (value + 1) // 2 if value & 1 else -(value // 2)
+
+        st_w = (state.bv_extent[0] + 15) // 16
+        raster = state.bv_cursor[1] * st_w + state.bv_cursor[0] + skip
+        state.bv_cursor = (raster % st_w, raster // st_w)
+
+        return (seek_head + zeros + 1 + width, False)
+
+    if cmd_b1:
+        # move cmd
+
+        state.bv_cursor = (bitutil.ba2int(bits[seek_head:seek_head + 5]), bitutil.ba2int(bits[seek_head + 5: seek_head + 10]))
+        return (seek_head + 10, False)
+
+    ext_cmd = struct.unpack("<bb", bits[seek_head:seek_head + 16].tobytes())
+
+    if ext_cmd == (BV_EXT_ESCAPE, BV_EXT_TILESET):
+        # tileset update, replaces entries for the rest of the frame (and those after it)
+        seek_head += 16
+        count = bitutil.ba2int(bits[seek_head:seek_head + 4]) + 1
+        seek_head += 4
+
+        for _ in range(count):
+            slot = bitutil.ba2int(bits[seek_head:seek_head + 8])
+            state.bv_table[slot] = bits[seek_head + 8:seek_head + 24]
+            seek_head += 24
+
+        return (seek_head, False)
+
+    if ext_cmd == (BV_EXT_ESCAPE, BV_EXT_SLICES):
+        # slices, played one after the other
+        seek_head += 16
+        count = bitutil.ba2int(bits[seek_head:seek_head + 4]) + 1
+        seek_head += 4
+
+        slice_row_bits, slice_size_bits = (8, 25) if skips else (5, 20)
+        slice_entry_bits = slice_row_bits + slice_size_bits
+
+        slice_head = seek_head + count * slice_entry_bits
+        for i in range(count):
+            entry_head = seek_head + i * slice_entry_bits
+            row = bitutil.ba2int(bits[entry_head:entry_head + slice_row_bits])
+            state.bv_slice_starts.append((slice_head, row))
+            slice_head += bitutil.ba2int(bits[entry_head + slice_row_bits:entry_head + slice_entry_bits])
+
+        return (seek_head + count * slice_entry_bits, False)
+
+    # flip cmd
+    return (seek_head, True)
+
+def bv_end_frame(bits: bitarray, state: BitVState, seek_head: int, win_surf) -> int:
+    # applies the flip (or keyframe) at seek_head to the shown frame, returns where the next frame starts
+    flip_offset = struct.unpack("<bb", bits[seek_head:seek_head + 16].tobytes())
+
+    if flip_offset[0] == BV_EXT_ESCAPE:
+        # extended cmd ending the frame, only keyframes
+        if flip_offset[1] == BV_EXT_KEYFRAME:
+            win_surf.fill((0, 0, 0))
+            state.bv_table = dict(state.bv_header_table)
+
+    else:
+        win_surf.scroll(dx=flip_offset[0])
+        win_surf.scroll(dy=flip_offset[1])
+
+    state.bv_cursor = (0, 0)
+    return seek_head + 16
+
+def bv_stream_ended(bits: bitarray, seek_head: int) -> bool:
+    # the final frame has no flip after it, less than a flip left is the last byte's padding
+    return len(bits) - seek_head < 18
+
+def bv_decode_frames(state: BitVState, bits: bitarray, win_surf):
+    # decodes the whole stream onto win_surf without presenting it, yields as each frame is complete
+    win_buf = win_surf.get_buffer()
+    seek_head = 0
+
+    while not bv_stream_ended(bits, seek_head):
+        seek_head, frame_end = bv_decode_cmd(bits, state, seek_head, win_buf, win_surf)
+
+        if frame_end:
+            yield
+            seek_head = bv_end_frame(bits, state, seek_head, win_surf)
+
+    yield
+
 def bv_play(state: BitVState, bits: bitarray) -> None:
     # init pygame player
 
@@ -123,58 +278,55 @@ def bv_play(state: BitVState, bits: bitarray) -> None:
     playback = True
    
     while True:
-        cmd_b0 = bits[seek_head]
-
-        if cmd_b0:
-            # draw supertile
-            seek_head += 1
-            seek_head = bv_draw_supertile(bits, state, seek_head, win_buf, win_surf)
+        if bv_stream_ended(bits, seek_head):
+            pygame.display.flip()
+            return
 
-        else:
-            cmd_b1 = bits[seek_head + 1]
-            seek_head += 2
+        seek_head, frame_end = bv_decode_cmd(bits, state, seek_head, win_buf, win_surf)
 
-            if cmd_b1:
-                # move cmd
+        if not frame_end:
+            continue
 
-                state.bv_cursor = (bitutil.ba2int(bits[seek_head:seek_head + 5]), bitutil.ba2int(bits[seek_head + 5: seek_head + 10]))
-                seek_head += 10
+        chapter = None
 
-            else:
-                # flip cmd
+        while True:
+            nextf = False
+            
+            for e in pygame.event.get():
+                if e.type == pygame.QUIT:
+                    exit()
 
-                while True:
-                    nextf = False
-                    
-                    for e in pygame.event.get():
-                        if e.type == pygame.QUIT:
-                            exit()
+                elif e.type == pygame.KEYDOWN and e.key == pygame.K_RIGHT:
+                    nextf = True
 
-                        elif e.type == pygame.KEYDOWN and e.key == pygame.K_RIGHT:
-                            nextf = True
+                elif e.type == pygame.KEYDOWN and e.key == pygame.K_SPACE:
+                    playback ^= True
 
-                        elif e.type == pygame.KEYDOWN and e.key == pygame.K_SPACE:
-                            playback ^= True
+                elif e.type == pygame.KEYDOWN and e.key == pygame.K_DOWN:
+                    # skip to the next keyframe
+                    chapter = next((kf for kf in state.bv_keyframes if kf[0] > frame_i + 1), None)
+                    nextf = chapter is not None
 
-                    if nextf or playback:
-                        break
+            if nextf or playback:
+                break
 
-                pygame.display.flip()
-                win_clk.tick(state.bv_framerate)
+        if chapter:
+            # land on the keyframe cmd in front of the keyframe, it clears the surf
+            frame_i = chapter[0] - 1
+            seek_head = chapter[1] - 16
+            state.bv_slice_starts.clear()
 
-                flip_offset = struct.unpack("<bb", bits[seek_head:seek_head + 16].tobytes())
-                win_surf.scroll(dx=flip_offset[0])
-                win_surf.scroll(dy=flip_offset[1])
+        pygame.display.flip()
+        win_clk.tick(state.bv_framerate)
 
-                if BV_INSPECT:
-                    win_surf.fill((0, 0, 0))
+        print(f"f: {frame_i}; vb: {round((seek_head - last_seek_head) / 1024, 2)}kb/f")
+        last_seek_head = seek_head
 
-                print(f"f: {frame_i}; vb: {round((seek_head - last_seek_head) / 1024, 2)}kb/f")
-                last_seek_head = seek_head
+        frame_i += 1
+        seek_head = bv_end_frame(bits, state, seek_head, win_surf)
 
-                frame_i += 1
-                state.bv_cursor = (0, 0)
-                seek_head += 16
+        if BV_INSPECT:
+            win_surf.fill((0, 0, 0))
 
 # == bvplay frontend ==
 
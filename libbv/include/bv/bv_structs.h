@@ -1,11 +1,105 @@
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 
+// newest bitstream revision bvdec understands
+#define BV_VERSION 5
+
+// bv_header flags
+#define BV_FLAG_INDEX 1 // a keyframe index follows the header
+#define BV_FLAG_CODED 2 // the frames are range coded (version 3+), see below
+
+// a flip cmd with this x shift is an extended cmd, selected by the y byte (version 1+)
+#define BV_EXT_ESCAPE 0x80
+#define BV_EXT_KEYFRAME 0 // ends the frame like a flip, the next frame starts from a blank fb
+#define BV_EXT_TILESET 1  // replaces tileset entries mid-frame (version 2+), see below
+#define BV_EXT_END 2      // ends the frame and the stream, only coded streams have (and need) it
+#define BV_EXT_SLICES 3   // splits the rest of the frame into slices (version 4+, plain streams only), see below
+
+// A tileset update is a 4 bit entry count - 1, then per entry its 8 bit tileset slot and 16 bit tile.
+// Updates hold until the next keyframe, which starts over from the header's tileset (so seeking works).
+#define BV_TILESET_UPDATE_MAX 16
+
+// A slice table is a 4 bit slice count - 1, then per slice its first supertile row and size in bits
+// (5 and 20 bits, 8 and 25 from version 5 on). The slices' cmds follow the table back to back: each one
+// starts with the cursor at column 0 of its first row, only has supertile and move / skip cmds, and only
+// draws into its own rows (up to the next slice's first one), so they can be decoded in any order or at
+// once. The frame ends right after.
+#define BV_SLICE_MAX 16
+#define BV_SLICE_ROW_BITS 5
+#define BV_SLICE_SIZE_BITS 20
+#define BV_SLICE_WIDE_ROW_BITS 8
+#define BV_SLICE_WIDE_SIZE_BITS 25
+
+// From version 5 on the 01 cmd is a skip instead of a move: the cursor goes a signed distance in supertile
+// raster order (row * supertile columns + column), zigzagged (d > 0 to 2d - 1, else -2d) into an order
+// BV_SKIP_ORDER Exp-Golomb code: n zero bits (n < BV_SKIP_PREFIX_MAX), a one bit, then the low
+// n + BV_SKIP_ORDER bits of the value + 2^BV_SKIP_ORDER.
+#define BV_SKIP_ORDER 5
+#define BV_SKIP_PREFIX_MAX 20
+
 #define BV_TILESET_SIZE 256
+
+// largest single cmd (a full slice table, a full tileset update is 406 bits and a supertile with 16
+// inline tiles 307) and the read-in bytes it may touch
+#define BV_CMD_MAX_BITS (2 + 16 + 4 + BV_SLICE_MAX * (BV_SLICE_WIDE_ROW_BITS + BV_SLICE_WIDE_SIZE_BITS))
+#define BV_CMD_MAX_BYTES ((BV_CMD_MAX_BITS + 7) / 8 + sizeof(uint32_t))
+
+// Coded streams have the same cmds, but every field goes through an adaptive binary range coder (LZMA's,
+// 11 bit probabilities). Each keyframe starts a new coder at the byte its index entry points to, with
+// all contexts reset; the final frame ends with BV_EXT_END. Flip bytes and tileset updates are coded
+// as plain bits, everything else gets a context from the table below: trees are msb first, indexed by
+// the bits so far (from 1), and mask / inline tile bits are conditioned on their left and upper neighbour.
+// A skip's zero bits (and the one ending them) get a context each, its low bits are plain.
+#define BV_PROB_BITS 11
+#define BV_PROB_MOVE 5
+
+#define BV_CTX_CMD 0                             // 2 per previous cmd: supertile?, then move?
+#define BV_CTX_ADJ (BV_CTX_CMD + 3 * 2)          // adjacency prefix, a 2 bit tree
+#define BV_CTX_MASK (BV_CTX_ADJ + 4)             // coverage mask, 4 per tile (left, above; set past the edge)
+#define BV_CTX_TILE_OP (BV_CTX_MASK + 16 * 4)    // 3 per previous tile op: uniform?, then white? / indexed?
+#define BV_CTX_TILE_INDEX (BV_CTX_TILE_OP + 4 * 3) // tileset index, an 8 bit tree
+#define BV_CTX_TILE_BITS (BV_CTX_TILE_INDEX + 256) // inline tile, 4 per pixel (left, above; clear past the edge)
+#define BV_CTX_MOVE (BV_CTX_TILE_BITS + 16 * 4)  // move x then y, 5 bit trees
+#define BV_CTX_SKIP (BV_CTX_MOVE + 2 * 32)       // skip prefix, one per zero bit so far (version 5+)
+#define BV_CTX_COUNT (BV_CTX_SKIP + BV_SKIP_PREFIX_MAX)
+
+// a coded supertile cmd decodes at most this many bits, each costs less than 7 coded bits; plus the
+// bytes a coder start reads
+#define BV_CODED_CMD_MAX_BITS (2 + 2 + 16 + 16 * 18)
+#define BV_CODED_CMD_MAX_BYTES ((BV_CODED_CMD_MAX_BITS * 7 + 7) / 8 + 5)
+
+// expanded tile cache slots, the tileset followed by the two uniform tiles
+#define BV_TILE_BLACK BV_TILESET_SIZE
+#define BV_TILE_WHITE (BV_TILESET_SIZE + 1)
+#define BV_TILE_CACHE_SIZE (BV_TILESET_SIZE + 2)
 #define BV_READ_BUF_SIZE 2048
 
+// Largest extent the library takes, build with a larger one (up to 4096, slice tables can't address
+// further) for bigger streams. Streams before version 5 can't go past 512, their move cmd only
+// addresses 32 supertiles.
+#ifndef BV_MAX_EXTENT
+#define BV_MAX_EXTENT 512
+#endif
+
+#define BV_MOVE_MAX_EXTENT 512
+
+_Static_assert(BV_MAX_EXTENT % 16 == 0 && BV_MAX_EXTENT <= 4096, "BV_MAX_EXTENT must be a multiple of 16, up to 4096");
+
+// damage bitmap layout, one bit per supertile, each supertile row starts on a new word
+#define BV_DAMAGE_STRIDE ((BV_MAX_EXTENT / 16 + 31) / 32)
+#define BV_DAMAGE_WORDS (BV_DAMAGE_STRIDE * (BV_MAX_EXTENT / 16))
+
+enum bv_fb_format {
+    BV_FB_8BPP = 0, // a byte per pixel, 0x00 / 0xff
+    BV_FB_4BPP,     // two pixels per byte, low nibble first, 0x0 / 0xf
+    BV_FB_1BPP,     // eight pixels per byte, lsb first
+};
+
 struct __attribute__((__packed__)) bv_header {
-    uint8_t __magic[6];
+    uint8_t magic[4];
+    uint8_t version;
+    uint8_t flags;
 
     uint16_t extent[2];
     uint16_t framerate;
@@ -13,18 +107,142 @@ struct __attribute__((__packed__)) bv_header {
     uint16_t tileset[256];
 };
 
+// keyframe index entry, the index is a u32 entry count followed by the entries (sorted by frame)
+struct __attribute__((__packed__)) bv_index_entry {
+    uint32_t frame;
+    uint32_t bit_offset; // first bit of the keyframe's diffs, from the start of the stream
+};
+
+// tile op (previous cmd / tile op contexts)
+enum bv_tile_op {
+    BV_OP_BLACK = 0,
+    BV_OP_WHITE,
+    BV_OP_INDEXED,
+    BV_OP_INLINE,
+};
+
+struct bv_coder {
+    uint32_t range;
+    uint32_t code;
+    uint32_t in_pos; // next input byte
+
+    uint8_t prev_cmd; // 0 - supertile, 1 - move, 2 - flip
+    uint8_t prev_op;
+    uint16_t probs[BV_CTX_COUNT];
+};
+
+// 64 bits of an attached stream, from bit head (word aligned) on
+struct bv_bit_cache {
+    uint32_t head;
+    uint64_t bits;
+};
+
+// a slice of the frame being decoded, what decoding it drew is added to the stream's counts once
+// the frame finishes
+struct bv_slice {
+    uint32_t bit_head;
+    uint32_t bit_end;
+    uint16_t rows[2]; // supertile rows it draws into, [rows[0], rows[1])
+
+    struct bv_bit_cache cache;
+
+    uint32_t supertile_count;
+    uint32_t tile_count;
+    uint32_t damage_count;
+};
+
+struct bv_damage {
+    // the whole frame changed (eg. moved by a flip shift), bits are only set for redrawn supertiles
+    bool full;
+
+    // flip shift the frame was moved by before the redraw, full is set along with it
+    int8_t shift[2];
+
+    uint32_t count;
+    uint32_t bits[BV_DAMAGE_WORDS];
+};
+
 struct bv_stream {
     uint16_t extent[2];
     uint16_t framerate;
 
+    uint8_t fb_format;
+    uint32_t fb_stride;
     uint32_t fb_size;
-    uint16_t frame_index;
+
+    uint32_t frame_index;
+    uint32_t supertile_count;
+    uint32_t tile_count;
+
+    // fbs[1] is null when single-buffered
     uint8_t *fbs[2];
 
+    // Each fb wraps around its origin, pixel x, y of the frame is stored at
+    // ((x + origin[0]) % extent[0], (y + origin[1]) % extent[1]); a flip shift only moves the origin.
+    uint16_t fb_origins[2][2];
+
+    // origin[0] stays 0, horizontal shifts are applied to the pixels (bv_stream_pin_origin_x)
+    bool origin_x_pinned;
+    volatile uint8_t front;
+    volatile bool swap_pending;
+
+    bool frame_open;
+    int8_t flip_shift[2];
+
+    // clear the fb at the next frame open (keyframe), or skip the front fb copy as the back is current (seek)
+    bool fb_reset;
+    bool back_synced;
+
+    // the damage can't bring the other fb up to date, the next frame open copies it whole
+    bool back_resync;
+
+    // supertiles redrawn by the last (or currently decoding) frame
+    struct bv_damage damage;
+
+    uint8_t version;
+    uint32_t frames_head;
+    uint32_t index_head;
+    uint32_t index_count;
+
+    // passed bv_stream_verify, decode skips the per-tile bounds checks
+    bool verified;
+
     uint16_t cursor[2];
     uint16_t tileset[BV_TILESET_SIZE];
-    
+
+    // the header's tileset, restored at keyframes once updates changed the tileset
+    uint16_t header_tileset[BV_TILESET_SIZE];
+    bool tileset_updated;
+
+    // tileset rows pre-expanded into the fb format, ready to be stored as is
+    uint32_t tile_rows[BV_TILE_CACHE_SIZE][4];
+
+    // bit_head is only written by the decoder and buf_head by whoever feeds read_buf,
+    // both may run concurrently (see bv_stream_write_window)
     uint32_t bit_head;
     uint32_t buf_head;
     uint8_t read_buf[BV_READ_BUF_SIZE];
+
+    // no more input will be committed, cmds near the end can't wait for a full BV_CMD_MAX_BYTES
+    bool input_ended;
+
+    // range coder state of a coded stream, the next input byte is bit_head / 8 between cmds; it starts
+    // over at the next cmd after a keyframe (or seek)
+    bool coded;
+    bool coder_restart;
+    bool stream_ended;
+    struct bv_coder coder;
+
+    // the current frame's slices (none when slice_count is 0), slice_next is the one a serial decode
+    // is in; claimed once bv_stream_slice_frame handed them out to bv_stream_decslice
+    uint32_t slice_count;
+    uint32_t slice_next;
+    bool slices_claimed;
+    struct bv_slice slices[BV_SLICE_MAX];
+
+    // attached input, when set read_buf is bypassed entirely
+    const uint8_t *mem;
+    uint32_t mem_size;
+
+    struct bv_bit_cache cache;
 };
\ No newline at end of file
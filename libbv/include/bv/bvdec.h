@@ -1,26 +1,94 @@
 #pragma once
 #include "bv_structs.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/* placement */
+
+// kernels the firmware runs from irqs (eg. bv_scale_row) go in RAM there instead of executing from
+// XIP flash; BV_RAM_FUNCS is set by libbv/CMakeLists.txt when cross-compiling with the pico sdk
+#ifdef BV_RAM_FUNCS
+#include <pico/platform.h>
+#define BV_RAM_FUNC(func_name) __not_in_flash_func(func_name)
+#else
+#define BV_RAM_FUNC(func_name) func_name
+#endif
+
 /* bv_stream dec api */
 
 // bvdec bv_stream init 
 void bv_stream_init(struct bv_stream *s);
 void bv_stream_deinit(struct bv_stream *s);
 
-// read-in a bv header; returns: 0 - success, -1 - read needed
+// read-in a bv header; returns: 0 - success, -1 - read needed, -2 - unsupported stream
 int32_t bv_stream_configure(struct bv_stream *s);
 
-// find an externally owned framebuffer (of size at least s->fb_size)
-// TODO: double-buffering
-void bv_stream_bind(struct bv_stream *s, uint8_t *fbs[1]);
+// select the fb layout (default BV_FB_8BPP); updates s->fb_stride and s->fb_size
+void bv_stream_set_format(struct bv_stream *s, enum bv_fb_format format);
+
+// keep the fbs' origin[0] at 0 (before bind), horizontal flip shifts move every row's pixels instead of
+// the origin; for scanouts which can only start a row at word boundaries (see bv_stream.fb_origins)
+void bv_stream_pin_origin_x(struct bv_stream *s, bool pinned);
+
+// find externally owned framebuffers (of size at least s->fb_size); fbs[1] may be null for single-buffering,
+// when double-buffered each frame is decoded into the off-screen fb and presented with bv_stream_commit_swap
+void bv_stream_bind(struct bv_stream *s, uint8_t *fbs[2]);
 
-// bitstream read-in
+// bitstream read-in, copies into read_buf; must never be given more than fits (see bv_stream_write_window)
 void bv_stream_read(struct bv_stream *s, uint8_t *buf, uint32_t bytes_read);
 
-// streaming decode; returns: 0 - success / frame done, -1 - read needed
+// Credit interface for asynchronous feeders (DMA, another thread), safe to use while the decoder runs
+// as long as there's a single feeder. The window is the contiguous part of read_buf the decoder is done
+// with, fill (part of) it and commit the bytes written; returns the window start, *bytes is its size.
+uint8_t *bv_stream_write_window(struct bv_stream *s, uint32_t *bytes);
+void bv_stream_commit(struct bv_stream *s, uint32_t bytes);
+
+// mark the end of the input, everything up to it was committed
+void bv_stream_end_input(struct bv_stream *s);
+
+// attach a whole, contiguous bitstream (eg. in XIP flash or mmap'd); replaces bv_stream_read,
+// buf must outlive the stream; decframe returns -1 only at end of stream
+void bv_stream_attach_memory(struct bv_stream *s, const uint8_t *buf, uint32_t size);
+
+// check a whole attached stream in one pass (cmd structure, cursor bounds, extent, keyframe index), the
+// stream must be attached (asserted); a verified stream decodes without per-tile bounds checks,
+// unverified ones drop tiles outside the frame;
+// returns: 0 - valid, -2 - invalid (or not attached in NDEBUG builds), the offending bit is stored in
+// bad_bit (may be null)
+// a coded stream is checked with the decoder's own coder, so verify before decoding (or seek after)
+int32_t bv_stream_verify(struct bv_stream *s, uint32_t *bad_bit);
+
+// streaming decode; returns: 0 - success / frame done, -1 - read needed, -2 - malformed stream
+// must not be called while a swap is pending, the fb it would decode into is still on-screen
 int32_t bv_stream_decframe(struct bv_stream *s);
 
+// Slice-parallel decoding of the next frame: opens it and, if it's a sliced one with all its slices
+// resident, hands out the slices; returns: n - slice count, 0 - not sliced (decframe decodes it all),
+// -1 - read needed. Each of the n slices is then decoded once by bv_stream_decslice, from any thread
+// and in any order, and once they're all done bv_stream_decframe finishes the frame.
+int32_t bv_stream_slice_frame(struct bv_stream *s);
+void bv_stream_decslice(struct bv_stream *s, uint32_t slice);
+
+// position an attached, indexed stream so the next decframe decodes "frame"; decodes forward from the
+// nearest keyframe, drops a pending swap; returns: 0 - success, -1 - past the end, -2 - no index / not attached
+int32_t bv_stream_seek(struct bv_stream *s, uint32_t frame);
+
+// true while a decoded frame waits to be presented
+bool bv_stream_swap_pending(struct bv_stream *s);
+
+// present the last decoded frame, meant to be called at vblank (irq safe); returns true if the fbs were swapped
+bool bv_stream_commit_swap(struct bv_stream *s);
+
+// supertiles changed by the last decoded frame, valid until the next decframe call
+const struct bv_damage *bv_stream_damage(struct bv_stream *s);
+
+static inline bool bv_damage_test(const struct bv_damage *d, uint32_t st_x, uint32_t st_y) {
+    return d->full || ((d->bits[st_y * BV_DAMAGE_STRIDE + st_x / 32] >> (st_x % 32)) & 1);
+}
+
 // fetch the currently active fb (aka fb which should be on-screen)
-uint8_t* bv_stream_active_fb(struct bv_stream *s);
\ No newline at end of file
+uint8_t* bv_stream_active_fb(struct bv_stream *s);
+
+// origin the active fb wraps around (see bv_stream.fb_origins), changes along with the active fb
+const uint16_t *bv_stream_active_origin(struct bv_stream *s);
\ No newline at end of file
@@ -0,0 +1,152 @@
+#pragma once
+#include "bv_structs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// largest shift the motion search tries, either way on both axes
+#define BV_MOTION_RANGE 16
+
+// Tileset updates look this many frames ahead (up to the next keyframe): a tile missing the tileset
+// replaces the entry drawn the least in there when it's drawn BV_TILESET_GAIN more times (an entry
+// costs 24 bits, each indexed tile saves 8).
+#define BV_TILESET_LOOKAHEAD 20
+#define BV_TILESET_GAIN 5
+
+// a frame is only cut into as many slices as give each this many damaged supertiles
+#define BV_SLICE_MIN_SUPERTILES 8
+
+// a non-uniform tile drawn count times in a frame
+struct bv_tile_use {
+    uint16_t tile;
+    uint16_t count;
+};
+
+// a bi-level image as packed rows, bit x of a row is pixel x
+struct bv_motion_plane {
+    uint16_t extent[2];
+    uint32_t words;
+    uint64_t *rows;
+};
+
+// Native .bv encoder, produces the same bitstream as bvenc.py. Frames are bi-level, a byte per pixel
+// (zero is black) row by row. Encoding takes two passes over the frames: a scan pass collecting tile
+// reuse for the tileset, then the encode pass; both get the same frames and flips in the same order.
+// Host only, it isn't part of the firmware's bv library.
+
+struct bv_encoder {
+    uint16_t extent[2];
+    uint16_t framerate;
+
+    // frames between self-contained keyframes, 0 to only have frame 0 (default 300)
+    uint32_t keyframe_interval;
+
+    // frames scanned / encoded so far in the current pass
+    uint32_t frame_index;
+    bool tileset_built;
+
+    // previous frame of the pass and the (shifted) frame the next one is diffed against
+    uint8_t *prev;
+    uint8_t *src;
+
+    // tile reuse over the scan pass, indexed by the 16 tile bits
+    uint32_t *tile_counts;
+    uint32_t *tile_seen;
+    uint32_t tiles_seen;
+
+    // the scan pass' tiles frame by frame (the first of frame f at frame_uses[f]), for the lookahead
+    struct bv_tile_use *tile_uses;
+    uint32_t tile_use_count;
+    uint32_t tile_use_cap;
+    uint32_t *frame_uses;
+    uint32_t frame_use_cap;
+    uint32_t scanned_frames;
+
+    uint16_t tileset[BV_TILESET_SIZE];
+    uint32_t tileset_size;
+    int16_t *tile_index;
+
+    // tileset updates between keyframes (default on): the live tileset tile_index maps into and the
+    // frame each entry was last drawn from
+    bool tileset_updates;
+    uint32_t tileset_update_count;
+    uint16_t live_tileset[BV_TILESET_SIZE];
+    int32_t slot_used[BV_TILESET_SIZE];
+
+    // draws per tile over the lookahead, and the tiles drawn
+    uint32_t *ahead_counts;
+    uint16_t *ahead_tiles;
+    uint32_t ahead_tile_count;
+
+    // damaged tiles per supertile of the current frame, and the supertiles in first damaged pixel order
+    uint16_t st_extent[2];
+    uint16_t *st_masks;
+    uint16_t *st_order;
+    uint32_t st_count;
+
+    // frame bitstream, lsb first
+    uint8_t *bits;
+    uint64_t bit_size;
+    uint64_t bit_cap;
+
+    // motion search planes, prev and current frame at a pixel per tile then at full resolution
+    struct bv_motion_plane motion_planes[4];
+    uint64_t *motion_row;
+
+    // keyframes, bit offsets are relative to the frame bitstream until the output is assembled
+    struct bv_index_entry *index;
+    uint32_t index_count;
+    uint32_t index_cap;
+
+    // coded output (default off): the frame bitstream is range coded when the output is assembled,
+    // coded_offsets holds the byte each keyframe's coder starts at; kept until the bitstream grows
+    bool coded;
+    uint8_t *coded_bytes;
+    uint32_t coded_size;
+    uint32_t coded_cap;
+    uint32_t *coded_offsets;
+    uint64_t coded_bit_size;
+
+    // frames are cut into up to this many slices for parallel decoding (default 0, off; up to
+    // BV_SLICE_MAX), not while coded
+    uint32_t slices;
+    uint32_t sliced_frame_count;
+
+    // skip cmds instead of moves (default on, version 5); always on past BV_MOVE_MAX_EXTENT, where
+    // moves can't address every supertile
+    bool skips;
+};
+
+/* bv_encoder api */
+
+// returns: 0 - success, -2 - unsupported extent (zero, past BV_MAX_EXTENT or not a multiple of 4)
+int32_t bv_encoder_init(struct bv_encoder *e, uint16_t width, uint16_t height, uint16_t framerate);
+void bv_encoder_deinit(struct bv_encoder *e);
+
+// Scan pass, flip is the shift the previous frame gets before this one is diffed against it
+// (ignored for the first frame).
+void bv_encoder_scan_frame(struct bv_encoder *e, const uint8_t *frame, const int8_t flip[2]);
+
+// Global motion between two frames: the flip shift for prev that leaves the fewest damaged tiles
+// against frame. Searches every tile-sized step on a pixel per tile downscale first, then refines
+// around the best one at full resolution; no shift wins ties.
+void bv_encoder_estimate_motion(struct bv_encoder *e, const uint8_t *prev, const uint8_t *frame, int8_t flip[2]);
+
+// pick the 256 most reused tiles and start the encode pass
+void bv_encoder_build_tileset(struct bv_encoder *e);
+
+// encode pass, appends the frame's cmds (and the flip / keyframe cmd in front of it)
+void bv_encoder_encode_frame(struct bv_encoder *e, const uint8_t *frame, const int8_t flip[2]);
+
+// size of the whole .bv file and the file itself (header, tileset, index and frames), a coded
+// encoder's frames are transcoded here
+uint32_t bv_encoder_output_size(struct bv_encoder *e);
+void bv_encoder_output(struct bv_encoder *e, uint8_t *out);
+
+// for bindings which can't use the struct directly (ctypes)
+uint32_t bv_encoder_sizeof(void);
+void bv_encoder_set_keyframe_interval(struct bv_encoder *e, uint32_t interval);
+void bv_encoder_set_tileset_updates(struct bv_encoder *e, bool enabled);
+void bv_encoder_set_coded(struct bv_encoder *e, bool enabled);
+void bv_encoder_set_slices(struct bv_encoder *e, uint32_t slices);
+void bv_encoder_set_skips(struct bv_encoder *e, bool enabled);
@@ -0,0 +1,86 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/* bvmx container */
+
+// A .bvmx file interleaves the chunks of a .bv stream and an ogg stream in presentation order, so both
+// can be fed from one sequential pass over slow sequential media (sd card, host pipe). It's a bvmx_header
+// followed by chunks, each a bvmx_chunk and its payload. Concatenating the payloads of a stream gives
+// back the original file byte for byte, chunks only ever split it (at frame / page boundaries).
+
+#define BVMX_VERSION 1
+
+// chunk stream ids
+#define BVMX_STREAM_VIDEO 0 // .bv bytes, header chunks first then one chunk per frame
+#define BVMX_STREAM_AUDIO 1 // ogg pages
+#define BVMX_STREAM_COUNT 2
+
+struct __attribute__((__packed__)) bvmx_header {
+    uint8_t magic[4];
+    uint8_t version;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+struct __attribute__((__packed__)) bvmx_chunk {
+    uint8_t stream;
+    uint8_t flags;
+    uint16_t reserved;
+
+    // presentation time of the first frame / sample the payload completes
+    uint32_t pts_us;
+    uint32_t size;
+};
+
+// Take (part of) a chunk's payload, chunk is the header of the chunk it belongs to and offset how far
+// into its payload data starts; returns the bytes taken, taking less than size stalls the reader
+// until the next bvmx_reader_feed call.
+typedef uint32_t (*bvmx_sink)(void *ctx, const struct bvmx_chunk *chunk, uint32_t offset,
+                              const uint8_t *data, uint32_t size);
+
+struct bvmx_reader {
+    uint8_t version;
+    bool configured;
+
+    // the header being parsed (the container's first, then each chunk's)
+    uint8_t head_buf[sizeof(struct bvmx_chunk)];
+    uint32_t head_fill;
+
+    struct bvmx_chunk chunk;
+    uint32_t chunk_seek;
+
+    uint32_t chunk_count;
+    uint64_t stream_bytes[BVMX_STREAM_COUNT];
+
+    bvmx_sink sinks[BVMX_STREAM_COUNT];
+    void *sink_ctxs[BVMX_STREAM_COUNT];
+};
+
+/* bvmx reader api */
+
+void bvmx_reader_init(struct bvmx_reader *r);
+
+// route a stream's payload to sink, payloads of streams without a sink are skipped
+void bvmx_reader_set_sink(struct bvmx_reader *r, uint8_t stream, bvmx_sink sink, void *ctx);
+
+// Push the next bytes of the container through the reader; returns how many were consumed (fewer than
+// size when a sink stalled, feed the rest again later), or -2 for an unsupported / corrupt container.
+int32_t bvmx_reader_feed(struct bvmx_reader *r, const uint8_t *data, uint32_t size);
+
+// true while the reader sits between chunks, ie. the input may end here
+bool bvmx_reader_at_boundary(struct bvmx_reader *r);
+
+/* bvmx sinks */
+
+struct bv_stream;
+
+// bv_stream_read sink, stalls while read_buf is full; ctx is the bv_stream
+uint32_t bvmx_bv_sink(void *ctx, const struct bvmx_chunk *chunk, uint32_t offset,
+                      const uint8_t *data, uint32_t size);
+
+// ogg_sync_buffer / ogg_sync_wrote sink, takes everything (ogg_sync grows to fit, pull pages out with
+// ogg_sync_pageout between feeds to keep it small); ctx is the ogg_sync_state. Only in the bvmx_ogg
+// library, built where libogg is available.
+uint32_t bvmx_ogg_sink(void *ctx, const struct bvmx_chunk *chunk, uint32_t offset,
+                       const uint8_t *data, uint32_t size);
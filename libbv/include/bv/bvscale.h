@@ -0,0 +1,46 @@
+#pragma once
+#include "bv_structs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* bv_scaler api */
+
+// nearest-neighbour upscale of bv fbs into 8bpp (0x00 / 0xff) scanlines, one line at a time
+
+#define BV_SCALE_MAX_WIDTH 1024
+#define BV_SCALE_MAX_HEIGHT 1024
+
+// distinct 4 pixel source patterns an upscale can produce (non-decreasing offsets 0..3)
+#define BV_SCALE_PATTERNS 20
+
+struct bv_scaler {
+    uint16_t src_extent[2];
+    uint16_t dst_extent[2];
+
+    uint8_t src_format;
+    uint32_t src_stride;
+
+    // dst line -> src row and dst pixel -> src pixel
+    uint16_t y_map[BV_SCALE_MAX_HEIGHT];
+    uint16_t x_map[BV_SCALE_MAX_WIDTH];
+
+    // 1bpp fast path, each 4 pixel dst word is expanded from a 4 pixel src window
+    bool word_path;
+    uint16_t word_pos[BV_SCALE_MAX_WIDTH / 4];
+    uint8_t word_pattern[BV_SCALE_MAX_WIDTH / 4];
+    uint8_t pattern_keys[BV_SCALE_PATTERNS];
+    uint32_t pattern_lut[BV_SCALE_PATTERNS][16];
+};
+
+// build the scale tables for s's current extent and fb format; returns: 0 - success, -1 - unsupported extent
+int32_t bv_scaler_init(struct bv_scaler *sc, const struct bv_stream *s, uint16_t dst_width, uint16_t dst_height);
+
+// src row shown on a dst line
+static inline uint16_t bv_scaler_src_row(const struct bv_scaler *sc, uint32_t dst_line) {
+    return sc->y_map[dst_line];
+}
+
+// expand src row "row" of fb (wrapping around origin, see bv_stream_active_origin) into dst_extent[0]
+// 8bpp pixels (dst must be 4 byte aligned)
+void bv_scale_row(const struct bv_scaler *sc, const uint8_t *fb, const uint16_t origin[2], uint32_t row, uint8_t *dst);
@@ -1,52 +1,82 @@
 #include <bv/bvdec.h>
 
-#include <pico/stdlib.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
-#include <stdio.h>
 #include <assert.h>
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
 void bv_stream_init(struct bv_stream *s) {
     memset(s, 0, sizeof(*s));
 }
 
 void bv_stream_deinit(struct bv_stream *s) {
+    (void)s;
 }
 
 /* bvdec read-in */
 
-void bv_stream_read(struct bv_stream *s, uint8_t *buf, uint32_t bytes_read) {
-    // validate
+uint8_t *bv_stream_write_window(struct bv_stream *s, uint32_t *bytes) {
+    assert(!s->mem && "bv_stream_write_window on a memory attached stream");
 
-    assert(s->buf_head + bytes_read - MIN(s->buf_head + bytes_read, BV_READ_BUF_SIZE) <= s->bit_head / 8);
+    // everything before the byte holding bit_head is consumed, a stale (smaller) bit_head only means less space
+    const uint32_t buf_head = s->buf_head;
+    const uint32_t read_tail = MIN(__atomic_load_n(&s->bit_head, __ATOMIC_ACQUIRE) / 8, buf_head);
 
-    // read-in
+    const uint32_t space = BV_READ_BUF_SIZE - (buf_head - read_tail);
+    const uint32_t until_wrap = BV_READ_BUF_SIZE - buf_head % BV_READ_BUF_SIZE;
 
-    uint32_t next_head = s->buf_head + bytes_read;
-    if (next_head / BV_READ_BUF_SIZE > s->buf_head / BV_READ_BUF_SIZE) {
-        uint32_t curr_head = s->buf_head % BV_READ_BUF_SIZE;
-        next_head %= BV_READ_BUF_SIZE;
+    *bytes = MIN(space, until_wrap);
+    return &s->read_buf[buf_head % BV_READ_BUF_SIZE];
+}
 
-        uint32_t bytes_until_wrap = bytes_read - next_head;
+void bv_stream_commit(struct bv_stream *s, uint32_t bytes) {
+    // the bytes must land before the decoder sees the new head
+    __atomic_store_n(&s->buf_head, s->buf_head + bytes, __ATOMIC_RELEASE);
+}
 
-        if (bytes_until_wrap)
-            memcpy(&s->read_buf[curr_head], buf, bytes_until_wrap);
-        if (next_head)
-            memcpy(&s->read_buf[0], buf + bytes_until_wrap, next_head);
-    } else {
-        memcpy(&s->read_buf[s->buf_head % BV_READ_BUF_SIZE], buf, bytes_read);
-    }
+void bv_stream_end_input(struct bv_stream *s) {
+    __atomic_store_n(&s->input_ended, true, __ATOMIC_RELEASE);
+}
+
+void bv_stream_read(struct bv_stream *s, uint8_t *buf, uint32_t bytes_read) {
+    while (bytes_read) {
+        uint32_t space;
+        uint8_t *window = bv_stream_write_window(s, &space);
+
+        assert(space && "bv_stream_read would overwrite unconsumed input");
 
-    s->buf_head += bytes_read;
+        const uint32_t size = MIN(space, bytes_read);
+        memcpy(window, buf, size);
+        bv_stream_commit(s, size);
+
+        buf += size;
+        bytes_read -= size;
+    }
 }
 
 static int32_t read_in_bytes(struct bv_stream *s, uint8_t *buf, uint32_t head, uint32_t size) {
+    if (s->mem) {
+        if (head + size > s->mem_size)
+            return -1; // truncated stream
+
+        memcpy(buf, &s->mem[head], size);
+        return 0;
+    }
+
     // validate
 
-    assert(head + BV_READ_BUF_SIZE >= s->buf_head);
+    const uint32_t buf_head = __atomic_load_n(&s->buf_head, __ATOMIC_ACQUIRE);
+    assert(head + BV_READ_BUF_SIZE >= buf_head);
 
     uint32_t next_head = head + size;
-    if (next_head >= s->buf_head)
+    if (next_head >= buf_head)
         return -1; // read needed
 
     // read-in
@@ -69,10 +99,63 @@ static int32_t read_in_bytes(struct bv_stream *s, uint8_t *buf, uint32_t head, u
     return 0;
 }
 
+// Load the little-endian 32-bit word "word" of an attached stream,
+// anything past the end of the stream reads as zero.
+static uint32_t mem_load_word(struct bv_stream *s, uint32_t word) {
+    uint32_t head = word * sizeof(uint32_t);
+    uint32_t bits = 0;
+
+    if (head + sizeof(uint32_t) <= s->mem_size) {
+        memcpy(&bits, &s->mem[head], sizeof(uint32_t));
+    } else {
+        for (uint32_t i = 0; head + i < s->mem_size && i < sizeof(uint32_t); i++)
+            bits |= (uint32_t)s->mem[head + i] << (i * 8);
+    }
+
+    return bits;
+}
+
+// Move the 64-bit bit cache window so it covers the word containing "pos".
+static void mem_refill(struct bv_stream *s, struct bv_bit_cache *cache, uint32_t pos) {
+    uint32_t word = pos / 32;
+
+    if (word == cache->head / 32 + 1) {
+        // sequential read-in, shift in a single new word
+        cache->bits = (cache->bits >> 32) | ((uint64_t)mem_load_word(s, word + 1) << 32);
+    } else {
+        cache->bits = mem_load_word(s, word) | ((uint64_t)mem_load_word(s, word + 1) << 32);
+    }
+
+    cache->head = word * 32;
+}
+
+// Grab "width" bits starting at bit number "pos" of an attached stream,
+// which can't fail (anything past its end reads as zero). Attached
+// streams are read straight out of the bit cache, the window is word
+// aligned so any field of up to 25 bits fits.
+static inline uint32_t read_mem_bits(struct bv_stream *s, struct bv_bit_cache *cache, size_t pos, uint32_t width) {
+    assert(s->mem);
+    assert(width <= 32 - 7);
+
+    uint32_t offset = pos - cache->head;
+    if (offset > 64 - width) {
+        mem_refill(s, cache, pos);
+        offset = pos % 32;
+    }
+
+    return (cache->bits >> offset) & ((1u << width) - 1);
+}
+
 // Treating buf[] as a giant little-endian integer, grab "width"
-// bits starting at bit number "pos" (LSB=bit 0).
-static uint32_t read_in_bits(struct bv_stream *s, int32_t *buf, size_t pos, uint32_t width) {
-    assert(width >= 0 && width <= 32 - 7);
+// bits starting at bit number "pos" (LSB=bit 0). Attached streams
+// go through a bit cache, the stream's own or a slice's.
+static inline int32_t read_bits_cached(struct bv_stream *s, struct bv_bit_cache *cache, uint32_t *buf, size_t pos, uint32_t width) {
+    assert(width <= 32 - 7);
+
+    if (s->mem) {
+        *buf = read_mem_bits(s, cache, pos, width);
+        return 0;
+    }
 
     // Read a 32-bit little-endian number starting from the byte
     // containing bit number "pos" (relative to "buf").
@@ -91,37 +174,437 @@ static uint32_t read_in_bits(struct bv_stream *s, int32_t *buf, size_t pos, uint
     return 0;
 }
 
+static int32_t read_in_bits(struct bv_stream *s, uint32_t *buf, size_t pos, uint32_t width) {
+    return read_bits_cached(s, &s->cache, buf, pos, width);
+}
+
+void bv_stream_attach_memory(struct bv_stream *s, const uint8_t *buf, uint32_t size) {
+    s->mem = buf;
+    s->mem_size = size;
+    s->verified = false;
+
+    // the whole stream is resident, no read-in will ever be needed
+    s->buf_head = size;
+
+    s->cache.head = 0;
+    mem_refill(s, &s->cache, 0);
+}
+
+/* bvdec blit kernels */
+
+// 4 pixel tile row (bit 0 = leftmost) -> 4 bytes of 0x00 / 0xff, little-endian
+static const uint32_t row_lut_8bpp[16] = {
+    0x00000000, 0x000000ff, 0x0000ff00, 0x0000ffff, 0x00ff0000, 0x00ff00ff, 0x00ffff00, 0x00ffffff,
+    0xff000000, 0xff0000ff, 0xff00ff00, 0xff00ffff, 0xffff0000, 0xffff00ff, 0xffffff00, 0xffffffff,
+};
+
+// 4 pixel tile row -> 2 bytes of 0x0 / 0xf nibbles, low nibble first
+static const uint16_t row_lut_4bpp[16] = {
+    0x0000, 0x000f, 0x00f0, 0x00ff, 0x0f00, 0x0f0f, 0x0ff0, 0x0fff,
+    0xf000, 0xf00f, 0xf0f0, 0xf0ff, 0xff00, 0xff0f, 0xfff0, 0xffff,
+};
+
+static uint32_t expand_row(uint8_t format, uint32_t row_bits) {
+    switch (format) {
+    case BV_FB_8BPP:
+        return row_lut_8bpp[row_bits & 15];
+    case BV_FB_4BPP:
+        return row_lut_4bpp[row_bits & 15];
+    default:
+        return row_bits & 15;
+    }
+}
+
+static void expand_tile(uint8_t format, uint16_t tile_bits, uint32_t rows[4]) {
+    for (uint32_t row = 0; row < 4; row++)
+        rows[row] = expand_row(format, tile_bits >> (row * 4));
+}
+
+// Rebuild tile_rows for the current tileset and fb format.
+static void expand_tileset(struct bv_stream *s) {
+    for (uint32_t i = 0; i < BV_TILESET_SIZE; i++)
+        expand_tile(s->fb_format, s->tileset[i], s->tile_rows[i]);
+
+    expand_tile(s->fb_format, 0x0000, s->tile_rows[BV_TILE_BLACK]);
+    expand_tile(s->fb_format, 0xffff, s->tile_rows[BV_TILE_WHITE]);
+}
+
+// Kernels write one 4x4 tile of expanded rows, fb points at its top-left pixel's byte.
+
+static void blit_8bpp(uint8_t *fb, uint32_t stride, const uint32_t rows[4]) {
+    for (uint32_t row = 0; row < 4; row++)
+        memcpy(&fb[row * stride], &rows[row], 4);
+}
+
+static void blit_4bpp(uint8_t *fb, uint32_t stride, const uint32_t rows[4]) {
+    for (uint32_t row = 0; row < 4; row++) {
+        const uint16_t px = rows[row];
+        memcpy(&fb[row * stride], &px, 2);
+    }
+}
+
+static void blit_1bpp(uint8_t *fb, uint32_t stride, uint32_t col_shift, const uint32_t rows[4]) {
+    if (col_shift <= 4) {
+        // each tile row fits in a byte (always the case without an origin, tiles are 4px aligned)
+        const uint8_t keep_mask = ~(15 << col_shift);
+
+        for (uint32_t row = 0; row < 4; row++)
+            fb[row * stride] = (fb[row * stride] & keep_mask) | (rows[row] << col_shift);
+    } else {
+        // tile rows straddle two bytes
+        const uint16_t keep_mask = ~(15 << col_shift);
+
+        for (uint32_t row = 0; row < 4; row++) {
+            uint8_t *dst = &fb[row * stride];
+            const uint16_t px = ((dst[0] | dst[1] << 8) & keep_mask) | (rows[row] << col_shift);
+
+            dst[0] = px;
+            dst[1] = px >> 8;
+        }
+    }
+}
+
+static inline uint32_t fb_bpp(struct bv_stream *s) {
+    return s->fb_format == BV_FB_8BPP ? 8 : s->fb_format == BV_FB_4BPP ? 4 : 1;
+}
+
+// Read / write the "width" (up to 32) bit field at bit "pos" of a packed row, bytes outside of it are untouched.
+static inline uint32_t get_row_bits(const uint8_t *row, uint32_t pos, uint32_t width) {
+    const uint32_t bytes = (pos % 8 + width + 7) / 8;
+
+    uint64_t word = 0;
+    memcpy(&word, &row[pos / 8], bytes);
+
+    return (word >> (pos % 8)) & ((1ull << width) - 1);
+}
+
+static inline void put_row_bits(uint8_t *row, uint32_t pos, uint32_t width, uint32_t bits) {
+    const uint32_t bytes = (pos % 8 + width + 7) / 8;
+    const uint64_t mask = ((1ull << width) - 1) << (pos % 8);
+
+    uint64_t word = 0;
+    memcpy(&word, &row[pos / 8], bytes);
+
+    word = (word & ~mask) | (((uint64_t)bits << (pos % 8)) & mask);
+    memcpy(&row[pos / 8], &word, bytes);
+}
+
+// Write a tile which isn't byte aligned in the fb or wraps around its edges, px, py are fb coordinates.
+static void blit_tile_wrapped(struct bv_stream *s, uint8_t *fb, uint32_t px, uint32_t py, const uint32_t rows[4]) {
+    const uint32_t bpp = fb_bpp(s);
+
+    // pixels before the right edge, the rest wraps around to the row's start
+    const uint32_t split = MIN(s->extent[0] - px, 4);
+
+    for (uint32_t row = 0; row < 4; row++) {
+        const uint32_t y = py + row < s->extent[1] ? py + row : py + row - s->extent[1];
+        uint8_t *dst = &fb[y * s->fb_stride];
+
+        put_row_bits(dst, px * bpp, split * bpp, rows[row]);
+        if (split < 4)
+            put_row_bits(dst, 0, (4 - split) * bpp, rows[row] >> (split * bpp));
+    }
+}
+
+// Write one 4x4 tile of expanded rows with its top-left pixel at px, py of the fb.
+static inline void blit_tile(struct bv_stream *s, uint8_t *fb, uint32_t px, uint32_t py, const uint32_t rows[4]) {
+    const uint32_t stride = s->fb_stride;
+    uint8_t *dst = &fb[py * stride];
+
+    // 4bpp tiles at odd columns would take 3 bytes per row
+    if (px + 4 > s->extent[0] || py + 4 > s->extent[1] || (s->fb_format == BV_FB_4BPP && px % 2)) {
+        blit_tile_wrapped(s, fb, px, py, rows);
+        return;
+    }
+
+    switch (s->fb_format) {
+    case BV_FB_8BPP:
+        assert((py + 3) * stride + px + 4 <= s->fb_size);
+        blit_8bpp(dst + px, stride, rows);
+        break;
+
+    case BV_FB_4BPP:
+        assert((py + 3) * stride + px / 2 + 2 <= s->fb_size);
+        blit_4bpp(dst + px / 2, stride, rows);
+        break;
+
+    case BV_FB_1BPP:
+        assert((py + 3) * stride + (px + 3) / 8 < s->fb_size);
+        blit_1bpp(dst + px / 8, stride, px % 8, rows);
+        break;
+    }
+}
+
+// Map x, y of the frame to the fb through its origin, x, y must be inside the frame.
+static inline void frame_to_fb(struct bv_stream *s, const uint16_t origin[2], uint32_t *x, uint32_t *y) {
+    *x += origin[0];
+    *y += origin[1];
+
+    if (*x >= s->extent[0])
+        *x -= s->extent[0];
+    if (*y >= s->extent[1])
+        *y -= s->extent[1];
+}
+
 /* bvdec config */
 
+static void update_fb_layout(struct bv_stream *s) {
+    switch (s->fb_format) {
+    case BV_FB_8BPP:
+        s->fb_stride = s->extent[0];
+        break;
+    case BV_FB_4BPP:
+        s->fb_stride = (s->extent[0] + 1) / 2;
+        break;
+    case BV_FB_1BPP:
+        s->fb_stride = (s->extent[0] + 7) / 8;
+        break;
+    }
+
+    s->fb_size = s->fb_stride * s->extent[1];
+}
+
 int32_t bv_stream_configure(struct bv_stream *s) {
     struct bv_header header_buf;
-    int32_t res = read_in_bytes(s, &header_buf, 0, sizeof(struct bv_header));
+    int32_t res = read_in_bytes(s, (uint8_t *)&header_buf, 0, sizeof(struct bv_header));
     if (res < 0)
         return res;
 
-    s->bit_head += sizeof(struct bv_header) * 8;
+    if (memcmp(header_buf.magic, "BitV", 4) || header_buf.version > BV_VERSION)
+        return -2;
+    if (header_buf.extent[0] > BV_MAX_EXTENT || header_buf.extent[1] > BV_MAX_EXTENT)
+        return -2;
+    if (header_buf.version < 5 && (header_buf.extent[0] > BV_MOVE_MAX_EXTENT || header_buf.extent[1] > BV_MOVE_MAX_EXTENT))
+        return -2;
+    if ((header_buf.flags & BV_FLAG_CODED) && header_buf.version < 3)
+        return -2;
+
+    uint32_t head = sizeof(struct bv_header);
+
+    if (header_buf.flags & BV_FLAG_INDEX) {
+        uint32_t index_count;
+        res = read_in_bytes(s, (uint8_t *)&index_count, head, sizeof(uint32_t));
+        if (res < 0)
+            return res;
+
+        // the index is only looked at by bv_stream_seek, skip over it
+        s->index_head = head + sizeof(uint32_t);
+        s->index_count = index_count;
+
+        head = s->index_head + index_count * sizeof(struct bv_index_entry);
+    }
+
+    s->frames_head = head;
+    s->bit_head += head * 8;
+    s->version = header_buf.version;
+
+    s->coded = header_buf.flags & BV_FLAG_CODED;
+    s->coder_restart = true;
+    s->stream_ended = false;
 
     // config bv_stream from header
     memcpy(s->extent, header_buf.extent, sizeof(header_buf.extent));
     memcpy(s->tileset, header_buf.tileset, sizeof(header_buf.tileset));
+    memcpy(s->header_tileset, header_buf.tileset, sizeof(header_buf.tileset));
+    s->tileset_updated = false;
     s->framerate = header_buf.framerate;
 
-    s->fb_size = (uint32_t)header_buf.extent[0] * (uint32_t)header_buf.extent[1];
+    update_fb_layout(s);
+    expand_tileset(s);
 
     return 0;
 }
 
-void bv_stream_bind(struct bv_stream *s, uint8_t *fbs[1]) {
-    memcpy(s->fbs, fbs, sizeof(uint8_t *) * 1);
+void bv_stream_set_format(struct bv_stream *s, enum bv_fb_format format) {
+    s->fb_format = format;
+    update_fb_layout(s);
+    expand_tileset(s);
+}
+
+void bv_stream_pin_origin_x(struct bv_stream *s, bool pinned) {
+    s->origin_x_pinned = pinned;
+}
+
+void bv_stream_bind(struct bv_stream *s, uint8_t *fbs[2]) {
+    memcpy(s->fbs, fbs, sizeof(s->fbs));
+
+    s->front = 0;
+    s->swap_pending = false;
+
+    memset(s->fb_origins, 0, sizeof(s->fb_origins));
 }
 
 /* bvdec streaming decode */
 
-static int32_t draw_supertile(struct bv_stream *s, uint8_t* fb) {
-    uint32_t local_head = s->bit_head + 1;
+// Move bit_head past a fully decoded cmd, its bytes may be overwritten by a feeder from now on.
+static inline void consume_to(struct bv_stream *s, uint32_t head) {
+    __atomic_store_n(&s->bit_head, head, __ATOMIC_RELEASE);
+}
+
+// Is the next cmd completely buffered; a cmd is only started once it is, so a
+// short read never throws away a half drawn supertile.
+static inline bool cmd_resident(struct bv_stream *s) {
+    if (s->mem || __atomic_load_n(&s->input_ended, __ATOMIC_ACQUIRE))
+        return true;
+
+    const uint32_t cmd_max_bytes = s->coded ? BV_CODED_CMD_MAX_BYTES : BV_CMD_MAX_BYTES;
+    return __atomic_load_n(&s->buf_head, __ATOMIC_ACQUIRE) > s->bit_head / 8 + cmd_max_bytes;
+}
+
+// Is the 4x4 tile at x, y entirely inside the frame.
+static inline bool tile_in_frame(struct bv_stream *s, uint32_t x, uint32_t y) {
+    return x + 4 <= s->extent[0] && y + 4 <= s->extent[1];
+}
+
+// Step the cursor to the adjacent supertile a supertile cmd names.
+static inline void advance_cursor(uint16_t cursor[2], uint8_t adj_prefix) {
+    switch (adj_prefix) {
+    case 0:
+        cursor[0] += 1;
+        break;
+
+    case 2:
+        cursor[0] -= 1;
+        break;
+
+    case 1:
+        cursor[1] += 1;
+        break;
+
+    case 3:
+        cursor[1] -= 1;
+        break;
+    }
+}
+
+// Skip the cursor a zigzagged distance along the supertile raster order, it ends up outside the frame
+// (at supertile columns, rows) when the skip leaves it.
+static inline void skip_cursor(struct bv_stream *s, uint16_t cursor[2], uint32_t value) {
+    const int32_t st_w = (s->extent[0] + 15) / 16, st_h = (s->extent[1] + 15) / 16;
+
+    // moving up from the first row leaves the cursor a row above it
+    const int32_t skip = value & 1 ? (int32_t)(value / 2 + 1) : -(int32_t)(value / 2);
+    const int32_t st = (int16_t)cursor[1] * st_w + (int16_t)cursor[0] + skip;
+
+    if (st < 0 || st >= st_w * st_h) {
+        cursor[0] = st_w;
+        cursor[1] = st_h;
+        return;
+    }
+
+    cursor[0] = st % st_w;
+    cursor[1] = st / st_w;
+}
+
+// Move the cursor as the move cmd (a skip from version 5 on) at pos says; returns the cmd's size in
+// bits or -1 when it isn't resident.
+static inline int32_t read_move(struct bv_stream *s, struct bv_bit_cache *cache, uint32_t pos, uint16_t cursor[2]) {
+    uint32_t bits;
+
+    if (s->version < 5) {
+        if (read_bits_cached(s, cache, &bits, pos + 2, 10) < 0)
+            return -1;
+
+        cursor[0] = (bits >> 0) & 31;
+        cursor[1] = (bits >> 5) & 31;
+        return 12;
+    }
+
+    if (read_bits_cached(s, cache, &bits, pos + 2, BV_SKIP_PREFIX_MAX) < 0)
+        return -1;
+
+    // a prefix without its one bit is malformed, the skip lands outside the frame all the same
+    const uint32_t zeros = bits ? __builtin_ctz(bits) : BV_SKIP_PREFIX_MAX;
+    const uint32_t width = zeros + BV_SKIP_ORDER;
+
+    if (read_bits_cached(s, cache, &bits, pos + 3 + zeros, width) < 0)
+        return -1;
+
+    skip_cursor(s, cursor, ((1u << width) | bits) - (1u << BV_SKIP_ORDER));
+    return 3 + zeros + width;
+}
+
+// where the supertile at the cursor lands in the fb, its tiles are simply offset from there unless it wraps around
+struct st_place {
+    uint32_t base_tx, base_ty;
+    uint32_t fb_x, fb_y;
+    bool wraps;
+};
+
+static inline void st_place_init(struct bv_stream *s, const uint16_t cursor[2], const uint16_t origin[2], struct st_place *pl) {
+    pl->base_tx = cursor[0] * 16;
+    pl->base_ty = cursor[1] * 16;
+
+    pl->fb_x = pl->base_tx;
+    pl->fb_y = pl->base_ty;
+    pl->wraps = true;
+
+    if (pl->base_tx < s->extent[0] && pl->base_ty < s->extent[1]) {
+        frame_to_fb(s, origin, &pl->fb_x, &pl->fb_y);
+        pl->wraps = pl->fb_x + 16 > s->extent[0] || pl->fb_y + 16 > s->extent[1];
+    }
+}
+
+// checked drops tiles which would land outside the frame, only verified streams may skip that
+static inline __attribute__((always_inline)) void st_place_tile(struct bv_stream *s, uint8_t *fb, const uint16_t origin[2],
+                                                                const struct st_place *pl, uint32_t tx, uint32_t ty,
+                                                                const uint32_t rows[4], const bool checked) {
+    uint32_t x = pl->base_tx + tx * 4, y = pl->base_ty + ty * 4;
+    if (checked && !tile_in_frame(s, x, y))
+        return;
+
+    if (pl->wraps) {
+        frame_to_fb(s, origin, &x, &y);
+        blit_tile(s, fb, x, y, rows);
+    } else {
+        blit_tile(s, fb, pl->fb_x + tx * 4, pl->fb_y + ty * 4, rows);
+    }
+}
+
+// Mark the supertile at cursor as redrawn; returns 1 if it wasn't yet. Each supertile row has words
+// of its own, so slices (which never share rows) can mark theirs concurrently.
+static inline uint32_t mark_damage(struct bv_stream *s, const uint16_t cursor[2]) {
+    if (cursor[0] >= BV_MAX_EXTENT / 16 || cursor[1] >= BV_MAX_EXTENT / 16)
+        return 0;
+
+    uint32_t *word = &s->damage.bits[cursor[1] * BV_DAMAGE_STRIDE + cursor[0] / 32];
+    uint32_t bit = 1u << (cursor[0] % 32);
+
+    if (*word & bit)
+        return 0;
+
+    *word |= bit;
+    return 1;
+}
+
+// account a drawn supertile and move on to the next one
+static inline void finish_supertile(struct bv_stream *s, uint16_t cv_mask, uint8_t adj_prefix) {
+    s->supertile_count += 1;
+    s->tile_count += __builtin_popcount(cv_mask);
+    s->damage.count += mark_damage(s, s->cursor);
+
+    advance_cursor(s->cursor, adj_prefix);
+}
+
+// A run of supertile cmds being decoded, either the frame's own serial decode or one of its slices;
+// it's only drawn into rows [rows[0], rows[1]) (checked decodes drop anything else).
+struct st_run {
+    uint32_t head;
+    uint16_t *cursor;
+    struct bv_bit_cache *cache;
+    uint16_t rows[2];
+
+    uint32_t supertile_count;
+    uint32_t tile_count;
+    uint32_t damage_count;
+};
+
+static inline __attribute__((always_inline)) int32_t draw_supertile_impl(struct bv_stream *s, uint8_t* fb, const uint16_t origin[2],
+                                                                         struct st_run *r, const bool checked) {
+    uint32_t local_head = r->head + 1;
     
     uint32_t st_bits;
-    int32_t res = read_in_bits(s, &st_bits, local_head, 18);
+    int32_t res = read_bits_cached(s, r->cache, &st_bits, local_head, 18);
     if (res < 0)
         return res;
     local_head += 18;
@@ -129,203 +612,1407 @@ static int32_t draw_supertile(struct bv_stream *s, uint8_t* fb) {
     const uint8_t adj_prefix = st_bits & 3;
     const uint16_t cv_mask = st_bits >> 2;
 
-    const uint32_t base_tx = s->cursor[0] * 16, base_ty = s->cursor[1] * 16;
+    // outside the run's rows the cmd is still read, just not drawn
+    const bool drawn = !checked || (r->cursor[1] >= r->rows[0] && r->cursor[1] < r->rows[1]);
+
+    struct st_place pl;
+    st_place_init(s, r->cursor, origin, &pl);
 
     for (uint32_t ty = 0; ty < 4; ty++) {
         for (uint32_t tx = 0; tx < 4; tx++) {
             if (!((cv_mask >> (tx + ty * 4)) & 1)) continue;
             
             uint32_t cmd_bits;
-            res = read_in_bits(s, &cmd_bits, local_head, 2);
+            res = read_bits_cached(s, r->cache, &cmd_bits, local_head, 2);
             if (res < 0)
-            return res;
-            
+                return res;
+
+            const uint32_t *rows;
+            uint32_t inline_rows[4];
+
             if (cmd_bits & 1) {
                 // uniform tile
                 bool polarity = cmd_bits & 2;
-
-                /* uint32_t x = base_tx + tx * (4 / 2);
-                uint32_t y = base_ty + ty * (4 / 2);
-                uint32_t index = x + y * row_step;
-                uint32_t col_shift = (tx % 2) * 4;
-                uint8_t wr_mask = 15 << 4;
-                uint8_t data = 15 * polarity;
-
-                for (uint32_t row = 0; row < 4; row++) {
-                    fb[index] &= wr_mask >> col_shift;
-                    fb[index] |= data << col_shift;
-                    index += row_step;
-                } */
-
-                for (uint32_t y = 0; y < 4; y++) {
-                    for (uint32_t x = 0; x < 4; x++) {
-                        uint32_t index = (base_tx + tx * 4 + x) + (base_ty + ty * 4 + y) * s->extent[0];
-                        assert(index < s->extent[0] * s->extent[1]);
-                        fb[index] = polarity ? 0xff : 0x00;
-                    }
-                }
+                rows = s->tile_rows[polarity ? BV_TILE_WHITE : BV_TILE_BLACK];
 
                 local_head += 2;
             } else if (cmd_bits & 2) {
                 // indexed tile
                 uint32_t index_bits;
-                res = read_in_bits(s, &index_bits, local_head + 2, 8);
+                res = read_bits_cached(s, r->cache, &index_bits, local_head + 2, 8);
                 if (res < 0)
                     return res;
 
-                uint16_t tile_bits = s->tileset[index_bits & 255];
-                
-                /* uint32_t x = base_tx + tx * (4 / 2);
-                uint32_t y = base_ty + ty * (4 / 2);
-                uint32_t index = x + y * row_step;
-                uint32_t col_shift = (tx % 2) * 4;
-                uint8_t wr_mask = 15 << 4;
-
-                for (uint32_t row = 0; row < 4; row++) {
-                    fb[index] &= wr_mask >> col_shift;
-                    fb[index] |= ((tile_bits >> (row * 4)) & 4) << col_shift;
-                    index += row_step;
-                } */
-
-                for (uint32_t y = 0; y < 4; y++) {
-                    for (uint32_t x = 0; x < 4; x++) {
-                        uint32_t index = (base_tx + tx * 4 + x) + (base_ty + ty * 4 + y) * s->extent[0];
-                        assert(index < s->extent[0] * s->extent[1]);
-                        fb[index] = (tile_bits >> (x + y * 4)) & 1 ? 0xff : 0x00;
-                    }
-                }
+                rows = s->tile_rows[index_bits & 255];
 
                 local_head += 10;
             } else {
                 // inline tile
                 uint32_t tile_bits;
-                res = read_in_bits(s, &tile_bits, local_head + 2, 16);
+                res = read_bits_cached(s, r->cache, &tile_bits, local_head + 2, 16);
                 if (res < 0)
                     return res;
 
-                /* uint32_t x = base_tx + tx * (4 / 2);
-                uint32_t y = base_ty + ty * (4 / 2);
-                uint32_t index = x + y * row_step;
-                uint32_t col_shift = (tx % 2) * 4;
-                uint8_t wr_mask = 15 << 4;
-
-                for (uint32_t row = 0; row < 4; row++) {
-                    fb[index] &= wr_mask >> col_shift;
-                    fb[index] |= ((tile_bits >> (row * 4)) & 4) << col_shift;
-                    index += row_step;
-                } */
-
-                for (uint32_t y = 0; y < 4; y++) {
-                    for (uint32_t x = 0; x < 4; x++) {
-                        uint32_t index = (base_tx + tx * 4 + x) + (base_ty + ty * 4 + y) * s->extent[0];
-                        assert(index < s->extent[0] * s->extent[1]);
-                        fb[index] = (tile_bits >> (x + y * 4)) & 1 ? 0xff : 0x00;
-                    }
-                }
-                
+                expand_tile(s->fb_format, tile_bits, inline_rows);
+                rows = inline_rows;
+
                 local_head += 18;
             }
+
+            if (drawn)
+                st_place_tile(s, fb, origin, &pl, tx, ty, rows, checked);
         }
     }
 
     // successfully drawn supertile, can't fail now on
-    s->bit_head = local_head;
+    r->head = local_head;
+    r->supertile_count += 1;
+    r->tile_count += __builtin_popcount(cv_mask);
 
-    switch (adj_prefix) {
-    case 0:
-        s->cursor[0] += 1;
-        break;
+    if (drawn)
+        r->damage_count += mark_damage(s, r->cursor);
 
-    case 2:
-        s->cursor[0] -= 1;
-        break;
+    advance_cursor(r->cursor, adj_prefix);
+    return 0;
+}
 
-    case 1:
-        s->cursor[1] += 1;
-        break;
+static int32_t draw_supertile(struct bv_stream *s, uint8_t* fb, const uint16_t origin[2]) {
+    // decoding slices serially, they keep to their rows all the same
+    const bool in_slice = s->slice_next < s->slice_count;
 
-    case 3:
-        s->cursor[1] -= 1;
-        break;
-    }
+    struct st_run r = {
+        .head = s->bit_head,
+        .cursor = s->cursor,
+        .cache = &s->cache,
+        .rows = {in_slice ? s->slices[s->slice_next].rows[0] : 0, in_slice ? s->slices[s->slice_next].rows[1] : BV_MAX_EXTENT / 16},
+    };
+
+    const int32_t res = s->verified ? draw_supertile_impl(s, fb, origin, &r, false) : draw_supertile_impl(s, fb, origin, &r, true);
+    if (res < 0)
+        return res;
+
+    consume_to(s, r.head);
+
+    s->supertile_count += r.supertile_count;
+    s->tile_count += r.tile_count;
+    s->damage.count += r.damage_count;
 
     return 0;
 }
 
-static void shift_fb(struct bv_stream *s, uint8_t* fb, int8_t x, int8_t y) {
-    // offset x
-    
-    if (x > 0) {
-        for (uint32_t row = 0; row < s->extent[1]; row++)
-            memmove(&fb[row * s->extent[0] + x], &fb[row * s->extent[0]], s->extent[0] - x);
-    } else if (x < 0) {
-        for (uint32_t row = 0; row < s->extent[1]; row++)
-            memmove(&fb[row * s->extent[0]], &fb[row * s->extent[0] - x], s->extent[0] + x);
+// Shift the frame's columns by x in place, for a pinned origin[0] (see bv_stream_pin_origin_x); the
+// columns shifted in keep their previous pixels. Rows are moved up to 32 bits at a time, from the end
+// they move towards so nothing is read after it was written.
+static void shift_columns(struct bv_stream *s, uint8_t *fb, int8_t x) {
+    const uint32_t w = s->extent[0], h = s->extent[1];
+    const uint32_t stride = s->fb_stride, bpp = fb_bpp(s);
+
+    const uint32_t offset = abs(x) * bpp;
+    const uint32_t bits = (w - abs(x)) * bpp;
+
+    for (uint32_t row = 0; row < h; row++) {
+        uint8_t *fb_row = &fb[row * stride];
+
+        if (bpp == 8) {
+            if (x > 0)
+                memmove(&fb_row[x], fb_row, w - x);
+            else
+                memmove(fb_row, &fb_row[-x], w + x);
+        } else if (x > 0) {
+            for (uint32_t end = bits; end;) {
+                const uint32_t width = MIN(end, 32);
+                end -= width;
+
+                put_row_bits(fb_row, end + offset, width, get_row_bits(fb_row, end, width));
+            }
+        } else {
+            for (uint32_t pos = 0; pos < bits; pos += 32) {
+                const uint32_t width = MIN(bits - pos, 32);
+                put_row_bits(fb_row, pos, width, get_row_bits(fb_row, pos + offset, width));
+            }
+        }
     }
+}
 
-    // offset y
-    
-    if (y > 0) {
-        memmove(&fb[y * s->extent[0]], &fb[0], s->extent[0] * (s->extent[1] - y));
-    } else if (y < 0) {
-        memmove(&fb[0], &fb[-y * s->extent[0]], s->extent[0] * (s->extent[1] + y));
+// Shift the frame by x, y by moving the fb's origin; the rows and columns shifted in keep their
+// previous pixels, which is only a strip to copy as the rest of the frame stays where it is.
+static void shift_fb(struct bv_stream *s, uint8_t* fb, uint16_t origin[2], int8_t x, int8_t y) {
+    const uint32_t w = s->extent[0], h = s->extent[1];
+    const uint32_t stride = s->fb_stride, bpp = fb_bpp(s);
+
+    // a shift past the frame's edge is malformed (bv_stream_verify rejects it), keep the fb in bounds
+    if (abs(x) >= w)
+        x = 0;
+    if (abs(y) >= h)
+        y = 0;
+
+    // offset x, frame column c now is the old column c - x; the shifted in columns [0, x) (or [w + x, w))
+    // take the old pixels back from c + x, in an order which never reads a column it already wrote
+
+    if (x && s->origin_x_pinned) {
+        shift_columns(s, fb, x);
+    } else if (x) {
+        origin[0] = (origin[0] + w - x) % w;
+
+        const uint32_t count = abs(x);
+        const uint32_t first = x > 0 ? (uint32_t)x - 1 : w + x;
+
+        // fb columns of the first shifted in column and of its source, they step by one (wrapping) from there
+        const uint32_t dst_x = (first + origin[0]) % w, src_x = (first + x + origin[0] + w) % w;
+
+        // strips which don't wrap around are copied in one go, the strip and its source only overlap
+        // for shifts over half the width
+        const int32_t dst_lo = x > 0 ? (int32_t)dst_x + 1 - x : (int32_t)dst_x;
+        const int32_t src_lo = x > 0 ? (int32_t)src_x + 1 - x : (int32_t)src_x;
+        const bool contiguous = count * 2 <= w && dst_lo >= 0 && src_lo >= 0 && dst_lo + count <= w && src_lo + count <= w;
+
+        for (uint32_t row = 0; row < h; row++) {
+            uint8_t *fb_row = &fb[row * stride];
+            uint32_t dst = dst_x, src = src_x;
+
+            if (contiguous && bpp == 8) {
+                memcpy(&fb_row[dst_lo], &fb_row[src_lo], count);
+                continue;
+            } else if (contiguous) {
+                for (uint32_t bit = 0; bit < count * bpp; bit += 32) {
+                    const uint32_t width = MIN(count * bpp - bit, 32);
+                    put_row_bits(fb_row, dst_lo * bpp + bit, width, get_row_bits(fb_row, src_lo * bpp + bit, width));
+                }
+
+                continue;
+            }
+
+            for (uint32_t i = 0; i < count; i++) {
+                if (bpp == 8)
+                    fb_row[dst] = fb_row[src];
+                else
+                    put_row_bits(fb_row, dst * bpp, bpp, get_row_bits(fb_row, src * bpp, bpp));
+
+                if (x > 0) {
+                    dst = dst ? dst - 1 : w - 1;
+                    src = src ? src - 1 : w - 1;
+                } else {
+                    dst = dst + 1 < w ? dst + 1 : 0;
+                    src = src + 1 < w ? src + 1 : 0;
+                }
+            }
+        }
+    }
+
+    // offset y, same again with whole rows
+
+    if (y) {
+        origin[1] = (origin[1] + h - y) % h;
+
+        for (uint32_t i = 0; i < (uint32_t)abs(y); i++) {
+            const uint32_t r = y > 0 ? y - 1 - i : h + y + i;
+            const uint32_t dst = (r + origin[1]) % h, src = (r + y + origin[1] + h) % h;
+
+            memcpy(&fb[dst * stride], &fb[src * stride], stride);
+        }
     }
 }
 
-int32_t bv_stream_decframe(struct bv_stream *s) {
-    uint8_t* fb = s->fbs[0];
-    assert(fb);
-    
-    // memcpy(fb, prev_fb, s->fb_size);
+// Copy the supertiles damaged by the previous frame over from the front fb, both fbs have the same origin.
+static void copy_damage(struct bv_stream *s, uint8_t *fb, const uint8_t *front_fb, const uint16_t origin[2]) {
+    const uint32_t bpp = fb_bpp(s);
+    const uint32_t st_extent[2] = {(s->extent[0] + 15) / 16, (s->extent[1] + 15) / 16};
 
-    int32_t res;
-    while (true) {
-        uint32_t cmd_bits;
-        res = read_in_bits(s, &cmd_bits, s->bit_head, 2);
-        if (res < 0)
-            return res;
+    for (uint32_t st_y = 0; st_y < st_extent[1]; st_y++) {
+        const uint32_t *row_bits = &s->damage.bits[st_y * BV_DAMAGE_STRIDE];
 
-        if (cmd_bits & 1) {
-            // supertile cmd
-            res = draw_supertile(s, fb);
-            if (res < 0)
-                return res;
+        // copy whole runs of damaged supertiles at once
+        for (uint32_t st_x = 0; st_x < st_extent[0];) {
+            if (!((row_bits[st_x / 32] >> (st_x % 32)) & 1)) {
+                st_x++;
+                continue;
+            }
 
-        } else if (cmd_bits & 2) {
-            // move cmd
-            uint32_t move_bits;
-            res = read_in_bits(s, &move_bits, s->bit_head + 2, 10);
-            if (res < 0)
-                return res;
+            uint32_t run_end = st_x + 1;
+            while (run_end < st_extent[0] && ((row_bits[run_end / 32] >> (run_end % 32)) & 1))
+                run_end++;
+
+            // the run in fb columns, split where it wraps around; the bytes holding its ends are copied whole,
+            // the pixels they share with the run's neighbours are the same in both fbs anyway
+            const uint32_t run_lo = st_x * 16 + origin[0], run_hi = MIN(run_end * 16, s->extent[0]) + origin[0];
+            const uint32_t spans[2][2] = {
+                {MIN(run_lo, s->extent[0]), MIN(run_hi, s->extent[0])},
+                {MAX(run_lo, s->extent[0]) - s->extent[0], MAX(run_hi, s->extent[0]) - s->extent[0]},
+            };
+
+            uint32_t bytes[2][2];
+            for (uint32_t i = 0; i < 2; i++) {
+                bytes[i][0] = spans[i][0] * bpp / 8;
+                bytes[i][1] = spans[i][0] == spans[i][1] ? bytes[i][0] : (spans[i][1] * bpp + 7) / 8;
+            }
 
-            s->cursor[0] = (move_bits >> 0) & 31;
-            s->cursor[1] = (move_bits >> 5) & 31;
+            const uint32_t rows = MIN(16, s->extent[1] - st_y * 16);
+            uint32_t fb_y = (st_y * 16 + origin[1]) % s->extent[1];
 
-            s->bit_head += 12;
+            for (uint32_t row = 0; row < rows; row++) {
+                const uint32_t head = fb_y * s->fb_stride;
 
-        } else {
-            // flip cmd
-            uint32_t flip_bits;
-            res = read_in_bits(s, &flip_bits, s->bit_head + 2, 16);
+                memcpy(&fb[head + bytes[0][0]], &front_fb[head + bytes[0][0]], bytes[0][1] - bytes[0][0]);
+                if (bytes[1][1] > bytes[1][0])
+                    memcpy(&fb[head + bytes[1][0]], &front_fb[head + bytes[1][0]], bytes[1][1] - bytes[1][0]);
 
-            int8_t x_shift = ((int8_t *)&flip_bits)[0];
-            int8_t y_shift = ((int8_t *)&flip_bits)[1];
-            shift_fb(s, fb, x_shift, y_shift);
+                fb_y = fb_y + 1 < s->extent[1] ? fb_y + 1 : 0;
+            }
 
-            s->bit_head += 18;
-            break;
+            st_x = run_end;
         }
     }
+}
 
-    memset(s->cursor, 0, sizeof(s->cursor));
-    s->frame_index += 1;
+// Get the back fb ready for the next frame's diffs: bring it up to date with the
+// previous frame and apply the previous flip's shift.
+static void open_frame(struct bv_stream *s, uint8_t *fb, uint16_t origin[2]) {
+    const uint32_t st_count = ((s->extent[0] + 15) / 16) * ((s->extent[1] + 15) / 16);
+
+    if (s->fbs[1]) {
+        // double-buffered, the back fb is still a frame behind
+        const uint8_t *front_fb = s->fbs[s->front];
+
+        if (s->fb_reset || s->back_synced) {
+            ; // overwritten or already up to date
+        } else if (s->back_resync || s->damage.count * 2 > st_count) {
+            // most of the frame changed, a straight copy is cheaper than following the damage
+            memcpy(fb, front_fb, s->fb_size);
+            memcpy(origin, s->fb_origins[s->front], sizeof(s->fb_origins[0]));
+        } else {
+            // redo the previous frame's shift, then its redrawn supertiles
+            if (s->damage.shift[0] || s->damage.shift[1])
+                shift_fb(s, fb, origin, s->damage.shift[0], s->damage.shift[1]);
 
-    return 0;
-}
+            copy_damage(s, fb, front_fb, origin);
+        }
+    }
 
-uint8_t *bv_stream_active_fb(struct bv_stream *s) {
-    uint8_t *fb = s->fbs[0]; // s->fbs[(s->frame_index - 1u) % 2];
-    assert(fb);
+    memset(&s->damage, 0, sizeof(s->damage));
+
+    if (s->fb_reset) {
+        // keyframe, diffs start over from a blank frame
+        memset(fb, 0, s->fb_size);
+        memset(origin, 0, sizeof(s->fb_origins[0]));
+        s->damage.full = true;
+    }
+
+    // a blank or fast-forwarded (after a seek) fb is ahead of the front fb by more than this frame's damage
+    s->back_resync = s->fb_reset || s->back_synced;
+    s->damage.full |= s->back_synced;
+
+    s->fb_reset = false;
+    s->back_synced = false;
+
+    if (s->flip_shift[0] || s->flip_shift[1]) {
+        shift_fb(s, fb, origin, s->flip_shift[0], s->flip_shift[1]);
+
+        memcpy(s->damage.shift, s->flip_shift, sizeof(s->damage.shift));
+        s->damage.full = true;
+    }
+
+    s->frame_open = true;
+}
+
+static void set_tileset_entry(struct bv_stream *s, uint8_t slot, uint16_t tile) {
+    s->tileset[slot] = tile;
+    expand_tile(s->fb_format, tile, s->tile_rows[slot]);
+
+    s->tileset_updated = true;
+}
+
+// Keyframes (and seeks) start over from the header's tileset.
+static void reset_tileset(struct bv_stream *s) {
+    if (!s->tileset_updated)
+        return;
+
+    memcpy(s->tileset, s->header_tileset, sizeof(s->tileset));
+    expand_tileset(s);
+
+    s->tileset_updated = false;
+}
+
+// Apply a tileset update cmd, bit_head is past its escape; the whole cmd is resident (cmd_resident).
+static int32_t update_tileset(struct bv_stream *s) {
+    uint32_t local_head = s->bit_head;
+
+    uint32_t count_bits;
+    int32_t res = read_in_bits(s, &count_bits, local_head, 4);
+    if (res < 0)
+        return res;
+    local_head += 4;
+
+    for (uint32_t i = 0; i <= count_bits; i++) {
+        uint32_t entry_bits;
+        res = read_in_bits(s, &entry_bits, local_head, 24);
+        if (res < 0)
+            return res;
+        local_head += 24;
+
+        set_tileset_entry(s, entry_bits & 255, entry_bits >> 8);
+    }
+
+    consume_to(s, local_head);
+    return 0;
+}
+
+// a keyframe cmd ended the frame, the next one is drawn over a blank fb and the header's tileset
+static void keyframe_next(struct bv_stream *s) {
+    s->flip_shift[0] = 0;
+    s->flip_shift[1] = 0;
+    s->fb_reset = true;
+
+    reset_tileset(s);
+}
+
+/* bvdec slices */
+
+// slice table entries (first row, size) got wider with version 5
+static uint32_t slice_row_bits(struct bv_stream *s) {
+    return s->version < 5 ? BV_SLICE_ROW_BITS : BV_SLICE_WIDE_ROW_BITS;
+}
+
+static uint32_t slice_size_bits(struct bv_stream *s) {
+    return s->version < 5 ? BV_SLICE_SIZE_BITS : BV_SLICE_WIDE_SIZE_BITS;
+}
+
+static uint32_t slice_entry_bits(struct bv_stream *s) {
+    return slice_row_bits(s) + slice_size_bits(s);
+}
+
+// the first row and size of the slice table entry at pos
+static int32_t read_slice_entry(struct bv_stream *s, uint32_t pos, uint32_t *row, uint32_t *size) {
+    int32_t res = read_in_bits(s, row, pos, slice_row_bits(s));
+    if (res < 0)
+        return res;
+
+    return read_in_bits(s, size, pos + slice_row_bits(s), slice_size_bits(s));
+}
+
+// Read the slice table after a slices cmd (resident along with it), a serial decode goes on into slice 0;
+// returns: 0 - success, -1 - truncated stream
+static int32_t read_slice_table(struct bv_stream *s) {
+    uint32_t local_head = s->bit_head;
+
+    uint32_t count_bits;
+    int32_t res = read_in_bits(s, &count_bits, local_head, 4);
+    if (res < 0)
+        return res;
+    local_head += 4;
+
+    const uint32_t count = (count_bits & 15) + 1;
+    uint32_t slice_head = local_head + count * slice_entry_bits(s);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t row, size;
+        res = read_slice_entry(s, local_head, &row, &size);
+        if (res < 0)
+            return res;
+        local_head += slice_entry_bits(s);
+
+        struct bv_slice *sl = &s->slices[i];
+
+        sl->bit_head = slice_head;
+        sl->bit_end = slice_head + size;
+        sl->rows[0] = row;
+        slice_head = sl->bit_end;
+
+        // a slice ends where the next one starts (rows out of order leave it none)
+        if (i)
+            s->slices[i - 1].rows[1] = sl->rows[0];
+    }
+
+    s->slices[count - 1].rows[1] = BV_MAX_EXTENT / 16;
+
+    s->slice_count = count;
+    s->slice_next = 0;
+    s->slices_claimed = false;
+
+    consume_to(s, local_head);
+
+    s->cursor[0] = 0;
+    s->cursor[1] = s->slices[0].rows[0];
+
+    return 0;
+}
+
+// A serial decode reached the end of its slice, go on with the next one (if any). Slices decoded with
+// bv_stream_decslice are skipped over as a whole instead, their counts are added to the frame's.
+static void next_slice(struct bv_stream *s) {
+    if (s->slices_claimed) {
+        for (uint32_t i = 0; i < s->slice_count; i++) {
+            s->supertile_count += s->slices[i].supertile_count;
+            s->tile_count += s->slices[i].tile_count;
+            s->damage.count += s->slices[i].damage_count;
+        }
+
+        consume_to(s, s->slices[s->slice_count - 1].bit_end);
+
+        s->slice_next = s->slice_count;
+        s->slices_claimed = false;
+        return;
+    }
+
+    s->slice_next += 1;
+
+    if (s->slice_next < s->slice_count) {
+        s->cursor[0] = 0;
+        s->cursor[1] = s->slices[s->slice_next].rows[0];
+    }
+}
+
+/* bvdec coded streams */
+
+// input byte pos of a coded stream, anything past the input reads as zero
+static inline uint8_t coder_byte(struct bv_stream *s, uint32_t pos) {
+    if (s->mem)
+        return pos < s->mem_size ? s->mem[pos] : 0;
+
+    // cmd_resident made sure the whole cmd is in, unless the input ended
+    if (pos >= __atomic_load_n(&s->buf_head, __ATOMIC_ACQUIRE))
+        return 0;
+
+    return s->read_buf[pos % BV_READ_BUF_SIZE];
+}
+
+static void coder_start(struct bv_stream *s, struct bv_coder *c, uint32_t pos) {
+    c->range = 0xffffffff;
+    c->code = 0;
+
+    // the first byte is always zero, the code is the 4 after it
+    for (uint32_t i = 0; i < 5; i++)
+        c->code = (c->code << 8) | coder_byte(s, pos + i);
+
+    c->in_pos = pos + 5;
+    c->prev_cmd = 0;
+    c->prev_op = BV_OP_BLACK;
+
+    for (uint32_t i = 0; i < BV_CTX_COUNT; i++)
+        c->probs[i] = 1 << (BV_PROB_BITS - 1);
+}
+
+// probabilities stay within [31, 2017], a decision never takes the range down by more than a byte
+static inline void coder_normalize(struct bv_stream *s, struct bv_coder *c) {
+    if (c->range < (1u << 24)) {
+        c->range <<= 8;
+        c->code = (c->code << 8) | coder_byte(s, c->in_pos++);
+    }
+}
+
+static inline uint32_t coder_bit(struct bv_stream *s, struct bv_coder *c, uint16_t *prob) {
+    const uint32_t bound = (c->range >> BV_PROB_BITS) * *prob;
+    uint32_t bit;
+
+    if (c->code < bound) {
+        c->range = bound;
+        *prob += ((1 << BV_PROB_BITS) - *prob) >> BV_PROB_MOVE;
+        bit = 0;
+    } else {
+        c->range -= bound;
+        c->code -= bound;
+        *prob -= *prob >> BV_PROB_MOVE;
+        bit = 1;
+    }
+
+    coder_normalize(s, c);
+    return bit;
+}
+
+// width plain bits, msb first
+static uint32_t coder_direct(struct bv_stream *s, struct bv_coder *c, uint32_t width) {
+    uint32_t value = 0;
+
+    for (uint32_t i = 0; i < width; i++) {
+        c->range >>= 1;
+
+        const uint32_t bit = c->code >= c->range;
+        if (bit)
+            c->code -= c->range;
+
+        value = (value << 1) | bit;
+        coder_normalize(s, c);
+    }
+
+    return value;
+}
+
+// a width bit tree, msb first, probs is indexed by the bits so far (from 1)
+static inline uint32_t coder_tree(struct bv_stream *s, struct bv_coder *c, uint16_t *probs, uint32_t width) {
+    uint32_t node = 1;
+
+    for (uint32_t i = 0; i < width; i++)
+        node = (node << 1) | coder_bit(s, c, &probs[node]);
+
+    return node - (1 << width);
+}
+
+// a coded cmd, read in full before it's carried out (or only checked by bv_stream_verify)
+struct coded_cmd {
+    uint8_t kind; // 0 - supertile, 1 - move, 2 - flip
+    uint8_t adj_prefix;
+    uint16_t cv_mask;
+
+    // per covered tile (by position) its tile cache slot, or the tile bits when inline
+    uint16_t inline_mask;
+    uint16_t tiles[16];
+
+    // move cursor or flip bytes, or the zigzagged skip
+    uint8_t fields[2];
+    uint32_t skip;
+
+    // tileset update entries
+    uint32_t entry_count;
+    uint8_t entry_slots[BV_TILESET_UPDATE_MAX];
+    uint16_t entry_tiles[BV_TILESET_UPDATE_MAX];
+};
+
+static void coded_move(struct bv_stream *s, uint16_t cursor[2], const struct coded_cmd *cmd) {
+    if (s->version < 5) {
+        cursor[0] = cmd->fields[0];
+        cursor[1] = cmd->fields[1];
+    } else {
+        skip_cursor(s, cursor, cmd->skip);
+    }
+}
+
+static void coded_read_supertile(struct bv_stream *s, struct bv_coder *c, struct coded_cmd *cmd) {
+    cmd->adj_prefix = coder_tree(s, c, &c->probs[BV_CTX_ADJ], 2);
+
+    uint16_t mask = 0;
+    for (uint32_t t = 0; t < 16; t++) {
+        const uint32_t left = t % 4 ? (mask >> (t - 1)) & 1 : 1;
+        const uint32_t above = t >= 4 ? (mask >> (t - 4)) & 1 : 1;
+
+        mask |= coder_bit(s, c, &c->probs[BV_CTX_MASK + t * 4 + left * 2 + above]) << t;
+    }
+
+    cmd->cv_mask = mask;
+    cmd->inline_mask = 0;
+
+    for (uint32_t t = 0; t < 16; t++) {
+        if (!((mask >> t) & 1))
+            continue;
+
+        uint16_t *op_probs = &c->probs[BV_CTX_TILE_OP + c->prev_op * 3];
+
+        if (coder_bit(s, c, &op_probs[0])) {
+            const bool white = coder_bit(s, c, &op_probs[1]);
+
+            c->prev_op = white ? BV_OP_WHITE : BV_OP_BLACK;
+            cmd->tiles[t] = white ? BV_TILE_WHITE : BV_TILE_BLACK;
+        } else if (coder_bit(s, c, &op_probs[2])) {
+            c->prev_op = BV_OP_INDEXED;
+            cmd->tiles[t] = coder_tree(s, c, &c->probs[BV_CTX_TILE_INDEX], 8);
+        } else {
+            uint32_t bits = 0;
+
+            for (uint32_t i = 0; i < 16; i++) {
+                const uint32_t left = i % 4 ? (bits >> (i - 1)) & 1 : 0;
+                const uint32_t above = i >= 4 ? (bits >> (i - 4)) & 1 : 0;
+
+                bits |= coder_bit(s, c, &c->probs[BV_CTX_TILE_BITS + i * 4 + left * 2 + above]) << i;
+            }
+
+            c->prev_op = BV_OP_INLINE;
+            cmd->tiles[t] = bits;
+            cmd->inline_mask |= 1 << t;
+        }
+    }
+}
+
+static void coded_read_cmd(struct bv_stream *s, struct bv_coder *c, struct coded_cmd *cmd) {
+    uint16_t *cmd_probs = &c->probs[BV_CTX_CMD + c->prev_cmd * 2];
+
+    if (coder_bit(s, c, &cmd_probs[0])) {
+        cmd->kind = 0;
+        coded_read_supertile(s, c, cmd);
+    } else if (coder_bit(s, c, &cmd_probs[1])) {
+        cmd->kind = 1;
+
+        if (s->version < 5) {
+            cmd->fields[0] = coder_tree(s, c, &c->probs[BV_CTX_MOVE], 5);
+            cmd->fields[1] = coder_tree(s, c, &c->probs[BV_CTX_MOVE + 32], 5);
+        } else {
+            uint32_t zeros = 0;
+            while (zeros < BV_SKIP_PREFIX_MAX && !coder_bit(s, c, &c->probs[BV_CTX_SKIP + zeros]))
+                zeros += 1;
+
+            const uint32_t width = zeros + BV_SKIP_ORDER;
+            cmd->skip = ((1u << width) | coder_direct(s, c, width)) - (1u << BV_SKIP_ORDER);
+        }
+    } else {
+        cmd->kind = 2;
+        cmd->fields[0] = coder_direct(s, c, 8);
+        cmd->fields[1] = coder_direct(s, c, 8);
+        cmd->entry_count = 0;
+
+        if (cmd->fields[0] == BV_EXT_ESCAPE && cmd->fields[1] == BV_EXT_TILESET) {
+            cmd->entry_count = coder_direct(s, c, 4) + 1;
+
+            for (uint32_t i = 0; i < cmd->entry_count; i++) {
+                cmd->entry_slots[i] = coder_direct(s, c, 8);
+                cmd->entry_tiles[i] = coder_direct(s, c, 16);
+            }
+        }
+    }
+
+    c->prev_cmd = cmd->kind;
+}
+
+static inline __attribute__((always_inline)) void draw_coded_supertile_impl(struct bv_stream *s, uint8_t *fb, const uint16_t origin[2],
+                                                                            const struct coded_cmd *cmd, const bool checked) {
+    struct st_place pl;
+    st_place_init(s, s->cursor, origin, &pl);
+
+    for (uint32_t t = 0; t < 16; t++) {
+        if (!((cmd->cv_mask >> t) & 1))
+            continue;
+
+        const uint32_t *rows;
+        uint32_t inline_rows[4];
+
+        if ((cmd->inline_mask >> t) & 1) {
+            expand_tile(s->fb_format, cmd->tiles[t], inline_rows);
+            rows = inline_rows;
+        } else {
+            rows = s->tile_rows[cmd->tiles[t]];
+        }
+
+        st_place_tile(s, fb, origin, &pl, t % 4, t / 4, rows, checked);
+    }
+
+    finish_supertile(s, cmd->cv_mask, cmd->adj_prefix);
+}
+
+// Decode and carry out the next cmd of a coded stream, the whole cmd is resident (cmd_resident);
+// returns: 1 - it ended the frame, 0 - the frame goes on, -2 - unknown extended cmd
+static int32_t decode_coded_cmd(struct bv_stream *s, uint8_t *fb, const uint16_t origin[2]) {
+    struct bv_coder *c = &s->coder;
+
+    if (s->coder_restart) {
+        coder_start(s, c, s->bit_head / 8);
+        s->coder_restart = false;
+    }
+
+    struct coded_cmd cmd;
+    coded_read_cmd(s, c, &cmd);
+
+    // whatever the coder read in is consumed
+    consume_to(s, c->in_pos * 8);
+
+    if (cmd.kind == 0) {
+        if (s->verified)
+            draw_coded_supertile_impl(s, fb, origin, &cmd, false);
+        else
+            draw_coded_supertile_impl(s, fb, origin, &cmd, true);
+
+        return 0;
+    }
+
+    if (cmd.kind == 1) {
+        coded_move(s, s->cursor, &cmd);
+        return 0;
+    }
+
+    if (cmd.fields[0] != BV_EXT_ESCAPE) {
+        s->flip_shift[0] = (int8_t)cmd.fields[0];
+        s->flip_shift[1] = (int8_t)cmd.fields[1];
+        return 1;
+    }
+
+    switch (cmd.fields[1]) {
+    case BV_EXT_KEYFRAME:
+        // the next frame starts a new coder, right after this one's last byte
+        keyframe_next(s);
+        s->coder_restart = true;
+        return 1;
+
+    case BV_EXT_TILESET:
+        for (uint32_t i = 0; i < cmd.entry_count; i++)
+            set_tileset_entry(s, cmd.entry_slots[i], cmd.entry_tiles[i]);
+        return 0;
+
+    case BV_EXT_END:
+        s->flip_shift[0] = 0;
+        s->flip_shift[1] = 0;
+        s->stream_ended = true;
+        return 1;
+    }
+
+    return -2;
+}
+
+// frames are decoded into the fb which isn't on-screen
+static uint8_t *decode_fb(struct bv_stream *s, uint16_t **origin) {
+    const uint32_t fb_index = s->fbs[1] ? s->front ^ 1 : 0;
+    assert(s->fbs[fb_index]);
+
+    *origin = s->fb_origins[fb_index];
+    return s->fbs[fb_index];
+}
+
+// only padding left in an attached stream (or past a coded stream's end), we're at the end
+static bool stream_at_end(struct bv_stream *s) {
+    return s->stream_ended || (s->mem && (uint64_t)s->bit_head + 8 > (uint64_t)s->mem_size * 8);
+}
+
+int32_t bv_stream_decframe(struct bv_stream *s) {
+    assert(!s->swap_pending && "previous frame is not on-screen yet");
+
+    uint16_t *origin;
+    uint8_t *fb = decode_fb(s, &origin);
+
+    if (stream_at_end(s))
+        return -1;
+    
+    if (!s->frame_open)
+        open_frame(s, fb, origin);
+
+    int32_t res;
+    while (true) {
+        // slices are walked one after the other, or skipped when they're decoded already
+        if (s->slice_next < s->slice_count && (s->slices_claimed || s->bit_head >= s->slices[s->slice_next].bit_end)) {
+            next_slice(s);
+            continue;
+        }
+
+        if (!cmd_resident(s))
+            return -1;
+
+        if (s->coded) {
+            res = decode_coded_cmd(s, fb, origin);
+            if (res < 0)
+                return res;
+
+            if (res)
+                break;
+
+            continue;
+        }
+
+        uint32_t cmd_bits;
+        res = read_in_bits(s, &cmd_bits, s->bit_head, 2);
+        if (res < 0)
+            return res;
+
+        if (cmd_bits & 1) {
+            // supertile cmd
+            res = draw_supertile(s, fb, origin);
+            if (res < 0)
+                return res;
+
+        } else if (cmd_bits & 2) {
+            // move cmd
+            res = read_move(s, &s->cache, s->bit_head, s->cursor);
+            if (res < 0)
+                return res;
+
+            consume_to(s, s->bit_head + res);
+
+        } else {
+            // flip cmd
+            uint32_t flip_bits;
+            res = read_in_bits(s, &flip_bits, s->bit_head + 2, 16);
+            if (res < 0)
+                return res;
+
+            consume_to(s, s->bit_head + 18);
+
+            if ((flip_bits & 0xff) == BV_EXT_ESCAPE) {
+                // extended cmd, the y byte selects it
+                const uint8_t ext_cmd = flip_bits >> 8;
+
+                if (ext_cmd == BV_EXT_KEYFRAME) {
+                    keyframe_next(s);
+                    break;
+                }
+
+                if (ext_cmd == BV_EXT_TILESET && s->version >= 2) {
+                    // the frame goes on with the new entries
+                    res = update_tileset(s);
+                    if (res < 0)
+                        return res;
+
+                    continue;
+                }
+
+                if (ext_cmd == BV_EXT_SLICES && s->version >= 4) {
+                    res = read_slice_table(s);
+                    if (res < 0)
+                        return res;
+
+                    continue;
+                }
+
+                // unknown extended cmd
+                return -2;
+            }
+
+            // the shift moves this frame into place for the next frame's diffs
+            s->flip_shift[0] = ((int8_t *)&flip_bits)[0];
+            s->flip_shift[1] = ((int8_t *)&flip_bits)[1];
+            break;
+        }
+    }
+
+    memset(s->cursor, 0, sizeof(s->cursor));
+    s->frame_index += 1;
+    s->frame_open = false;
+    s->slice_count = 0;
+
+    if (s->fbs[1])
+        s->swap_pending = true;
+
+    return 0;
+}
+
+int32_t bv_stream_slice_frame(struct bv_stream *s) {
+    assert(!s->swap_pending && "previous frame is not on-screen yet");
+
+    uint16_t *origin;
+    uint8_t *fb = decode_fb(s, &origin);
+
+    if (stream_at_end(s))
+        return -1;
+
+    // coded streams have no slices, the coder runs through the whole frame
+    if (s->coded || s->version < 4)
+        return 0;
+
+    if (!s->frame_open)
+        open_frame(s, fb, origin);
+
+    // the frame's tileset updates come first, then the slice table if it has one
+    while (!s->slice_count) {
+        if (!cmd_resident(s))
+            return -1;
+
+        uint32_t cmd_bits;
+        if (read_in_bits(s, &cmd_bits, s->bit_head, 18) < 0)
+            return -1;
+
+        if ((cmd_bits & 3) || ((cmd_bits >> 2) & 0xff) != BV_EXT_ESCAPE)
+            return 0;
+
+        const uint8_t ext_cmd = cmd_bits >> 10;
+
+        int32_t res;
+
+        if (ext_cmd == BV_EXT_TILESET) {
+            consume_to(s, s->bit_head + 18);
+
+            res = update_tileset(s);
+            if (res < 0)
+                return res;
+
+            continue;
+        }
+
+        if (ext_cmd != BV_EXT_SLICES)
+            return 0;
+
+        consume_to(s, s->bit_head + 18);
+
+        res = read_slice_table(s);
+        if (res < 0)
+            return res;
+    }
+
+    // a serial decode of the slices already started
+    if (s->slices_claimed || s->slice_next || s->bit_head != s->slices[0].bit_head)
+        return 0;
+
+    // the slices are read out of order, they all have to be resident (and stay so, bit_head holds
+    // the feeder off until they're done); slices which never fit are left to decframe
+    if (!s->mem && !__atomic_load_n(&s->input_ended, __ATOMIC_ACQUIRE)) {
+        const uint32_t end = s->slices[s->slice_count - 1].bit_end / 8 + sizeof(uint32_t);
+
+        if (end >= s->bit_head / 8 + BV_READ_BUF_SIZE)
+            return 0;
+        if (end >= __atomic_load_n(&s->buf_head, __ATOMIC_ACQUIRE))
+            return -1;
+    }
+
+    for (uint32_t i = 0; i < s->slice_count; i++) {
+        struct bv_slice *sl = &s->slices[i];
+
+        sl->supertile_count = 0;
+        sl->tile_count = 0;
+        sl->damage_count = 0;
+
+        if (s->mem)
+            mem_refill(s, &sl->cache, sl->bit_head);
+    }
+
+    s->slices_claimed = true;
+    return s->slice_count;
+}
+
+void bv_stream_decslice(struct bv_stream *s, uint32_t slice) {
+    assert(s->slices_claimed && slice < s->slice_count);
+
+    uint16_t *origin;
+    uint8_t *fb = decode_fb(s, &origin);
+
+    struct bv_slice *sl = &s->slices[slice];
+    uint16_t cursor[2] = {0, sl->rows[0]};
+
+    struct st_run r = {
+        .head = sl->bit_head,
+        .cursor = cursor,
+        .cache = &sl->cache,
+        .rows = {sl->rows[0], sl->rows[1]},
+    };
+
+    while (r.head < sl->bit_end) {
+        uint32_t cmd_bits;
+        if (read_bits_cached(s, r.cache, &cmd_bits, r.head, 2) < 0)
+            break;
+
+        if (cmd_bits & 1) {
+            const int32_t res = s->verified ? draw_supertile_impl(s, fb, origin, &r, false) : draw_supertile_impl(s, fb, origin, &r, true);
+            if (res < 0)
+                break;
+
+        } else if (cmd_bits & 2) {
+            const int32_t size = read_move(s, r.cache, r.head, cursor);
+            if (size < 0)
+                break;
+
+            r.head += size;
+
+        } else {
+            break; // slices only have supertile and move cmds
+        }
+    }
+
+    sl->supertile_count = r.supertile_count;
+    sl->tile_count = r.tile_count;
+    sl->damage_count = r.damage_count;
+}
+
+/* bvdec seeking */
+
+int32_t bv_stream_seek(struct bv_stream *s, uint32_t frame) {
+    if (!s->mem || !s->index_count)
+        return -2;
+
+    // find the last keyframe at or before frame
+    struct bv_index_entry entry;
+    uint32_t lo = 0, hi = s->index_count;
+
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (read_in_bytes(s, (uint8_t *)&entry, s->index_head + mid * sizeof(entry), sizeof(entry)) < 0)
+            return -2;
+
+        if (entry.frame <= frame)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    if (read_in_bytes(s, (uint8_t *)&entry, s->index_head + lo * sizeof(entry), sizeof(entry)) < 0)
+        return -2;
+    if (entry.frame > frame)
+        return -2;
+
+    // an unpresented frame gets dropped, its fb is the back fb again
+    s->swap_pending = false;
+
+    s->bit_head = entry.bit_offset;
+    s->frame_index = entry.frame;
+    s->frame_open = false;
+
+    memset(s->cursor, 0, sizeof(s->cursor));
+    memset(s->flip_shift, 0, sizeof(s->flip_shift));
+    s->fb_reset = true;
+
+    reset_tileset(s);
+
+    // a coded stream's keyframe starts a new coder
+    s->coder_restart = true;
+    s->stream_ended = false;
+
+    s->slice_count = 0;
+    s->slices_claimed = false;
+
+    // fast-forward, the frames in between all pile up in the back fb
+    while (s->frame_index < frame) {
+        if (bv_stream_decframe(s) < 0)
+            return -1;
+
+        s->swap_pending = false;
+        s->back_synced = true;
+    }
+
+    return 0;
+}
+
+/* bvdec verification */
+
+// Verification only walks attached streams, all of it is read with read_mem_bits.
+
+// the first row and size of the slice table entry at pos
+static void verify_slice_entry(struct bv_stream *s, uint32_t pos, uint32_t *row, uint32_t *size) {
+    *row = read_mem_bits(s, &s->cache, pos, slice_row_bits(s));
+    *size = read_mem_bits(s, &s->cache, pos + slice_row_bits(s), slice_size_bits(s));
+}
+
+static bool verify_index_entry(struct bv_stream *s, uint32_t i, struct bv_index_entry *entry) {
+    return read_in_bytes(s, (uint8_t *)entry, s->index_head + i * sizeof(*entry), sizeof(*entry)) == 0;
+}
+
+// The supertile cmd at *pos (moved past it), every covered tile has to be inside the frame and the
+// supertile inside rows.
+static bool verify_supertile(struct bv_stream *s, uint32_t *pos, uint16_t cursor[2], const uint16_t rows[2]) {
+    const uint32_t st_w = (s->extent[0] + 15) / 16, st_h = (s->extent[1] + 15) / 16;
+
+    const uint32_t st_bits = read_mem_bits(s, &s->cache, *pos + 1, 18);
+    *pos += 19;
+
+    if (cursor[0] >= st_w || cursor[1] >= st_h || cursor[1] < rows[0] || cursor[1] >= rows[1])
+        return false;
+
+    const uint16_t cv_mask = st_bits >> 2;
+
+    for (uint32_t i = 0; i < 16; i++) {
+        if (!((cv_mask >> i) & 1))
+            continue;
+
+        if (!tile_in_frame(s, cursor[0] * 16 + i % 4 * 4, cursor[1] * 16 + i / 4 * 4))
+            return false;
+
+        // 8-bit tileset indices always land in the tileset
+        const uint32_t tile_bits = read_mem_bits(s, &s->cache, *pos, 2);
+        *pos += (tile_bits & 1) ? 2 : (tile_bits & 2) ? 10 : 18;
+    }
+
+    if (*pos > (uint64_t)s->mem_size * 8)
+        return false; // truncated
+
+    advance_cursor(cursor, st_bits & 3);
+    return true;
+}
+
+// The slice table at *pos and its slices (moved past them all), each slice has to end exactly where
+// the table says and keep to its rows.
+static bool verify_slices(struct bv_stream *s, uint32_t *pos, uint32_t *bad_bit) {
+    const uint32_t st_h = (s->extent[1] + 15) / 16;
+
+    const uint32_t count = read_mem_bits(s, &s->cache, *pos, 4) + 1;
+    *pos += 4;
+
+    const uint32_t entry_bits = slice_entry_bits(s);
+    uint32_t slice_head = *pos + count * entry_bits;
+
+    if (slice_head > (uint64_t)s->mem_size * 8)
+        return false; // truncated
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t row, size, next_row, next_size;
+        verify_slice_entry(s, *pos + i * entry_bits, &row, &size);
+
+        // rows go up, every slice has at least one
+        uint16_t rows[2] = {row, st_h};
+        if (i + 1 < count) {
+            verify_slice_entry(s, *pos + (i + 1) * entry_bits, &next_row, &next_size);
+            rows[1] = next_row;
+        }
+
+        if (rows[0] >= rows[1] || rows[1] > st_h)
+            return false;
+
+        const uint32_t slice_end = slice_head + size;
+        if (slice_end > (uint64_t)s->mem_size * 8)
+            return false;
+
+        uint16_t cursor[2] = {0, rows[0]};
+
+        while (slice_head < slice_end) {
+            *bad_bit = slice_head;
+
+            const uint32_t cmd_bits = read_mem_bits(s, &s->cache, slice_head, 2);
+
+            if (cmd_bits & 1) {
+                if (!verify_supertile(s, &slice_head, cursor, rows))
+                    return false;
+            } else if (cmd_bits & 2) {
+                slice_head += read_move(s, &s->cache, slice_head, cursor);
+            } else {
+                return false; // slices only have supertile and move cmds
+            }
+        }
+
+        // the last cmd ran past the slice
+        if (slice_head != slice_end)
+            return false;
+    }
+
+    *pos = slice_head;
+    return true;
+}
+
+// Walk the frame bitstream the way decframe would without drawing anything; returns false
+// with *bad_bit on the offending cmd (or index entry).
+static bool verify_frames(struct bv_stream *s, uint32_t *bad_bit) {
+    const uint64_t end = (uint64_t)s->mem_size * 8;
+    const uint16_t all_rows[2] = {0, BV_MAX_EXTENT / 16};
+
+    uint32_t pos = s->frames_head * 8;
+    uint32_t frame = 0;
+    uint16_t cursor[2] = {0, 0};
+
+    // the frame's slices were walked, only its flip may follow
+    bool sliced = false;
+
+    // index entries are matched in order against the keyframes as they're walked over
+    struct bv_index_entry entry;
+    uint32_t index_seek = 0;
+    bool entry_valid = s->index_count && verify_index_entry(s, 0, &entry);
+
+    bool frame_start = true;
+
+    // the frame starting at pos starts from a blank fb, the first one or one after a keyframe cmd
+    bool keyframe = true;
+
+    // frames end at a flip or with the stream (only padding left)
+    while ((uint64_t)pos + 8 <= end) {
+        // a frame starts at pos, it has to be indexed right here if the next entry names it; seeking
+        // decodes from a cleared fb, so only keyframes can be indexed
+        if (frame_start && entry_valid && entry.frame == frame && entry.bit_offset == pos) {
+            if (!keyframe) {
+                *bad_bit = pos;
+                return false;
+            }
+
+            index_seek += 1;
+            entry_valid = index_seek < s->index_count && verify_index_entry(s, index_seek, &entry);
+        }
+
+        frame_start = false;
+        *bad_bit = pos;
+
+        const uint32_t cmd_bits = read_mem_bits(s, &s->cache, pos, 2);
+
+        if (sliced && (cmd_bits & 3))
+            return false;
+
+        if (cmd_bits & 1) {
+            // supertile cmd
+            if (!verify_supertile(s, &pos, cursor, all_rows))
+                return false;
+
+        } else if (cmd_bits & 2) {
+            // move cmd, checked once a supertile is drawn at the new cursor
+            pos += read_move(s, &s->cache, pos, cursor);
+
+            if (pos > end)
+                return false;
+
+        } else {
+            // flip cmd, the stream's last one may run into the padding
+            const uint32_t flip_bits = read_mem_bits(s, &s->cache, pos + 2, 16);
+            pos += 18;
+
+            const int8_t shift_x = flip_bits & 0xff, shift_y = flip_bits >> 8;
+
+            if ((flip_bits & 0xff) == BV_EXT_ESCAPE && shift_y == BV_EXT_TILESET && s->version >= 2 && !sliced) {
+                // tileset update, any slot is a valid one; doesn't end the frame
+                const uint32_t count_bits = read_mem_bits(s, &s->cache, pos, 4);
+                pos += 4 + (count_bits + 1) * 24;
+
+                if (pos > end)
+                    return false;
+
+                continue;
+            }
+
+            if ((flip_bits & 0xff) == BV_EXT_ESCAPE && shift_y == BV_EXT_SLICES && s->version >= 4 && !sliced) {
+                // slices, whatever the frame drew before them stays
+                if (!verify_slices(s, &pos, bad_bit))
+                    return false;
+
+                sliced = true;
+                continue;
+            }
+
+            if ((flip_bits & 0xff) == BV_EXT_ESCAPE) {
+                if (shift_y != BV_EXT_KEYFRAME)
+                    return false; // unknown extended cmd
+            } else if (abs(shift_x) >= s->extent[0] || abs(shift_y) >= s->extent[1]) {
+                return false;
+            }
+
+            memset(cursor, 0, sizeof(cursor));
+            frame += 1;
+            frame_start = true;
+            keyframe = (flip_bits & 0xff) == BV_EXT_ESCAPE;
+            sliced = false;
+        }
+    }
+
+    if (index_seek < s->index_count) {
+        // an entry which isn't at a keyframe, out of order or past the end
+        *bad_bit = entry_valid ? entry.bit_offset : s->index_head * 8;
+        return false;
+    }
+
+    return true;
+}
+
+// verify_frames for coded streams, decodes each cmd with the stream's own coder (which decode then
+// has to start over)
+static bool verify_coded_frames(struct bv_stream *s, uint32_t *bad_bit) {
+    struct bv_coder *c = &s->coder;
+    const uint32_t st_w = (s->extent[0] + 15) / 16, st_h = (s->extent[1] + 15) / 16;
+
+    uint32_t frame = 0;
+    uint16_t cursor[2] = {0, 0};
+
+    struct bv_index_entry entry;
+    uint32_t index_seek = 0;
+    bool entry_valid = s->index_count && verify_index_entry(s, 0, &entry);
+
+    bool segment_start = true;
+    uint32_t segment_pos = s->frames_head;
+
+    // a coded stream has to end with BV_EXT_END, within the input
+    while (true) {
+        if (segment_start) {
+            // a keyframe's coder starts right here, its index entry (if any) has to point here
+            if (entry_valid && entry.frame == frame && entry.bit_offset == segment_pos * 8) {
+                index_seek += 1;
+                entry_valid = index_seek < s->index_count && verify_index_entry(s, index_seek, &entry);
+            }
+
+            *bad_bit = segment_pos * 8;
+            if (segment_pos + 5 > s->mem_size)
+                return false;
+
+            coder_start(s, c, segment_pos);
+            segment_start = false;
+        }
+
+        *bad_bit = c->in_pos * 8;
+
+        struct coded_cmd cmd;
+        coded_read_cmd(s, c, &cmd);
+
+        if (c->in_pos > s->mem_size)
+            return false; // truncated
+
+        if (cmd.kind == 0) {
+            if (cursor[0] >= st_w || cursor[1] >= st_h)
+                return false;
+
+            for (uint32_t i = 0; i < 16; i++) {
+                if (((cmd.cv_mask >> i) & 1) && !tile_in_frame(s, cursor[0] * 16 + i % 4 * 4, cursor[1] * 16 + i / 4 * 4))
+                    return false;
+            }
+
+            advance_cursor(cursor, cmd.adj_prefix);
+            continue;
+        }
+
+        if (cmd.kind == 1) {
+            coded_move(s, cursor, &cmd);
+            continue;
+        }
+
+        const int8_t shift_x = cmd.fields[0], shift_y = cmd.fields[1];
+
+        if (cmd.fields[0] == BV_EXT_ESCAPE) {
+            if (shift_y == BV_EXT_TILESET)
+                continue;
+
+            if (shift_y == BV_EXT_END)
+                break;
+
+            if (shift_y != BV_EXT_KEYFRAME)
+                return false; // unknown extended cmd
+
+            segment_start = true;
+            segment_pos = c->in_pos;
+        } else if (abs(shift_x) >= s->extent[0] || abs(shift_y) >= s->extent[1]) {
+            return false;
+        }
+
+        memset(cursor, 0, sizeof(cursor));
+        frame += 1;
+    }
+
+    if (index_seek < s->index_count) {
+        *bad_bit = entry_valid ? entry.bit_offset : s->index_head * 8;
+        return false;
+    }
+
+    return true;
+}
+
+int32_t bv_stream_verify(struct bv_stream *s, uint32_t *bad_bit) {
+    assert(s->mem && "only attached streams can be verified");
+
+    uint32_t bit = 0;
+
+    if (bad_bit)
+        *bad_bit = 0;
+
+    s->verified = false;
+
+    if (!s->mem)
+        return -2;
+
+    // tiles are blitted whole, an extent that isn't a multiple of them would leave a partial tile
+    if (!s->extent[0] || !s->extent[1] || s->extent[0] % 4 || s->extent[1] % 4)
+        return -2;
+
+    bool valid;
+    if (s->coded) {
+        valid = verify_coded_frames(s, &bit);
+        s->coder_restart = true;
+    } else {
+        valid = verify_frames(s, &bit);
+    }
+
+    if (!valid) {
+        if (bad_bit)
+            *bad_bit = bit;
+
+        return -2;
+    }
+
+    s->verified = true;
+    return 0;
+}
+
+/* bvdec presentation */
+
+bool bv_stream_swap_pending(struct bv_stream *s) {
+    return s->swap_pending;
+}
+
+bool bv_stream_commit_swap(struct bv_stream *s) {
+    if (!s->swap_pending)
+        return false;
+
+    s->front ^= 1;
+    s->swap_pending = false;
+
+    return true;
+}
+
+const struct bv_damage *bv_stream_damage(struct bv_stream *s) {
+    return &s->damage;
+}
+
+uint8_t *bv_stream_active_fb(struct bv_stream *s) {
+    uint8_t *fb = s->fbs[s->front];
+    assert(fb);
 
     return fb;
+}
+
+const uint16_t *bv_stream_active_origin(struct bv_stream *s) {
+    return s->fb_origins[s->front];
 }
\ No newline at end of file
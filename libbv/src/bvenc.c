@@ -0,0 +1,1148 @@
+#include <bv/bvenc.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILE_VALUES 65536
+
+/* bvenc init */
+
+static void plane_init(struct bv_motion_plane *p, uint32_t width, uint32_t height) {
+    p->extent[0] = width;
+    p->extent[1] = height;
+    p->words = (width + 63) / 64;
+    p->rows = calloc(p->words * height, sizeof(uint64_t));
+}
+
+int32_t bv_encoder_init(struct bv_encoder *e, uint16_t width, uint16_t height, uint16_t framerate) {
+    memset(e, 0, sizeof(*e));
+
+    if (!width || !height || width > BV_MAX_EXTENT || height > BV_MAX_EXTENT || width % 4 || height % 4)
+        return -2;
+
+    e->extent[0] = width;
+    e->extent[1] = height;
+    e->framerate = framerate;
+    e->keyframe_interval = 300;
+    e->tileset_updates = true;
+    e->skips = true;
+
+    e->st_extent[0] = (width + 15) / 16;
+    e->st_extent[1] = (height + 15) / 16;
+
+    const uint32_t size = width * height;
+    const uint32_t st_size = e->st_extent[0] * e->st_extent[1];
+
+    e->prev = calloc(1, size);
+    e->src = calloc(1, size);
+
+    e->tile_counts = calloc(TILE_VALUES, sizeof(uint32_t));
+    e->tile_seen = calloc(TILE_VALUES, sizeof(uint32_t));
+    e->tile_index = malloc(TILE_VALUES * sizeof(int16_t));
+
+    e->ahead_counts = calloc(TILE_VALUES, sizeof(uint32_t));
+    e->ahead_tiles = calloc(TILE_VALUES, sizeof(uint16_t));
+
+    e->st_masks = calloc(st_size, sizeof(uint16_t));
+    e->st_order = calloc(st_size, sizeof(uint16_t));
+
+    plane_init(&e->motion_planes[0], width / 4, height / 4);
+    plane_init(&e->motion_planes[1], width / 4, height / 4);
+    plane_init(&e->motion_planes[2], width, height);
+    plane_init(&e->motion_planes[3], width, height);
+    e->motion_row = calloc(e->motion_planes[2].words, sizeof(uint64_t));
+
+    return 0;
+}
+
+void bv_encoder_deinit(struct bv_encoder *e) {
+    free(e->prev);
+    free(e->src);
+    free(e->tile_counts);
+    free(e->tile_seen);
+    free(e->tile_index);
+    free(e->tile_uses);
+    free(e->frame_uses);
+    free(e->ahead_counts);
+    free(e->ahead_tiles);
+    free(e->st_masks);
+    free(e->st_order);
+    for (uint32_t i = 0; i < 4; i++)
+        free(e->motion_planes[i].rows);
+    free(e->motion_row);
+    free(e->bits);
+    free(e->index);
+    free(e->coded_bytes);
+    free(e->coded_offsets);
+
+    memset(e, 0, sizeof(*e));
+}
+
+/* bvenc bit writer */
+
+static void put_bits(struct bv_encoder *e, uint32_t value, uint32_t width) {
+    if (e->bit_size + width > e->bit_cap) {
+        uint64_t cap = e->bit_cap ? e->bit_cap * 2 : 1 << 16;
+        while (cap < e->bit_size + width)
+            cap *= 2;
+
+        e->bits = realloc(e->bits, cap / 8);
+        memset(&e->bits[e->bit_cap / 8], 0, (cap - e->bit_cap) / 8);
+        e->bit_cap = cap;
+    }
+
+    for (uint32_t i = 0; i < width; i++, e->bit_size++) {
+        if ((value >> i) & 1)
+            e->bits[e->bit_size / 8] |= 1 << (e->bit_size % 8);
+    }
+}
+
+// overwrite bits put earlier
+static void patch_bits(struct bv_encoder *e, uint64_t pos, uint32_t value, uint32_t width) {
+    for (uint32_t i = 0; i < width; i++, pos++) {
+        if ((value >> i) & 1)
+            e->bits[pos / 8] |= 1 << (pos % 8);
+        else
+            e->bits[pos / 8] &= ~(1 << (pos % 8));
+    }
+}
+
+/* bvenc frame analysis */
+
+// Shift the previous frame the way the decoder will, the rows / columns it exposes keep their old pixels.
+static void offset_frame(struct bv_encoder *e, int8_t x, int8_t y) {
+    const uint32_t w = e->extent[0], h = e->extent[1];
+    uint8_t *f = e->src;
+
+    memcpy(f, e->prev, w * h);
+
+    if (x > 0) {
+        for (uint32_t row = 0; row < h; row++)
+            memmove(&f[row * w + x], &f[row * w], w - x);
+    } else if (x < 0) {
+        for (uint32_t row = 0; row < h; row++)
+            memmove(&f[row * w], &f[row * w - x], w + x);
+    }
+
+    if (y > 0)
+        memmove(&f[y * w], &f[0], w * (h - y));
+    else if (y < 0)
+        memmove(&f[0], &f[-y * w], w * (h + y));
+}
+
+// the frame the next one gets diffed against
+static void prepare_src(struct bv_encoder *e, const int8_t flip[2], bool blank) {
+    if (blank)
+        memset(e->src, 0, e->extent[0] * e->extent[1]);
+    else
+        offset_frame(e, flip[0], flip[1]);
+}
+
+// Collect the damaged tiles of every supertile, supertiles are ordered by their first damaged
+// pixel in raster order.
+static void detect_damage(struct bv_encoder *e, const uint8_t *frame) {
+    const uint32_t w = e->extent[0], h = e->extent[1];
+
+    e->st_count = 0;
+
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            if (!frame[y * w + x] == !e->src[y * w + x])
+                continue;
+
+            const uint32_t st = (y / 16) * e->st_extent[0] + x / 16;
+
+            if (!e->st_masks[st])
+                e->st_order[e->st_count++] = st;
+
+            e->st_masks[st] |= 1 << ((x % 16) / 4 + (y % 16) / 4 * 4);
+        }
+    }
+}
+
+// the 4x4 tile at x, y, bit x + y * 4
+static uint16_t tile_at(struct bv_encoder *e, const uint8_t *frame, uint32_t x, uint32_t y) {
+    const uint32_t w = e->extent[0];
+    uint16_t tile = 0;
+
+    for (uint32_t ty = 0; ty < 4; ty++) {
+        for (uint32_t tx = 0; tx < 4; tx++) {
+            if (frame[(y + ty) * w + x + tx])
+                tile |= 1 << (tx + ty * 4);
+        }
+    }
+
+    return tile;
+}
+
+/* bvenc scan pass */
+
+// keep the frame's tiles (counted in ahead_counts) for the encode pass' lookahead
+static void record_tile_uses(struct bv_encoder *e) {
+    if (e->frame_index + 2 > e->frame_use_cap) {
+        e->frame_use_cap = e->frame_use_cap ? e->frame_use_cap * 2 : 256;
+        e->frame_uses = realloc(e->frame_uses, e->frame_use_cap * sizeof(uint32_t));
+    }
+
+    if (e->tile_use_count + e->ahead_tile_count > e->tile_use_cap) {
+        while (e->tile_use_count + e->ahead_tile_count > e->tile_use_cap)
+            e->tile_use_cap = e->tile_use_cap ? e->tile_use_cap * 2 : 4096;
+
+        e->tile_uses = realloc(e->tile_uses, e->tile_use_cap * sizeof(struct bv_tile_use));
+    }
+
+    e->frame_uses[e->frame_index] = e->tile_use_count;
+
+    for (uint32_t i = 0; i < e->ahead_tile_count; i++) {
+        const uint16_t tile = e->ahead_tiles[i];
+
+        e->tile_uses[e->tile_use_count++] = (struct bv_tile_use){tile, e->ahead_counts[tile]};
+        e->ahead_counts[tile] = 0;
+    }
+
+    e->frame_uses[e->frame_index + 1] = e->tile_use_count;
+    e->ahead_tile_count = 0;
+}
+
+void bv_encoder_scan_frame(struct bv_encoder *e, const uint8_t *frame, const int8_t flip[2]) {
+    prepare_src(e, flip, e->frame_index == 0);
+    detect_damage(e, frame);
+
+    for (uint32_t i = 0; i < e->st_count; i++) {
+        const uint32_t st = e->st_order[i];
+        const uint32_t base_x = st % e->st_extent[0] * 16, base_y = st / e->st_extent[0] * 16;
+
+        for (uint32_t t = 0; t < 16; t++) {
+            if (!((e->st_masks[st] >> t) & 1))
+                continue;
+
+            const uint16_t tile = tile_at(e, frame, base_x + t % 4 * 4, base_y + t / 4 * 4);
+            if (tile == 0 || tile == 0xffff)
+                continue; // uniform tiles never go in the tileset
+
+            if (!e->tile_counts[tile])
+                e->tile_seen[tile] = ++e->tiles_seen;
+
+            e->tile_counts[tile] += 1;
+
+            // ahead_counts is free until the encode pass
+            if (!e->ahead_counts[tile]++)
+                e->ahead_tiles[e->ahead_tile_count++] = tile;
+        }
+
+        e->st_masks[st] = 0;
+    }
+
+    record_tile_uses(e);
+
+    memcpy(e->prev, frame, e->extent[0] * e->extent[1]);
+    e->frame_index += 1;
+}
+
+struct tile_reuse {
+    uint32_t count;
+    uint32_t seen;
+    uint16_t tile;
+};
+
+// most reused first, ties go to the tile seen first
+static int compare_reuse(const void *a, const void *b) {
+    const struct tile_reuse *ra = a, *rb = b;
+
+    if (ra->count != rb->count)
+        return ra->count < rb->count ? 1 : -1;
+
+    return ra->seen < rb->seen ? -1 : 1;
+}
+
+void bv_encoder_build_tileset(struct bv_encoder *e) {
+    struct tile_reuse *reuse = malloc(TILE_VALUES * sizeof(struct tile_reuse));
+    uint32_t count = 0;
+
+    for (uint32_t tile = 0; tile < TILE_VALUES; tile++) {
+        if (e->tile_counts[tile])
+            reuse[count++] = (struct tile_reuse){e->tile_counts[tile], e->tile_seen[tile], tile};
+    }
+
+    qsort(reuse, count, sizeof(struct tile_reuse), compare_reuse);
+
+    e->tileset_size = count < BV_TILESET_SIZE ? count : BV_TILESET_SIZE;
+    memset(e->tileset, 0, sizeof(e->tileset));
+    memset(e->tile_index, 0xff, TILE_VALUES * sizeof(int16_t));
+
+    for (uint32_t i = 0; i < e->tileset_size; i++) {
+        e->tileset[i] = reuse[i].tile;
+        e->tile_index[reuse[i].tile] = i;
+    }
+
+    free(reuse);
+
+    // the encode pass starts over
+    e->tileset_built = true;
+    e->scanned_frames = e->frame_index;
+    e->frame_index = 0;
+    memset(e->prev, 0, e->extent[0] * e->extent[1]);
+}
+
+/* bvenc motion search */
+
+static void plane_pack(struct bv_motion_plane *p, const uint8_t *frame) {
+    const uint32_t w = p->extent[0], h = p->extent[1];
+
+    memset(p->rows, 0, p->words * h * sizeof(uint64_t));
+
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            if (frame[y * w + x])
+                p->rows[y * p->words + x / 64] |= 1ull << (x % 64);
+        }
+    }
+}
+
+// A pixel per tile of the full plane, set when any of the tile's pixels are.
+static void plane_pack_low(struct bv_motion_plane *p, const struct bv_motion_plane *full) {
+    const uint32_t w = p->extent[0], h = p->extent[1];
+
+    memset(p->rows, 0, p->words * h * sizeof(uint64_t));
+
+    for (uint32_t y = 0; y < h; y++) {
+        const uint64_t *src = &full->rows[y * 4 * full->words];
+
+        for (uint32_t x = 0; x < w; x++) {
+            const uint32_t word = x / 16, shift = x % 16 * 4;
+            const uint64_t tile = (src[word] | src[word + full->words] | src[word + full->words * 2] | src[word + full->words * 3]) >> shift;
+
+            if (tile & 0xf)
+                p->rows[y * p->words + x / 64] |= 1ull << (x % 64);
+        }
+    }
+}
+
+// Shift a packed row by x like shift_fb does, the columns shifted in keep their old pixels.
+static void shift_row(const struct bv_motion_plane *p, const uint64_t *src, uint64_t *dst, int32_t x) {
+    const uint32_t words = p->words, w = p->extent[0];
+
+    for (uint32_t i = 0; i < words; i++) {
+        uint64_t word;
+
+        if (x > 0)
+            word = (src[i] << x) | (i ? src[i - 1] >> (64 - x) : 0);
+        else if (x < 0)
+            word = (src[i] >> -x) | (i + 1 < words ? src[i + 1] << (64 + x) : 0);
+        else
+            word = src[i];
+
+        // keep the exposed columns [0, x) or [w + x, w) from src
+        const int64_t lo = x > 0 ? 0 : (int64_t)w + x, hi = x > 0 ? x : (int64_t)w;
+        const int64_t base = (int64_t)i * 64;
+
+        uint64_t stale = 0;
+        if (x && hi > base && lo < base + 64) {
+            const uint32_t from = lo > base ? lo - base : 0, to = hi < base + 64 ? hi - base : 64;
+            stale = (to == 64 ? ~0ull : (1ull << to) - 1) & ~((1ull << from) - 1);
+        }
+
+        dst[i] = (word & ~stale) | (src[i] & stale);
+    }
+
+    // nothing past the plane's edge
+    if (w % 64)
+        dst[words - 1] &= (1ull << (w % 64)) - 1;
+}
+
+// The difference left if prev is shifted by x, y: damaged 4x4 tiles when tiles is set, differing
+// pixels otherwise.
+static uint32_t plane_cost(const struct bv_motion_plane *prev, const struct bv_motion_plane *curr,
+                           uint64_t *row, int32_t x, int32_t y, bool tiles) {
+    const uint32_t words = prev->words, h = prev->extent[1];
+    const uint32_t group = tiles ? 4 : 1;
+    const uint64_t tile_lsbs = 0x1111111111111111ull;
+
+    uint32_t cost = 0;
+
+    for (uint32_t gy = 0; gy + group <= h; gy += group) {
+        uint64_t acc[BV_MAX_EXTENT / 64] = {0};
+
+        for (uint32_t r = gy; r < gy + group; r++) {
+            // the source row after the vertical shift, rows shifted in keep their old pixels
+            uint32_t src_r = r;
+            if (y > 0 && r >= (uint32_t)y)
+                src_r = r - y;
+            else if (y < 0 && r < h + y)
+                src_r = r - y;
+
+            shift_row(prev, &prev->rows[src_r * words], row, x);
+
+            for (uint32_t i = 0; i < words; i++)
+                acc[i] |= row[i] ^ curr->rows[r * words + i];
+        }
+
+        // a tile is 4 bits of a row, damaged if any of its nibbles in the 4 rows differ
+        for (uint32_t i = 0; i < words; i++)
+            cost += __builtin_popcountll(tiles ? (acc[i] | acc[i] >> 1 | acc[i] >> 2 | acc[i] >> 3) & tile_lsbs : acc[i]);
+    }
+
+    return cost;
+}
+
+void bv_encoder_estimate_motion(struct bv_encoder *e, const uint8_t *prev, const uint8_t *frame, int8_t flip[2]) {
+    const int32_t range_x = BV_MOTION_RANGE < e->extent[0] ? BV_MOTION_RANGE : e->extent[0] - 1;
+    const int32_t range_y = BV_MOTION_RANGE < e->extent[1] ? BV_MOTION_RANGE : e->extent[1] - 1;
+
+    plane_pack(&e->motion_planes[2], prev);
+    plane_pack(&e->motion_planes[3], frame);
+
+    // coarse, a pixel per tile, every shift in tile steps
+
+    plane_pack_low(&e->motion_planes[0], &e->motion_planes[2]);
+    plane_pack_low(&e->motion_planes[1], &e->motion_planes[3]);
+
+    int32_t coarse_x = 0, coarse_y = 0;
+    uint32_t coarse_cost = plane_cost(&e->motion_planes[0], &e->motion_planes[1], e->motion_row, 0, 0, false);
+
+    for (int32_t y = -range_y / 4; y <= range_y / 4; y++) {
+        for (int32_t x = -range_x / 4; x <= range_x / 4; x++) {
+            const uint32_t cost = plane_cost(&e->motion_planes[0], &e->motion_planes[1], e->motion_row, x, y, false);
+
+            if (cost < coarse_cost) {
+                coarse_cost = cost;
+                coarse_x = x * 4;
+                coarse_y = y * 4;
+            }
+        }
+    }
+
+    // fine, every shift around the coarse pick, scored by the tiles a diff would have to redraw
+
+    int32_t best_x = 0, best_y = 0;
+    uint32_t best_cost = plane_cost(&e->motion_planes[2], &e->motion_planes[3], e->motion_row, 0, 0, true);
+
+    for (int32_t y = coarse_y - 3; y <= coarse_y + 3; y++) {
+        for (int32_t x = coarse_x - 3; x <= coarse_x + 3; x++) {
+            if (x < -range_x || x > range_x || y < -range_y || y > range_y)
+                continue;
+
+            const uint32_t cost = plane_cost(&e->motion_planes[2], &e->motion_planes[3], e->motion_row, x, y, true);
+
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_x = x;
+                best_y = y;
+            }
+        }
+    }
+
+    flip[0] = best_x;
+    flip[1] = best_y;
+}
+
+/* bvenc encode pass */
+
+// supertile rows the frame's cmds are being put for, the whole frame unless it's sliced
+struct st_band {
+    int32_t row_lo, row_hi;
+};
+
+static bool st_damaged(struct bv_encoder *e, const struct st_band *band, int32_t x, int32_t y) {
+    if (x < 0 || y < band->row_lo || x >= e->st_extent[0] || y >= band->row_hi)
+        return false;
+
+    return e->st_masks[y * e->st_extent[0] + x];
+}
+
+static void put_supertile(struct bv_encoder *e, const uint8_t *frame, int32_t cx, int32_t cy,
+                          uint16_t mask, uint32_t adj_prefix) {
+    put_bits(e, 1, 1);
+    put_bits(e, adj_prefix, 2);
+    put_bits(e, mask, 16);
+
+    for (uint32_t t = 0; t < 16; t++) {
+        if (!((mask >> t) & 1))
+            continue;
+
+        const uint16_t tile = tile_at(e, frame, cx * 16 + t % 4 * 4, cy * 16 + t / 4 * 4);
+
+        if (tile == 0xffff) {
+            put_bits(e, 3, 2); // uniform white
+        } else if (tile == 0) {
+            put_bits(e, 1, 2); // uniform black
+        } else if (e->tile_index[tile] >= 0) {
+            put_bits(e, 2, 2);
+            put_bits(e, e->tile_index[tile], 8);
+        } else {
+            put_bits(e, 0, 2);
+            put_bits(e, tile, 16);
+        }
+    }
+}
+
+// a move cmd from the cursor at cx, cy to supertile st, as a skip unless they're off
+static void put_move(struct bv_encoder *e, int32_t cx, int32_t cy, uint32_t st) {
+    const uint32_t st_w = e->st_extent[0];
+
+    put_bits(e, 2, 2);
+
+    if (!e->skips) {
+        put_bits(e, st % st_w, 5);
+        put_bits(e, st / st_w, 5);
+        return;
+    }
+
+    // zigzagged raster distance, then Exp-Golomb
+    const int32_t skip = (int32_t)st - (cy * (int32_t)st_w + cx);
+    const uint32_t value = (skip > 0 ? 2 * skip - 1 : -2 * skip) + (1 << BV_SKIP_ORDER);
+    const uint32_t width = 31 - __builtin_clz(value);
+
+    put_bits(e, 0, width - BV_SKIP_ORDER);
+    put_bits(e, 1, 1);
+    put_bits(e, value, width);
+}
+
+static bool st_in_band(struct bv_encoder *e, const struct st_band *band, uint32_t st) {
+    return st_damaged(e, band, st % e->st_extent[0], st / e->st_extent[0]);
+}
+
+static void encode_diff(struct bv_encoder *e, const uint8_t *frame, const struct st_band *band) {
+    int32_t cx = 0, cy = band->row_lo;
+    uint32_t order_seek = 0;
+
+    uint32_t left = 0;
+    for (uint32_t i = 0; i < e->st_count; i++)
+        left += st_in_band(e, band, e->st_order[i]);
+
+    for (; left; left--) {
+        if (!st_damaged(e, band, cx, cy)) {
+            // jump to the earliest supertile still damaged
+            while (!st_in_band(e, band, e->st_order[order_seek]))
+                order_seek += 1;
+
+            const uint32_t st = e->st_order[order_seek];
+            put_move(e, cx, cy, st);
+
+            cx = st % e->st_extent[0];
+            cy = st / e->st_extent[0];
+        }
+
+        // chain into an adjacent damaged supertile when there is one, move up otherwise
+        // (a move cmd follows if nothing is there)
+        const uint32_t st = cy * e->st_extent[0] + cx;
+        const uint16_t mask = e->st_masks[st];
+        e->st_masks[st] = 0;
+
+        uint32_t adj_prefix;
+        int32_t nx = cx, ny = cy;
+
+        if (st_damaged(e, band, cx + 1, cy)) {
+            adj_prefix = 0;
+            nx += 1;
+        } else if (st_damaged(e, band, cx - 1, cy)) {
+            adj_prefix = 2;
+            nx -= 1;
+        } else if (st_damaged(e, band, cx, cy + 1)) {
+            adj_prefix = 1;
+            ny += 1;
+        } else {
+            adj_prefix = 3;
+            ny -= 1;
+        }
+
+        put_supertile(e, frame, cx, cy, mask, adj_prefix);
+
+        cx = nx;
+        cy = ny;
+    }
+}
+
+// Cut the frame into up to e->slices bands of supertile rows holding about as many damaged tiles each,
+// every band gets at least a row; returns the band count, the first row of band i in rows[i].
+static uint32_t plan_slices(struct bv_encoder *e, uint16_t rows[BV_SLICE_MAX]) {
+    const uint32_t st_w = e->st_extent[0], st_h = e->st_extent[1];
+
+    uint32_t count = e->slices < BV_SLICE_MAX ? e->slices : BV_SLICE_MAX;
+    if (count > e->st_count / BV_SLICE_MIN_SUPERTILES)
+        count = e->st_count / BV_SLICE_MIN_SUPERTILES;
+    if (count > st_h)
+        count = st_h;
+
+    if (count < 2)
+        return 0;
+
+    uint32_t weights[BV_MAX_EXTENT / 16] = {0};
+    uint32_t total = 0;
+
+    for (uint32_t st = 0; st < st_w * st_h; st++) {
+        const uint32_t tiles = __builtin_popcount(e->st_masks[st]);
+        weights[st / st_w] += tiles;
+        total += tiles;
+    }
+
+    uint32_t row = 0, sum = 0;
+    rows[0] = 0;
+
+    for (uint32_t i = 1; i < count; i++) {
+        sum += weights[row++];
+
+        // leave a row for each band after this one
+        while (row < st_h - (count - i) && sum * count < i * total)
+            sum += weights[row++];
+
+        rows[i] = row;
+    }
+
+    return count;
+}
+
+// A slices cmd, its table and the slices; the table's sizes are filled in once the slices are put.
+static void encode_slices(struct bv_encoder *e, const uint8_t *frame, const uint16_t rows[BV_SLICE_MAX], uint32_t count) {
+    put_bits(e, 0, 2);
+    put_bits(e, BV_EXT_ESCAPE, 8);
+    put_bits(e, BV_EXT_SLICES, 8);
+    put_bits(e, count - 1, 4);
+
+    // the entries got wider along with skips
+    const uint32_t row_bits = e->skips ? BV_SLICE_WIDE_ROW_BITS : BV_SLICE_ROW_BITS;
+    const uint32_t size_bits = e->skips ? BV_SLICE_WIDE_SIZE_BITS : BV_SLICE_SIZE_BITS;
+
+    const uint64_t table = e->bit_size;
+    for (uint32_t i = 0; i < count; i++) {
+        put_bits(e, rows[i], row_bits);
+        put_bits(e, 0, size_bits);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const struct st_band band = {rows[i], i + 1 < count ? rows[i + 1] : e->st_extent[1]};
+        const uint64_t head = e->bit_size;
+
+        encode_diff(e, frame, &band);
+
+        patch_bits(e, table + i * (row_bits + size_bits) + row_bits, e->bit_size - head, size_bits);
+    }
+
+    e->sliced_frame_count += 1;
+}
+
+/* bvenc tileset updates */
+
+// Keyframes start over from the header's tileset, its lowest ranked entries are the first to go.
+static void reset_live_tileset(struct bv_encoder *e) {
+    memcpy(e->live_tileset, e->tileset, sizeof(e->tileset));
+    memset(e->tile_index, 0xff, TILE_VALUES * sizeof(int16_t));
+
+    for (uint32_t i = 0; i < BV_TILESET_SIZE; i++) {
+        if (i < e->tileset_size)
+            e->tile_index[e->tileset[i]] = i;
+
+        e->slot_used[i] = -(int32_t)i - 1;
+    }
+}
+
+// most drawn ahead first, ties go to the lower tile
+static bool ahead_before(const struct bv_encoder *e, uint16_t a, uint16_t b) {
+    if (e->ahead_counts[a] != e->ahead_counts[b])
+        return e->ahead_counts[a] > e->ahead_counts[b];
+
+    return a < b;
+}
+
+// Swap tiles the frame draws a lot in the lookahead but which miss the tileset in for the entries
+// drawn the least, in a tileset update cmd ahead of the frame's diff (so the frame itself already
+// indexes them). Goes by the scan pass, frames it didn't see get no updates.
+static void update_tileset(struct bv_encoder *e) {
+    const uint32_t f = e->frame_index;
+
+    uint32_t end = f + BV_TILESET_LOOKAHEAD;
+    if (e->keyframe_interval && end > (f / e->keyframe_interval + 1) * e->keyframe_interval)
+        end = (f / e->keyframe_interval + 1) * e->keyframe_interval;
+    if (end > e->scanned_frames)
+        end = e->scanned_frames;
+
+    if (f >= end)
+        return;
+
+    for (uint32_t i = e->frame_uses[f]; i < e->frame_uses[end]; i++) {
+        const struct bv_tile_use *use = &e->tile_uses[i];
+
+        if (!e->ahead_counts[use->tile])
+            e->ahead_tiles[e->ahead_tile_count++] = use->tile;
+
+        e->ahead_counts[use->tile] += use->count;
+    }
+
+    // the frame's tiles missing the tileset, the BV_TILESET_UPDATE_MAX most drawn ahead sorted
+    uint16_t picks[BV_TILESET_UPDATE_MAX];
+    uint32_t pick_count = 0;
+
+    for (uint32_t i = e->frame_uses[f]; i < e->frame_uses[f + 1]; i++) {
+        const uint16_t tile = e->tile_uses[i].tile;
+
+        if (e->tile_index[tile] >= 0) {
+            e->slot_used[e->tile_index[tile]] = f;
+            continue;
+        }
+
+        uint32_t at = pick_count;
+        while (at && ahead_before(e, tile, picks[at - 1]))
+            at -= 1;
+
+        if (at == BV_TILESET_UPDATE_MAX)
+            continue;
+
+        if (pick_count < BV_TILESET_UPDATE_MAX)
+            pick_count += 1;
+
+        memmove(&picks[at + 1], &picks[at], (pick_count - 1 - at) * sizeof(uint16_t));
+        picks[at] = tile;
+    }
+
+    // each replaces the entry drawn the least ahead (ties go to the least recently drawn, then the
+    // lower slot) as long as it's worth the update
+    uint8_t slots[BV_TILESET_UPDATE_MAX];
+    bool taken[BV_TILESET_SIZE] = {false};
+    uint32_t count = 0;
+
+    for (; count < pick_count; count++) {
+        int32_t victim = -1;
+        uint32_t victim_ahead = 0;
+
+        for (uint32_t slot = 0; slot < BV_TILESET_SIZE; slot++) {
+            if (taken[slot])
+                continue;
+
+            const uint32_t ahead = e->ahead_counts[e->live_tileset[slot]];
+
+            if (victim < 0 || ahead < victim_ahead ||
+                (ahead == victim_ahead && e->slot_used[slot] < e->slot_used[victim])) {
+                victim = slot;
+                victim_ahead = ahead;
+            }
+        }
+
+        if (e->ahead_counts[picks[count]] < victim_ahead + BV_TILESET_GAIN)
+            break;
+
+        slots[count] = victim;
+        taken[victim] = true;
+    }
+
+    for (uint32_t i = 0; i < e->ahead_tile_count; i++)
+        e->ahead_counts[e->ahead_tiles[i]] = 0;
+    e->ahead_tile_count = 0;
+
+    if (!count)
+        return;
+
+    put_bits(e, 0, 2);
+    put_bits(e, BV_EXT_ESCAPE, 8);
+    put_bits(e, BV_EXT_TILESET, 8);
+    put_bits(e, count - 1, 4);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint16_t old = e->live_tileset[slots[i]];
+        if (e->tile_index[old] == slots[i])
+            e->tile_index[old] = -1;
+
+        e->live_tileset[slots[i]] = picks[i];
+        e->tile_index[picks[i]] = slots[i];
+        e->slot_used[slots[i]] = f;
+
+        put_bits(e, slots[i], 8);
+        put_bits(e, picks[i], 16);
+    }
+
+    e->tileset_update_count += count;
+}
+
+static void add_keyframe(struct bv_encoder *e) {
+    if (e->index_count == e->index_cap) {
+        e->index_cap = e->index_cap ? e->index_cap * 2 : 16;
+        e->index = realloc(e->index, e->index_cap * sizeof(struct bv_index_entry));
+    }
+
+    e->index[e->index_count++] = (struct bv_index_entry){
+        .frame = e->frame_index,
+        .bit_offset = e->bit_size,
+    };
+}
+
+void bv_encoder_encode_frame(struct bv_encoder *e, const uint8_t *frame, const int8_t flip[2]) {
+    if (!e->tileset_built)
+        bv_encoder_build_tileset(e);
+
+    const bool keyframe = e->frame_index == 0 ||
+                          (e->keyframe_interval && e->frame_index % e->keyframe_interval == 0);
+
+    if (e->frame_index) {
+        put_bits(e, 0, 2);
+
+        if (keyframe) {
+            // ends the previous frame without a shift
+            put_bits(e, BV_EXT_ESCAPE, 8);
+            put_bits(e, BV_EXT_KEYFRAME, 8);
+        } else {
+            put_bits(e, (uint8_t)flip[0], 8);
+            put_bits(e, (uint8_t)flip[1], 8);
+        }
+    }
+
+    if (keyframe)
+        add_keyframe(e);
+
+    prepare_src(e, flip, keyframe);
+    detect_damage(e, frame);
+
+    if (keyframe)
+        reset_live_tileset(e);
+    else if (e->tileset_updates)
+        update_tileset(e);
+
+    // coded streams aren't sliced, the coder runs through the whole frame
+    uint16_t rows[BV_SLICE_MAX];
+    const uint32_t slice_count = e->coded ? 0 : plan_slices(e, rows);
+
+    if (slice_count) {
+        encode_slices(e, frame, rows, slice_count);
+    } else {
+        const struct st_band band = {0, e->st_extent[1]};
+        encode_diff(e, frame, &band);
+    }
+
+    memcpy(e->prev, frame, e->extent[0] * e->extent[1]);
+    e->frame_index += 1;
+}
+
+/* bvenc range coder */
+
+// LZMA's range encoder, the mirror of bvdec's coder
+struct rc_encoder {
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    uint32_t cache_size;
+
+    uint8_t prev_cmd;
+    uint8_t prev_op;
+    uint16_t probs[BV_CTX_COUNT];
+};
+
+static void put_coded_byte(struct bv_encoder *e, uint8_t byte) {
+    if (e->coded_size == e->coded_cap) {
+        e->coded_cap = e->coded_cap ? e->coded_cap * 2 : 1 << 14;
+        e->coded_bytes = realloc(e->coded_bytes, e->coded_cap);
+    }
+
+    e->coded_bytes[e->coded_size++] = byte;
+}
+
+static void rc_start(struct rc_encoder *rc) {
+    rc->low = 0;
+    rc->range = 0xffffffff;
+    rc->cache = 0;
+    rc->cache_size = 1;
+
+    rc->prev_cmd = 0;
+    rc->prev_op = BV_OP_BLACK;
+
+    for (uint32_t i = 0; i < BV_CTX_COUNT; i++)
+        rc->probs[i] = 1 << (BV_PROB_BITS - 1);
+}
+
+// out goes the top byte of low, held back while a carry could still run into it
+static void rc_shift_low(struct bv_encoder *e, struct rc_encoder *rc) {
+    if ((uint32_t)rc->low < 0xff000000 || (rc->low >> 32)) {
+        const uint8_t carry = rc->low >> 32;
+        uint8_t byte = rc->cache;
+
+        do {
+            put_coded_byte(e, byte + carry);
+            byte = 0xff;
+        } while (--rc->cache_size);
+
+        rc->cache = rc->low >> 24;
+    }
+
+    rc->cache_size += 1;
+    rc->low = (rc->low & 0x00ffffff) << 8;
+}
+
+// normalizes after each decision, like the decoder, so both take the same bytes
+static void rc_normalize(struct bv_encoder *e, struct rc_encoder *rc) {
+    if (rc->range < (1u << 24)) {
+        rc->range <<= 8;
+        rc_shift_low(e, rc);
+    }
+}
+
+static void rc_bit(struct bv_encoder *e, struct rc_encoder *rc, uint16_t *prob, uint32_t bit) {
+    const uint32_t bound = (rc->range >> BV_PROB_BITS) * *prob;
+
+    if (!bit) {
+        rc->range = bound;
+        *prob += ((1 << BV_PROB_BITS) - *prob) >> BV_PROB_MOVE;
+    } else {
+        rc->low += bound;
+        rc->range -= bound;
+        *prob -= *prob >> BV_PROB_MOVE;
+    }
+
+    rc_normalize(e, rc);
+}
+
+static void rc_direct(struct bv_encoder *e, struct rc_encoder *rc, uint32_t value, uint32_t width) {
+    for (uint32_t i = width; i-- > 0;) {
+        rc->range >>= 1;
+        if ((value >> i) & 1)
+            rc->low += rc->range;
+
+        rc_normalize(e, rc);
+    }
+}
+
+static void rc_tree(struct bv_encoder *e, struct rc_encoder *rc, uint16_t *probs, uint32_t value, uint32_t width) {
+    uint32_t node = 1;
+
+    for (uint32_t i = width; i-- > 0;) {
+        const uint32_t bit = (value >> i) & 1;
+
+        rc_bit(e, rc, &probs[node], bit);
+        node = (node << 1) | bit;
+    }
+}
+
+// the last coded byte has to be out before the next coder starts
+static void rc_flush(struct bv_encoder *e, struct rc_encoder *rc) {
+    for (uint32_t i = 0; i < 5; i++)
+        rc_shift_low(e, rc);
+}
+
+static void rc_cmd(struct bv_encoder *e, struct rc_encoder *rc, uint8_t kind) {
+    uint16_t *cmd_probs = &rc->probs[BV_CTX_CMD + rc->prev_cmd * 2];
+
+    rc_bit(e, rc, &cmd_probs[0], kind == 0);
+    if (kind)
+        rc_bit(e, rc, &cmd_probs[1], kind == 1);
+
+    rc->prev_cmd = kind;
+}
+
+/* bvenc transcoding */
+
+static uint32_t get_bits(const struct bv_encoder *e, uint64_t *pos, uint32_t width) {
+    uint32_t value = 0;
+
+    for (uint32_t i = 0; i < width; i++, *pos += 1) {
+        if (*pos < e->bit_size && ((e->bits[*pos / 8] >> (*pos % 8)) & 1))
+            value |= 1 << i;
+    }
+
+    return value;
+}
+
+static void transcode_supertile(struct bv_encoder *e, struct rc_encoder *rc, uint64_t *pos) {
+    const uint32_t adj_prefix = get_bits(e, pos, 2);
+    const uint32_t cv_mask = get_bits(e, pos, 16);
+
+    rc_cmd(e, rc, 0);
+    rc_tree(e, rc, &rc->probs[BV_CTX_ADJ], adj_prefix, 2);
+
+    for (uint32_t t = 0; t < 16; t++) {
+        const uint32_t left = t % 4 ? (cv_mask >> (t - 1)) & 1 : 1;
+        const uint32_t above = t >= 4 ? (cv_mask >> (t - 4)) & 1 : 1;
+
+        rc_bit(e, rc, &rc->probs[BV_CTX_MASK + t * 4 + left * 2 + above], (cv_mask >> t) & 1);
+    }
+
+    for (uint32_t t = 0; t < 16; t++) {
+        if (!((cv_mask >> t) & 1))
+            continue;
+
+        uint16_t *op_probs = &rc->probs[BV_CTX_TILE_OP + rc->prev_op * 3];
+        const uint32_t op_bits = get_bits(e, pos, 2);
+
+        if (op_bits & 1) {
+            rc_bit(e, rc, &op_probs[0], 1);
+            rc_bit(e, rc, &op_probs[1], op_bits >> 1);
+
+            rc->prev_op = (op_bits >> 1) ? BV_OP_WHITE : BV_OP_BLACK;
+        } else if (op_bits & 2) {
+            rc_bit(e, rc, &op_probs[0], 0);
+            rc_bit(e, rc, &op_probs[2], 1);
+            rc_tree(e, rc, &rc->probs[BV_CTX_TILE_INDEX], get_bits(e, pos, 8), 8);
+
+            rc->prev_op = BV_OP_INDEXED;
+        } else {
+            rc_bit(e, rc, &op_probs[0], 0);
+            rc_bit(e, rc, &op_probs[2], 0);
+
+            const uint32_t bits = get_bits(e, pos, 16);
+
+            for (uint32_t i = 0; i < 16; i++) {
+                const uint32_t left = i % 4 ? (bits >> (i - 1)) & 1 : 0;
+                const uint32_t above = i >= 4 ? (bits >> (i - 4)) & 1 : 0;
+
+                rc_bit(e, rc, &rc->probs[BV_CTX_TILE_BITS + i * 4 + left * 2 + above], (bits >> i) & 1);
+            }
+
+            rc->prev_op = BV_OP_INLINE;
+        }
+    }
+}
+
+// Range code the frame bitstream cmd by cmd, each keyframe's cmds get a coder of their own (starting
+// at the byte its index entry will point to) and the stream ends with BV_EXT_END.
+static void transcode(struct bv_encoder *e) {
+    e->coded_size = 0;
+    e->coded_offsets = realloc(e->coded_offsets, (e->index_count + 1) * sizeof(uint32_t));
+
+    struct rc_encoder rc;
+    uint64_t pos = 0;
+    uint32_t entry = 0;
+    bool coder_open = false;
+
+    while (pos < e->bit_size) {
+        if (!coder_open) {
+            // each coder starts at a keyframe, which the bitstream has an index entry for
+            assert(entry < e->index_count && e->index[entry].bit_offset == pos);
+
+            e->coded_offsets[entry++] = e->coded_size;
+            rc_start(&rc);
+            coder_open = true;
+        }
+
+        if (get_bits(e, &pos, 1)) {
+            transcode_supertile(e, &rc, &pos);
+            continue;
+        }
+
+        if (get_bits(e, &pos, 1)) {
+            rc_cmd(e, &rc, 1);
+
+            if (!e->skips) {
+                rc_tree(e, &rc, &rc.probs[BV_CTX_MOVE], get_bits(e, &pos, 5), 5);
+                rc_tree(e, &rc, &rc.probs[BV_CTX_MOVE + 32], get_bits(e, &pos, 5), 5);
+                continue;
+            }
+
+            // a context per prefix bit, the low bits are plain
+            uint32_t zeros = 0;
+            while (!get_bits(e, &pos, 1))
+                rc_bit(e, &rc, &rc.probs[BV_CTX_SKIP + zeros++], 0);
+
+            rc_bit(e, &rc, &rc.probs[BV_CTX_SKIP + zeros], 1);
+            rc_direct(e, &rc, get_bits(e, &pos, zeros + BV_SKIP_ORDER), zeros + BV_SKIP_ORDER);
+            continue;
+        }
+
+        const uint32_t flip_x = get_bits(e, &pos, 8), flip_y = get_bits(e, &pos, 8);
+
+        rc_cmd(e, &rc, 2);
+        rc_direct(e, &rc, flip_x, 8);
+        rc_direct(e, &rc, flip_y, 8);
+
+        if (flip_x == BV_EXT_ESCAPE && flip_y == BV_EXT_TILESET) {
+            const uint32_t count = get_bits(e, &pos, 4);
+            rc_direct(e, &rc, count, 4);
+
+            for (uint32_t i = 0; i <= count; i++) {
+                rc_direct(e, &rc, get_bits(e, &pos, 8), 8);
+                rc_direct(e, &rc, get_bits(e, &pos, 16), 16);
+            }
+        } else if (flip_x == BV_EXT_ESCAPE && flip_y == BV_EXT_KEYFRAME) {
+            rc_flush(e, &rc);
+            coder_open = false;
+        }
+    }
+
+    if (!coder_open)
+        rc_start(&rc);
+
+    rc_cmd(e, &rc, 2);
+    rc_direct(e, &rc, BV_EXT_ESCAPE, 8);
+    rc_direct(e, &rc, BV_EXT_END, 8);
+    rc_flush(e, &rc);
+
+    e->coded_bit_size = e->bit_size;
+}
+
+/* bvenc output */
+
+static uint32_t frames_head(struct bv_encoder *e) {
+    return sizeof(struct bv_header) + sizeof(uint32_t) + e->index_count * sizeof(struct bv_index_entry);
+}
+
+// the frames as they're output, transcoded when the bitstream grew since the last time
+static uint32_t frames_size(struct bv_encoder *e) {
+    if (!e->coded)
+        return (e->bit_size + 7) / 8;
+
+    if (!e->coded_bytes || e->coded_bit_size != e->bit_size)
+        transcode(e);
+
+    return e->coded_size;
+}
+
+uint32_t bv_encoder_output_size(struct bv_encoder *e) {
+    return frames_head(e) + frames_size(e);
+}
+
+void bv_encoder_output(struct bv_encoder *e, uint8_t *out) {
+    struct bv_header header = {
+        .magic = {'B', 'i', 't', 'V'},
+        // players without tileset updates (or coding, slices) still take streams that have none
+        .version = e->skips ? 5 : e->sliced_frame_count ? 4 : e->coded ? 3 : e->tileset_update_count ? 2 : 1,
+        .flags = BV_FLAG_INDEX | (e->coded ? BV_FLAG_CODED : 0),
+        .extent = {e->extent[0], e->extent[1]},
+        .framerate = e->framerate,
+    };
+    memcpy(header.tileset, e->tileset, sizeof(header.tileset));
+
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+
+    // the index points at absolute bits
+    const uint32_t head = frames_head(e);
+    const uint32_t size = frames_size(e);
+
+    memcpy(out, &e->index_count, sizeof(uint32_t));
+    out += sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < e->index_count; i++) {
+        const struct bv_index_entry entry = {
+            .frame = e->index[i].frame,
+            .bit_offset = head * 8 + (e->coded ? e->coded_offsets[i] * 8 : e->index[i].bit_offset),
+        };
+
+        memcpy(out, &entry, sizeof(entry));
+        out += sizeof(entry);
+    }
+
+    if (size)
+        memcpy(out, e->coded ? e->coded_bytes : e->bits, size);
+}
+
+/* bvenc bindings */
+
+uint32_t bv_encoder_sizeof(void) {
+    return sizeof(struct bv_encoder);
+}
+
+void bv_encoder_set_keyframe_interval(struct bv_encoder *e, uint32_t interval) {
+    e->keyframe_interval = interval;
+}
+
+void bv_encoder_set_tileset_updates(struct bv_encoder *e, bool enabled) {
+    e->tileset_updates = enabled;
+}
+
+void bv_encoder_set_coded(struct bv_encoder *e, bool enabled) {
+    e->coded = enabled;
+}
+
+void bv_encoder_set_slices(struct bv_encoder *e, uint32_t slices) {
+    e->slices = slices;
+}
+
+void bv_encoder_set_skips(struct bv_encoder *e, bool enabled) {
+    e->skips = enabled || e->extent[0] > BV_MOVE_MAX_EXTENT || e->extent[1] > BV_MOVE_MAX_EXTENT;
+}
@@ -0,0 +1,123 @@
+#include <bv/bvmux.h>
+#include <bv/bvdec.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+void bvmx_reader_init(struct bvmx_reader *r) {
+    memset(r, 0, sizeof(*r));
+}
+
+void bvmx_reader_set_sink(struct bvmx_reader *r, uint8_t stream, bvmx_sink sink, void *ctx) {
+    if (stream >= BVMX_STREAM_COUNT)
+        return;
+
+    r->sinks[stream] = sink;
+    r->sink_ctxs[stream] = ctx;
+}
+
+bool bvmx_reader_at_boundary(struct bvmx_reader *r) {
+    return r->configured && !r->head_fill && r->chunk_seek == r->chunk.size;
+}
+
+/* bvmx parsing */
+
+// gather a header of size bytes into head_buf; returns true once it's complete
+static bool gather_head(struct bvmx_reader *r, uint32_t size, const uint8_t **data, uint32_t *left) {
+    const uint32_t take = MIN(size - r->head_fill, *left);
+
+    memcpy(&r->head_buf[r->head_fill], *data, take);
+    r->head_fill += take;
+    *data += take;
+    *left -= take;
+
+    if (r->head_fill < size)
+        return false;
+
+    r->head_fill = 0;
+    return true;
+}
+
+int32_t bvmx_reader_feed(struct bvmx_reader *r, const uint8_t *data, uint32_t size) {
+    uint32_t left = size;
+
+    if (!r->configured) {
+        if (!gather_head(r, sizeof(struct bvmx_header), &data, &left))
+            return size - left;
+
+        const struct bvmx_header *header = (const struct bvmx_header *)r->head_buf;
+        if (memcmp(header->magic, "BVMX", 4) || header->version > BVMX_VERSION)
+            return -2;
+
+        r->version = header->version;
+        r->configured = true;
+    }
+
+    while (left) {
+        // next chunk header
+
+        if (r->chunk_seek == r->chunk.size) {
+            if (!gather_head(r, sizeof(struct bvmx_chunk), &data, &left))
+                break;
+
+            memcpy(&r->chunk, r->head_buf, sizeof(struct bvmx_chunk));
+            r->chunk_seek = 0;
+            r->chunk_count += 1;
+
+            if (r->chunk.stream >= BVMX_STREAM_COUNT)
+                return -2;
+
+            continue;
+        }
+
+        // payload, straight from the caller's buffer into the sink
+
+        const uint8_t stream = r->chunk.stream;
+        const uint32_t avail = MIN(r->chunk.size - r->chunk_seek, left);
+
+        uint32_t taken = avail;
+        if (r->sinks[stream])
+            taken = r->sinks[stream](r->sink_ctxs[stream], &r->chunk, r->chunk_seek, data, avail);
+
+        r->chunk_seek += taken;
+        r->stream_bytes[stream] += taken;
+        data += taken;
+        left -= taken;
+
+        if (taken < avail)
+            break; // sink stalled
+    }
+
+    return size - left;
+}
+
+/* bvmx sinks */
+
+uint32_t bvmx_bv_sink(void *ctx, const struct bvmx_chunk *chunk, uint32_t offset,
+                      const uint8_t *data, uint32_t size) {
+    (void)chunk;
+    (void)offset;
+
+    struct bv_stream *s = ctx;
+    uint32_t taken = 0;
+
+    while (taken < size) {
+        uint32_t space;
+        uint8_t *window = bv_stream_write_window(s, &space);
+
+        if (!space)
+            break;
+
+        const uint32_t n = MIN(space, size - taken);
+        memcpy(window, &data[taken], n);
+        bv_stream_commit(s, n);
+
+        taken += n;
+    }
+
+    return taken;
+}
@@ -0,0 +1,27 @@
+#include <bv/bvmux.h>
+
+#include <ogg/ogg.h>
+
+#include <string.h>
+
+/* bvmx ogg sink */
+
+// kept out of bvmux.c so libbv itself doesn't need libogg
+
+uint32_t bvmx_ogg_sink(void *ctx, const struct bvmx_chunk *chunk, uint32_t offset,
+                       const uint8_t *data, uint32_t size) {
+    (void)chunk;
+    (void)offset;
+
+    ogg_sync_state *oy = ctx;
+
+    // ogg_sync grows its buffer to fit, it only fails once it's out of memory
+    char *buf = ogg_sync_buffer(oy, size);
+    if (!buf)
+        return 0;
+
+    memcpy(buf, data, size);
+    ogg_sync_wrote(oy, size);
+
+    return size;
+}
@@ -0,0 +1,166 @@
+#include <bv/bvdec.h>
+#include <bv/bvscale.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* bv_scaler tables */
+
+// Find (or add) the pattern taking dst pixel px from src window pixel
+// offsets[px]; returns the pattern index or -1 when out of patterns.
+static int32_t scaler_pattern(struct bv_scaler *sc, uint32_t *pattern_count, const uint8_t offsets[4]) {
+    uint8_t key = 0;
+    for (uint32_t px = 0; px < 4; px++)
+        key |= offsets[px] << (px * 2);
+
+    for (uint32_t i = 0; i < *pattern_count; i++) {
+        if (sc->pattern_keys[i] == key)
+            return i;
+    }
+
+    if (*pattern_count >= BV_SCALE_PATTERNS)
+        return -1;
+
+    uint32_t i = (*pattern_count)++;
+    sc->pattern_keys[i] = key;
+
+    for (uint32_t window = 0; window < 16; window++) {
+        uint32_t word = 0;
+        for (uint32_t px = 0; px < 4; px++) {
+            if ((window >> offsets[px]) & 1)
+                word |= 0xffu << (px * 8);
+        }
+
+        sc->pattern_lut[i][window] = word;
+    }
+
+    return i;
+}
+
+int32_t bv_scaler_init(struct bv_scaler *sc, const struct bv_stream *s, uint16_t dst_width, uint16_t dst_height) {
+    if (dst_width > BV_SCALE_MAX_WIDTH || dst_height > BV_SCALE_MAX_HEIGHT || dst_width % 4)
+        return -1;
+    if (!s->extent[0] || !s->extent[1])
+        return -1;
+
+    memset(sc, 0, sizeof(*sc));
+
+    sc->src_extent[0] = s->extent[0];
+    sc->src_extent[1] = s->extent[1];
+    sc->dst_extent[0] = dst_width;
+    sc->dst_extent[1] = dst_height;
+
+    sc->src_format = s->fb_format;
+    sc->src_stride = s->fb_stride;
+
+    for (uint32_t y = 0; y < dst_height; y++)
+        sc->y_map[y] = y * s->extent[1] / dst_height;
+    for (uint32_t x = 0; x < dst_width; x++)
+        sc->x_map[x] = x * s->extent[0] / dst_width;
+
+    // the word path needs every dst word to come out of a 4 pixel src window,
+    // which holds for any upscale (and a bit of downscale)
+
+    sc->word_path = sc->src_format == BV_FB_1BPP;
+
+    uint32_t pattern_count = 0;
+    for (uint32_t w = 0; w < dst_width / 4 && sc->word_path; w++) {
+        uint16_t pos = sc->x_map[w * 4];
+        uint8_t offsets[4];
+
+        for (uint32_t px = 0; px < 4; px++) {
+            uint32_t offset = sc->x_map[w * 4 + px] - pos;
+            if (offset > 3) {
+                sc->word_path = false;
+                break;
+            }
+
+            offsets[px] = offset;
+        }
+
+        int32_t pattern = sc->word_path ? scaler_pattern(sc, &pattern_count, offsets) : -1;
+        if (pattern < 0) {
+            sc->word_path = false;
+            break;
+        }
+
+        sc->word_pos[w] = pos;
+        sc->word_pattern[w] = pattern;
+    }
+
+    return 0;
+}
+
+/* bv_scaler kernels */
+
+// The fb wraps around origin[0] (see bv_stream.fb_origins), src pixels are looked up through it.
+// The firmware scales from its scanline irq, so these are placed in RAM (BV_RAM_FUNC).
+
+static void BV_RAM_FUNC(scale_row_words)(const struct bv_scaler *sc, const uint8_t *row, uint32_t origin_x, uint32_t *dst) {
+    const uint32_t src_w = sc->src_extent[0];
+
+    for (uint32_t w = 0; w < sc->dst_extent[0] / 4u; w++) {
+        uint32_t pos = sc->word_pos[w] + origin_x;
+        if (pos >= src_w)
+            pos -= src_w;
+
+        uint32_t window;
+
+        if (pos + 3 < src_w) {
+            window = row[pos / 8];
+            if (pos % 8 > 4)
+                window |= row[pos / 8 + 1] << 8;
+
+            window >>= pos % 8;
+        } else {
+            // the window wraps around the right edge
+            window = 0;
+            for (uint32_t px = 0; px < 4; px++) {
+                const uint32_t x = pos + px < src_w ? pos + px : pos + px - src_w;
+                window |= ((row[x / 8] >> (x % 8)) & 1) << px;
+            }
+        }
+
+        dst[w] = sc->pattern_lut[sc->word_pattern[w]][window & 15];
+    }
+}
+
+static void BV_RAM_FUNC(scale_row_pixels)(const struct bv_scaler *sc, const uint8_t *row, uint32_t origin_x, uint8_t *dst) {
+    for (uint32_t x = 0; x < sc->dst_extent[0]; x++) {
+        uint32_t src_x = sc->x_map[x] + origin_x;
+        if (src_x >= sc->src_extent[0])
+            src_x -= sc->src_extent[0];
+
+        bool white;
+
+        switch (sc->src_format) {
+        case BV_FB_8BPP:
+            white = row[src_x];
+            break;
+        case BV_FB_4BPP:
+            white = (row[src_x / 2] >> ((src_x % 2) * 4)) & 1;
+            break;
+        default:
+            white = (row[src_x / 8] >> (src_x % 8)) & 1;
+            break;
+        }
+
+        dst[x] = white ? 0xff : 0x00;
+    }
+}
+
+void BV_RAM_FUNC(bv_scale_row)(const struct bv_scaler *sc, const uint8_t *fb, const uint16_t origin[2], uint32_t row, uint8_t *dst) {
+    assert(row < sc->src_extent[1]);
+
+    uint32_t fb_row = row + origin[1];
+    if (fb_row >= sc->src_extent[1])
+        fb_row -= sc->src_extent[1];
+
+    const uint8_t *src = &fb[fb_row * sc->src_stride];
+
+    if (sc->word_path)
+        scale_row_words(sc, src, origin[0], (uint32_t *)dst);
+    else
+        scale_row_pixels(sc, src, origin[0], dst);
+}
@@ -0,0 +1,696 @@
+#include <bv/bvdec.h>
+#include <bv/bvscale.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+// bvbench - decodes a .bv file end to end and reports decoder throughput
+//
+// usage: bvbench [-m [-c] | -t] [-d] [-f 8|4|1] [-x] [-s WxH] [-p threads] [-H hashes] [-o times] [-b times [-r percent]]
+//                <file.bv> [runs]
+//   -m  decode straight from the mmap'd file instead of streaming it through bv_stream_read,
+//       the stream is verified first and decoded without bounds checks
+//   -c  keep the bounds checks, don't verify the attached stream
+//   -t  stream the file from a feeder thread through the credit interface, decoding concurrently
+//   -d  double-buffered, swaps are committed right after each frame
+//   -f  framebuffer bits per pixel
+//   -x  pin the fb origin's x at 0, horizontal shifts move the pixels (the firmware's 1bpp chain scanout)
+//   -s  also expand the last frame into WxH 8bpp scanlines and time the scaler
+//   -p  decode sliced frames' slices on this many threads (counting the decoding one)
+//   -H  write each frame's CRC-32 (a byte per pixel, 0 or 1, row by row) to hashes, for comparing decoders
+//   -o  write each frame's decode time (the fastest over the runs) to times
+//   -b  compare against times written by -o before, fail if decoding got more than percent (default 10)
+//       slower over the whole stream
+
+#define BENCH_READ_SIZE 1024
+#define BENCH_FEED_SIZE 256
+
+// the final frame isn't terminated by a flip, zero padding decodes as one
+#define BENCH_TAIL_PAD 5
+
+#define BENCH_THREADS_MAX 16
+
+#define BENCH_REGRESSION_PERCENT 10
+
+struct bench_result {
+    uint32_t frames;
+    uint32_t supertiles;
+    uint32_t tiles;
+    uint64_t bits;
+
+    uint64_t damaged;
+    uint32_t full_frames;
+    uint32_t grid;
+
+    uint64_t total_ns;
+    uint64_t worst_ns;
+    uint32_t worst_frame;
+
+    uint64_t scale_ns;
+    uint32_t scale_lines;
+    uint32_t scale_errors;
+
+    uint32_t stalls;
+    uint32_t sliced_frames;
+
+    uint64_t verify_ns;
+    int32_t verify_res;
+    uint32_t verify_bad_bit;
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* bench input */
+
+struct bench_input {
+    const uint8_t *data;
+    uint32_t size;
+
+    bool attach;
+    bool checked;
+    bool threaded;
+    bool double_buffer;
+    enum bv_fb_format format;
+    bool pin_origin_x;
+
+    uint16_t scale_extent[2];
+    uint32_t threads;
+
+    uint32_t seek;
+    uint32_t pad_seek;
+    bool end_seen;
+
+    // the decoder gave up on a malformed stream, the feeder drops the rest
+    bool feeder_stop;
+
+    struct bv_stream *s;
+    uint32_t stalls;
+
+    // frame hashes are written on the first run, decode times kept per frame over all of them
+    uint32_t run;
+    FILE *hashes;
+    uint64_t *frame_ns;
+    uint32_t frame_cap;
+};
+
+// feeder thread, commits the file (and the tail padding) in small chunks as space frees up
+static void *input_feeder(void *arg) {
+    struct bench_input *in = arg;
+    static const uint8_t pad[BENCH_TAIL_PAD];
+
+    const uint32_t total = in->size + BENCH_TAIL_PAD;
+
+    for (uint32_t seek = 0; seek < total;) {
+        if (__atomic_load_n(&in->feeder_stop, __ATOMIC_ACQUIRE))
+            break;
+
+        uint32_t space;
+        uint8_t *window = bv_stream_write_window(in->s, &space);
+
+        if (!space) {
+            sched_yield();
+            continue;
+        }
+
+        const uint32_t size = MIN(MIN(space, BENCH_FEED_SIZE), total - seek);
+
+        for (uint32_t i = 0; i < size; i++)
+            window[i] = seek + i < in->size ? in->data[seek + i] : pad[seek + i - in->size];
+
+        bv_stream_commit(in->s, size);
+        seek += size;
+    }
+
+    bv_stream_end_input(in->s);
+    return NULL;
+}
+
+// stream the next chunk of the file into s; returns: 0 - success, -1 - end of file
+static int32_t input_read(struct bench_input *in, struct bv_stream *s) {
+    static uint8_t pad[BENCH_TAIL_PAD];
+
+    if (in->attach)
+        return -1;
+
+    if (in->threaded) {
+        // give the decoder one more go after the feeder finished, it may have raced the end
+        if (__atomic_load_n(&s->input_ended, __ATOMIC_ACQUIRE)) {
+            if (in->end_seen)
+                return -1;
+
+            in->end_seen = true;
+            return 0;
+        }
+
+        in->stalls += 1;
+        sched_yield();
+        return 0;
+    }
+
+    // never more than fits, waiting on a sliced frame's slices leaves less room than a cmd would
+    uint32_t space;
+    bv_stream_write_window(s, &space);
+
+    if (in->seek < in->size) {
+        const uint32_t to_read = MIN(MIN(BENCH_READ_SIZE, space), in->size - in->seek);
+        bv_stream_read(s, (uint8_t *)&in->data[in->seek], to_read);
+        in->seek += to_read;
+
+        return 0;
+    }
+
+    if (in->pad_seek < BENCH_TAIL_PAD) {
+        const uint32_t to_read = MIN(BENCH_TAIL_PAD - in->pad_seek, space);
+        bv_stream_read(s, pad, to_read);
+        in->pad_seek += to_read;
+
+        return 0;
+    }
+
+    if (!s->input_ended) {
+        bv_stream_end_input(s);
+        return 0;
+    }
+
+    return -1;
+}
+
+/* slice workers */
+
+// The frame's slices are claimed one at a time by the decoding thread and the workers, with a CAS on
+// a single word holding the frame's generation, slice count and next slice. A worker descheduled
+// between its load and its CAS fails the CAS once a later frame was handed out (the generation only
+// repeats after 65536 frames), and a frame isn't done while a slice claimed in it is still decoding,
+// so done only ever counts the current frame's slices.
+#define SLICE_CLAIM_NEXT(c)  ((c) & 0xff)
+#define SLICE_CLAIM_COUNT(c) ((c) >> 8 & 0xff)
+#define SLICE_CLAIM_GEN(c)   ((c) >> 16)
+
+_Static_assert(BV_SLICE_MAX <= 0xff, "slice counts fit a claim word's byte");
+
+struct slice_pool {
+    struct bv_stream *s;
+    pthread_t workers[BENCH_THREADS_MAX];
+    uint32_t worker_count;
+
+    // generation << 16 | slice count << 8 | next slice
+    uint32_t claim;
+    uint32_t done;
+    bool quit;
+};
+
+// decode one of the frame's slices if any is left; returns false when they're all claimed
+static bool slice_claim(struct slice_pool *p) {
+    uint32_t c = __atomic_load_n(&p->claim, __ATOMIC_ACQUIRE);
+
+    if (SLICE_CLAIM_NEXT(c) >= SLICE_CLAIM_COUNT(c))
+        return false;
+
+    if (__atomic_compare_exchange_n(&p->claim, &c, c + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        bv_stream_decslice(p->s, SLICE_CLAIM_NEXT(c));
+        __atomic_fetch_add(&p->done, 1, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+static void *slice_worker(void *arg) {
+    struct slice_pool *p = arg;
+
+    while (!__atomic_load_n(&p->quit, __ATOMIC_ACQUIRE)) {
+        if (!slice_claim(p))
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void slice_pool_start(struct slice_pool *p, struct bv_stream *s, uint32_t threads) {
+    memset(p, 0, sizeof(*p));
+    p->s = s;
+    p->worker_count = threads > 1 ? MIN(threads, BENCH_THREADS_MAX) - 1 : 0;
+
+    for (uint32_t i = 0; i < p->worker_count; i++)
+        pthread_create(&p->workers[i], NULL, slice_worker, p);
+}
+
+static void slice_pool_stop(struct slice_pool *p) {
+    __atomic_store_n(&p->quit, true, __ATOMIC_RELEASE);
+
+    for (uint32_t i = 0; i < p->worker_count; i++)
+        pthread_join(p->workers[i], NULL);
+}
+
+// hand the frame's slices out and help decode them until they're all done
+static void slice_pool_run(struct slice_pool *p, uint32_t slice_count) {
+    const uint32_t gen = SLICE_CLAIM_GEN(__atomic_load_n(&p->claim, __ATOMIC_RELAXED)) + 1;
+
+    // only this thread hands frames out, every claim of the last one has landed in done
+    __atomic_store_n(&p->done, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->claim, gen << 16 | slice_count << 8, __ATOMIC_RELEASE);
+
+    while (slice_claim(p))
+        ;
+
+    while (__atomic_load_n(&p->done, __ATOMIC_ACQUIRE) < slice_count)
+        ;
+}
+
+/* frame readback */
+
+// the pixel at x, y of the frame, the fb wraps around its origin
+static bool fb_pixel(const struct bv_stream *s, const uint8_t *fb, const uint16_t origin[2], uint32_t x, uint32_t y) {
+    const uint32_t fb_x = (x + origin[0]) % s->extent[0], fb_y = (y + origin[1]) % s->extent[1];
+
+    switch (s->fb_format) {
+    case BV_FB_8BPP:
+        return fb[fb_y * s->fb_stride + fb_x];
+    case BV_FB_4BPP:
+        return (fb[fb_y * s->fb_stride + fb_x / 2] >> ((fb_x % 2) * 4)) & 1;
+    default:
+        return (fb[fb_y * s->fb_stride + fb_x / 8] >> (fb_x % 8)) & 1;
+    }
+}
+
+// CRC-32 (zlib's) of the frame as a byte per pixel, so any decoder's frames hash the same
+static uint32_t frame_crc(const struct bv_stream *s, const uint8_t *fb, const uint16_t origin[2]) {
+    static uint32_t table[256];
+
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (uint32_t k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+            table[i] = c;
+        }
+    }
+
+    uint32_t crc = 0xffffffff;
+    for (uint32_t y = 0; y < s->extent[1]; y++) {
+        for (uint32_t x = 0; x < s->extent[0]; x++)
+            crc = table[(crc ^ fb_pixel(s, fb, origin, x, y)) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+/* scaler bench */
+
+#define SCALE_PASSES 16
+
+// expand every dst line of fb, checking the output against a plain per-pixel expansion
+static void bench_scale(struct bench_input *in, struct bv_stream *s, const uint8_t *fb, const uint16_t origin[2],
+                        struct bench_result *r) {
+    static struct bv_scaler sc;
+    static uint32_t line[BV_SCALE_MAX_WIDTH / 4];
+
+    const uint16_t dst_w = in->scale_extent[0], dst_h = in->scale_extent[1];
+    if (bv_scaler_init(&sc, s, dst_w, dst_h) < 0) {
+        r->scale_errors = 1;
+        return;
+    }
+
+    uint64_t t = now_ns();
+    for (uint32_t pass = 0; pass < SCALE_PASSES; pass++) {
+        for (uint32_t y = 0; y < dst_h; y++)
+            bv_scale_row(&sc, fb, origin, bv_scaler_src_row(&sc, y), (uint8_t *)line);
+    }
+
+    r->scale_ns = now_ns() - t;
+    r->scale_lines = SCALE_PASSES * dst_h;
+
+    for (uint32_t y = 0; y < dst_h; y++) {
+        uint32_t src_y = y * s->extent[1] / dst_h;
+        bv_scale_row(&sc, fb, origin, src_y, (uint8_t *)line);
+
+        for (uint32_t x = 0; x < dst_w; x++) {
+            const bool white = fb_pixel(s, fb, origin, x * s->extent[0] / dst_w, src_y);
+
+            if (((uint8_t *)line)[x] != (white ? 0xff : 0x00))
+                r->scale_errors += 1;
+        }
+    }
+}
+
+static int32_t bench_run(struct bench_input *in, struct bench_result *r) {
+    static struct bv_stream s;
+
+    memset(r, 0, sizeof(*r));
+    bv_stream_init(&s);
+    bv_stream_set_format(&s, in->format);
+    bv_stream_pin_origin_x(&s, in->pin_origin_x);
+
+    in->seek = 0;
+    in->pad_seek = 0;
+    in->end_seen = false;
+    in->feeder_stop = false;
+    in->s = &s;
+    in->stalls = 0;
+
+    // read-in header
+
+    pthread_t feeder;
+
+    if (in->attach)
+        bv_stream_attach_memory(&s, in->data, in->size);
+    else if (in->threaded)
+        pthread_create(&feeder, NULL, input_feeder, in);
+
+    int32_t configured;
+    while ((configured = bv_stream_configure(&s)) == -1) {
+        if (input_read(in, &s) < 0)
+            break;
+    }
+
+    if (configured < 0) {
+        if (in->threaded) {
+            __atomic_store_n(&in->feeder_stop, true, __ATOMIC_RELEASE);
+            pthread_join(feeder, NULL);
+        }
+
+        return -1;
+    }
+
+    if (in->attach && !in->checked) {
+        uint64_t t = now_ns();
+        r->verify_res = bv_stream_verify(&s, &r->verify_bad_bit);
+        r->verify_ns = now_ns() - t;
+    }
+
+    uint8_t *fbs[2] = {calloc(1, s.fb_size), in->double_buffer ? calloc(1, s.fb_size) : NULL};
+    bv_stream_bind(&s, fbs);
+
+    static struct slice_pool pool;
+    if (in->threads)
+        slice_pool_start(&pool, &s, in->threads);
+
+    // decode all frames
+
+    uint32_t prev_bit_head = s.bit_head;
+
+    while (true) {
+        uint64_t t = now_ns();
+        int32_t res = 0;
+
+        if (in->threads) {
+            while ((res = bv_stream_slice_frame(&s)) == -1) {
+                if (input_read(in, &s) < 0)
+                    break;
+            }
+
+            if (res > 0) {
+                slice_pool_run(&pool, res);
+                r->sliced_frames += 1;
+            }
+        }
+
+        while ((res = bv_stream_decframe(&s)) == -1) {
+            if (input_read(in, &s) < 0)
+                break;
+        }
+
+        bv_stream_commit_swap(&s);
+
+        uint64_t dt = now_ns() - t;
+        if (res == -2)
+            fprintf(stderr, "bvbench: malformed stream at frame %u\n", r->frames);
+
+        if (res < 0)
+            break; // end of stream
+
+        if (dt > r->worst_ns) {
+            r->worst_ns = dt;
+            r->worst_frame = r->frames;
+        }
+
+        if (r->frames >= in->frame_cap) {
+            in->frame_cap = in->frame_cap ? in->frame_cap * 2 : 1024;
+            in->frame_ns = realloc(in->frame_ns, in->frame_cap * sizeof(uint64_t));
+        }
+
+        if (!in->run || dt < in->frame_ns[r->frames])
+            in->frame_ns[r->frames] = dt;
+
+        if (in->hashes && !in->run)
+            fprintf(in->hashes, "%u %08x\n", r->frames, frame_crc(&s, bv_stream_active_fb(&s), bv_stream_active_origin(&s)));
+
+        const struct bv_damage *damage = bv_stream_damage(&s);
+        r->damaged += damage->count;
+        r->full_frames += damage->full;
+
+        r->total_ns += dt;
+        r->bits += s.bit_head - prev_bit_head;
+        r->frames += 1;
+
+        prev_bit_head = s.bit_head;
+    }
+
+    if (in->threads)
+        slice_pool_stop(&pool);
+
+    r->supertiles = s.supertile_count;
+    r->tiles = s.tile_count;
+    r->stalls = in->stalls;
+    r->grid = ((s.extent[0] + 15) / 16) * ((s.extent[1] + 15) / 16);
+
+    if (in->scale_extent[0])
+        bench_scale(in, &s, bv_stream_active_fb(&s), bv_stream_active_origin(&s), r);
+
+    if (in->threaded) {
+        __atomic_store_n(&in->feeder_stop, true, __ATOMIC_RELEASE);
+        pthread_join(feeder, NULL);
+    }
+
+    free(fbs[0]);
+    free(fbs[1]);
+    bv_stream_deinit(&s);
+
+    return 0;
+}
+
+/* decode time baseline */
+
+static int32_t write_times(const struct bench_input *in, uint32_t frames, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    for (uint32_t i = 0; i < frames; i++)
+        fprintf(f, "%u %llu\n", i, (unsigned long long)in->frame_ns[i]);
+
+    fclose(f);
+    return 0;
+}
+
+// Compare the per-frame times against a baseline over the frames both have; returns: 0 - within
+// percent, 1 - regressed, -1 - unreadable baseline.
+static int32_t check_times(const struct bench_input *in, uint32_t frames, const char *path, uint32_t percent) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    uint64_t base_ns = 0, ns = 0;
+    uint32_t compared = 0;
+    uint32_t frame;
+    unsigned long long frame_ns;
+
+    while (fscanf(f, "%u %llu", &frame, &frame_ns) == 2) {
+        if (frame >= frames)
+            continue;
+
+        base_ns += frame_ns;
+        ns += in->frame_ns[frame];
+        compared += 1;
+    }
+
+    fclose(f);
+
+    if (!compared)
+        return -1;
+
+    const double change = 100.0 * ((double)ns - base_ns) / base_ns;
+    printf("baseline:    %.3f ms -> %.3f ms over %u frames, %+.1f%% (limit +%u%%)\n", base_ns / 1e6, ns / 1e6, compared, change, percent);
+
+    return change > percent;
+}
+
+static enum bv_fb_format parse_format(const char *bpp) {
+    switch (atoi(bpp)) {
+    case 4:
+        return BV_FB_4BPP;
+    case 1:
+        return BV_FB_1BPP;
+    default:
+        return BV_FB_8BPP;
+    }
+}
+
+static const char *format_name(enum bv_fb_format format) {
+    static const char *names[] = {"8bpp", "4bpp", "1bpp"};
+    return names[format];
+}
+
+int main(int argc, char **argv) {
+    struct bench_input in = {0};
+    const char *path = NULL;
+    const char *hashes_path = NULL;
+    const char *times_path = NULL;
+    const char *baseline_path = NULL;
+    uint32_t regression_percent = BENCH_REGRESSION_PERCENT;
+    uint32_t runs = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-m"))
+            in.attach = true;
+        else if (!strcmp(argv[i], "-c"))
+            in.checked = true;
+        else if (!strcmp(argv[i], "-t"))
+            in.threaded = true;
+        else if (!strcmp(argv[i], "-d"))
+            in.double_buffer = true;
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            in.format = parse_format(argv[++i]);
+        else if (!strcmp(argv[i], "-x"))
+            in.pin_origin_x = true;
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            sscanf(argv[++i], "%hux%hu", &in.scale_extent[0], &in.scale_extent[1]);
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            in.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-H") && i + 1 < argc)
+            hashes_path = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            times_path = argv[++i];
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            regression_percent = atoi(argv[++i]);
+        else if (!path)
+            path = argv[i];
+        else
+            runs = atoi(argv[i]);
+    }
+
+    if (!path) {
+        fprintf(stderr, "usage: %s [-m [-c] | -t] [-d] [-f 8|4|1] [-x] [-s WxH] [-p threads] [-H hashes] [-o times] "
+                        "[-b times [-r percent]] <file.bv> [runs]\n", argv[0]);
+        return 1;
+    }
+
+    if (!runs)
+        runs = 1;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0 || !st.st_size) {
+        fprintf(stderr, "bvbench: can't read %s\n", path);
+        return 1;
+    }
+
+    in.size = st.st_size;
+    in.data = mmap(NULL, in.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (in.data == MAP_FAILED) {
+        fprintf(stderr, "bvbench: can't map %s\n", path);
+        return 1;
+    }
+
+    if (hashes_path && !(in.hashes = fopen(hashes_path, "w"))) {
+        fprintf(stderr, "bvbench: can't write %s\n", hashes_path);
+        return 1;
+    }
+
+    // keep the fastest run, the rest is scheduling noise
+
+    struct bench_result best = {0}, r;
+    for (in.run = 0; in.run < runs; in.run++) {
+        if (bench_run(&in, &r) < 0) {
+            fprintf(stderr, "bvbench: %s is not a bv stream\n", path);
+            return 1;
+        }
+
+        if (!in.run || r.total_ns < best.total_ns)
+            best = r;
+    }
+
+    if (in.hashes)
+        fclose(in.hashes);
+
+    if (!best.frames) {
+        fprintf(stderr, "bvbench: no frames decoded\n");
+        return 1;
+    }
+
+    printf("input:       %s, %s %s fb\n", in.attach ? "attached memory" : in.threaded ? "feeder thread" : "streamed", in.double_buffer ? "double-buffered" : "single", format_name(in.format));
+
+    if (in.attach && !in.checked) {
+        if (best.verify_res < 0)
+            printf("verify:      failed at bit %u, decoded with bounds checks\n", best.verify_bad_bit);
+        else
+            printf("verify:      ok, %.3f ms\n", best.verify_ns / 1e6);
+    }
+
+    printf("frames:      %u (%u supertiles, %u tiles)\n", best.frames, best.supertiles, best.tiles);
+    printf("decode:      %.3f ms, %.1f frames/s\n", best.total_ns / 1e6, best.frames / (best.total_ns / 1e9));
+    printf("supertile:   %.1f ns\n", best.supertiles ? (double)best.total_ns / best.supertiles : 0.0);
+    printf("tiles/s:     %.2f M\n", best.tiles / (best.total_ns / 1e3));
+    printf("bits/frame:  %.1f\n", (double)best.bits / best.frames);
+    printf("damage:      %.1f%% of supertiles/frame, %u full frames\n", 100.0 * best.damaged / ((double)best.grid * best.frames), best.full_frames);
+    printf("worst frame: %u, %.1f us\n", best.worst_frame, best.worst_ns / 1e3);
+
+    if (in.threaded)
+        printf("stalls:      %u waits on the feeder\n", best.stalls);
+
+    if (in.threads)
+        printf("slices:      %u/%u frames decoded slice-parallel on %u threads\n", best.sliced_frames, best.frames, MIN(in.threads, BENCH_THREADS_MAX));
+
+    if (in.scale_extent[0]) {
+        printf("scale:       %ux%u, %.1f ns/line\n", in.scale_extent[0], in.scale_extent[1], (double)best.scale_ns / best.scale_lines);
+
+        if (best.scale_errors) {
+            fprintf(stderr, "bvbench: scaler output differs in %u pixels\n", best.scale_errors);
+            return 1;
+        }
+    }
+
+    if (times_path && write_times(&in, best.frames, times_path) < 0) {
+        fprintf(stderr, "bvbench: can't write %s\n", times_path);
+        return 1;
+    }
+
+    int32_t regressed = 0;
+    if (baseline_path && (regressed = check_times(&in, best.frames, baseline_path, regression_percent)) < 0) {
+        fprintf(stderr, "bvbench: can't read a baseline from %s\n", baseline_path);
+        return 1;
+    }
+
+    if (regressed) {
+        fprintf(stderr, "bvbench: decoding regressed past the baseline\n");
+        return 1;
+    }
+
+    free(in.frame_ns);
+    munmap((void *)in.data, in.size);
+    return 0;
+}
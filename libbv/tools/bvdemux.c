@@ -0,0 +1,225 @@
+#include <bv/bvdec.h>
+#include <bv/bvmux.h>
+
+#include <ogg/ogg.h>
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// bvdemux - plays a .bvmx container in a single sequential pass, the way a sd card / pipe fed player would;
+// video chunks are decoded as they arrive, audio chunks go through ogg_sync and come out as pages
+// (optionally also copied into a file)
+//
+// usage: bvdemux [-b bytes] <file.bvmx | -> [audio.ogg]
+//   -b  read size of the sequential input (default 4096)
+
+#define DEMUX_READ_SIZE 4096
+
+// the final frame isn't terminated by a flip, zero padding decodes as one
+#define DEMUX_TAIL_PAD 5
+
+struct demux_state {
+    struct bv_stream s;
+    bool configured;
+    uint8_t *fb;
+
+    uint32_t frames;
+    uint32_t video_stalls;
+
+    // chunks should arrive in pts order, this is how far back one ever reached
+    uint32_t max_pts;
+    uint32_t max_reorder_us;
+
+    ogg_sync_state o_sync;
+    uint32_t pages;
+    uint32_t page_holes;
+    int64_t granulepos;
+
+    FILE *audio_out;
+};
+
+static void track_pts(struct demux_state *d, const struct bvmx_chunk *chunk, uint32_t offset) {
+    if (offset)
+        return;
+
+    if (chunk->pts_us > d->max_pts)
+        d->max_pts = chunk->pts_us;
+    if (d->max_pts - chunk->pts_us > d->max_reorder_us)
+        d->max_reorder_us = d->max_pts - chunk->pts_us;
+}
+
+static uint32_t video_sink(void *ctx, const struct bvmx_chunk *chunk, uint32_t offset,
+                           const uint8_t *data, uint32_t size) {
+    struct demux_state *d = ctx;
+
+    track_pts(d, chunk, offset);
+    return bvmx_bv_sink(&d->s, chunk, offset, data, size);
+}
+
+static uint32_t audio_sink(void *ctx, const struct bvmx_chunk *chunk, uint32_t offset,
+                           const uint8_t *data, uint32_t size) {
+    struct demux_state *d = ctx;
+
+    track_pts(d, chunk, offset);
+
+    const uint32_t taken = bvmx_ogg_sink(&d->o_sync, chunk, offset, data, size);
+    if (d->audio_out)
+        fwrite(data, 1, taken, d->audio_out);
+
+    return taken;
+}
+
+// pull whatever pages are complete out of ogg_sync, the way the audio decoder would
+static void drain_audio(struct demux_state *d) {
+    ogg_page page;
+    int res;
+
+    while ((res = ogg_sync_pageout(&d->o_sync, &page)) != 0) {
+        if (res < 0) {
+            // lost sync, ogg_sync skipped ahead to the next page
+            d->page_holes += 1;
+            continue;
+        }
+
+        d->pages += 1;
+
+        if (ogg_page_granulepos(&page) >= 0)
+            d->granulepos = ogg_page_granulepos(&page);
+    }
+}
+
+// decode whatever frames are resident; returns: 0 - read needed, -1 - unsupported stream, -2 - malformed stream
+static int32_t drain_video(struct demux_state *d) {
+    if (!d->configured) {
+        int32_t res = bv_stream_configure(&d->s);
+        if (res == -1)
+            return 0;
+        if (res < 0)
+            return -1;
+
+        d->fb = calloc(1, d->s.fb_size);
+        bv_stream_bind(&d->s, (uint8_t *[2]){d->fb, NULL});
+        d->configured = true;
+    }
+
+    int32_t res;
+    while ((res = bv_stream_decframe(&d->s)) == 0)
+        d->frames += 1;
+
+    return res == -2 ? -2 : 0;
+}
+
+static bool video_failed(const struct demux_state *d, int32_t res, const char *path) {
+    if (res == -1)
+        fprintf(stderr, "%s: unsupported bv stream\n", path);
+    else if (res == -2)
+        fprintf(stderr, "%s: malformed bv stream at frame %u\n", path, d->frames);
+
+    return res < 0;
+}
+
+int main(int argc, char **argv) {
+    uint32_t read_size = DEMUX_READ_SIZE;
+    const char *paths[2] = {NULL, NULL};
+    uint32_t path_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            read_size = atoi(argv[++i]);
+        else if (path_count < 2)
+            paths[path_count++] = argv[i];
+    }
+
+    if (!path_count || !read_size) {
+        fprintf(stderr, "usage: %s [-b bytes] <file.bvmx | -> [audio.ogg]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = strcmp(paths[0], "-") ? open(paths[0], O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
+        perror(paths[0]);
+        return 1;
+    }
+
+    static struct demux_state d;
+    static struct bvmx_reader r;
+
+    if (paths[1] && !(d.audio_out = fopen(paths[1], "wb"))) {
+        perror(paths[1]);
+        return 1;
+    }
+
+    bv_stream_init(&d.s);
+    ogg_sync_init(&d.o_sync);
+    bvmx_reader_init(&r);
+    bvmx_reader_set_sink(&r, BVMX_STREAM_VIDEO, video_sink, &d);
+    bvmx_reader_set_sink(&r, BVMX_STREAM_AUDIO, audio_sink, &d);
+
+    // one sequential pass, the input is never seeked
+
+    uint8_t *block = malloc(read_size);
+    ssize_t n;
+
+    while ((n = read(fd, block, read_size)) > 0) {
+        for (uint32_t seek = 0; seek < n;) {
+            int32_t used = bvmx_reader_feed(&r, &block[seek], n - seek);
+            if (used < 0) {
+                fprintf(stderr, "%s: not a bvmx container (or corrupt)\n", paths[0]);
+                return 1;
+            }
+
+            seek += used;
+
+            // read_buf filled up mid-chunk, decoding frees it
+            if (seek < n)
+                d.video_stalls += 1;
+
+            drain_audio(&d);
+
+            const uint32_t bit_head = d.s.bit_head;
+            if (video_failed(&d, drain_video(&d), paths[0]))
+                return 1;
+
+            // nothing was taken and decoding freed nothing, feeding again would take nothing either
+            if (!used && d.s.bit_head == bit_head) {
+                fprintf(stderr, "%s: bv stream stuck at frame %u, read_buf full\n", paths[0], d.frames);
+                return 1;
+            }
+        }
+    }
+
+    if (!bvmx_reader_at_boundary(&r))
+        fprintf(stderr, "%s: truncated in chunk %u\n", paths[0], r.chunk_count);
+
+    // decode the tail
+
+    static const uint8_t pad[DEMUX_TAIL_PAD];
+    bvmx_bv_sink(&d.s, NULL, 0, pad, DEMUX_TAIL_PAD);
+    bv_stream_end_input(&d.s);
+
+    if (video_failed(&d, drain_video(&d), paths[0]))
+        return 1;
+
+    printf("chunks:      %u\n", r.chunk_count);
+    printf("video:       %llu bytes, %u frames (%ux%u @ %u fps), %u read_buf stalls\n",
+           (unsigned long long)r.stream_bytes[BVMX_STREAM_VIDEO], d.frames,
+           d.s.extent[0], d.s.extent[1], d.s.framerate, d.video_stalls);
+    printf("audio:       %llu bytes, %u ogg pages (last granulepos %lld), %u sync holes\n",
+           (unsigned long long)r.stream_bytes[BVMX_STREAM_AUDIO], d.pages, (long long)d.granulepos, d.page_holes);
+    printf("interleave:  %.1f ms worst out of order chunk\n", d.max_reorder_us / 1e3);
+
+    if (d.audio_out)
+        fclose(d.audio_out);
+
+    free(block);
+    free(d.fb);
+    bv_stream_deinit(&d.s);
+    ogg_sync_clear(&d.o_sync);
+
+    return 0;
+}
@@ -0,0 +1,396 @@
+#include <bv/bvdec.h>
+#include <bv/bvenc.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// bvroundtrip - encodes frames with bv_encoder, decodes the result with bv_stream_decframe in every fb
+// format and checks the decoded frames match the input bit for bit; exits non-zero on any mismatch
+//
+// usage: bvroundtrip [-s WxH] [-n frames] [-k interval] [-m] [-c] [-e] [-t] [-x] [-z] [-p slices] [-r frames.raw] [-o out.bv]
+//   -s  extent of the synthetic clip (default 160x96)
+//   -n  frame count of the synthetic clip (default 60)
+//   -k  keyframe interval (default 300)
+//   -m  pan the synthetic clip's background and flip along with it, exercises the shifted diffs
+//   -c  cut to a different background pattern every 20 frames, the tiles drawn change with it
+//   -e  estimate the flips with bv_encoder_estimate_motion and report the bits saved over no flips
+//   -t  report the bits tileset updates save over the header's tileset alone
+//   -x  report the bits skip cmds save over 5 + 5 bit moves (up to 512x512)
+//   -z  range code the stream and report the bytes it saves over the plain bitstream
+//   -p  cut frames into up to this many slices, each is then also decoded slice by slice (last first)
+//   -r  use WxH frames from a raw file (a byte per pixel) instead of the synthetic clip
+//   -o  write the encoded stream to a file
+
+struct trip_clip {
+    uint16_t extent[2];
+    uint32_t frame_count;
+    uint8_t *frames;
+
+    int8_t (*flips)[2];
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* test clips */
+
+// pan velocity of the -m clip, changes every 10 frames
+static const int8_t pan_steps[][2] = {{2, 0}, {0, 1}, {-3, -1}, {1, 2}, {0, 0}, {-1, 3}};
+
+// a wobbling disc with a dithered rim over a sparse pattern (panning with motion, changing with cuts),
+// plus some noise
+static void synth_clip(struct trip_clip *c, bool motion, bool cuts) {
+    const uint32_t w = c->extent[0], h = c->extent[1];
+
+    c->frames = calloc(c->frame_count, w * h);
+    c->flips = calloc(c->frame_count, sizeof(*c->flips));
+    srand(c->frame_count);
+
+    int32_t pan_x = 0, pan_y = 0;
+
+    for (uint32_t f = 0; f < c->frame_count; f++) {
+        uint8_t *frame = &c->frames[f * w * h];
+
+        if (motion && f) {
+            const int8_t *step = pan_steps[f / 10 % (sizeof(pan_steps) / sizeof(pan_steps[0]))];
+
+            // the previous frame shifted by the pan lines the background up again
+            c->flips[f][0] = step[0];
+            c->flips[f][1] = step[1];
+
+            pan_x += step[0];
+            pan_y += step[1];
+        }
+
+        const uint32_t scene = cuts ? f / 20 : 0;
+
+        const float cx = w / 2.f + cosf(f / 10.f) * w / 4, cy = h / 2.f + sinf(f / 7.f) * h / 4;
+        const float r = h / 4.f + sinf(f / 5.f) * h / 8;
+
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                const float d = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+
+                // offset so the pattern coordinates stay positive
+                const uint32_t px = x - pan_x + 4096, py = y - pan_y + 4096;
+
+                // each scene fills the disc with its own dither
+                const bool fill = !cuts || (x * (1 + scene % 3) + y * (1 + scene % 5)) % (2 + scene % 4) == 0;
+
+                bool white = (d < r * r && fill) || (d < r * r * 1.69f && (x + y) % 2 == 0) ||
+                             ((px / 24 + py / 24) % 7 == 0 && (px * 3 + py) % 5 == 0) ||
+                             ((px / 8 + py / 8) % 3 == 0 && (px ^ py) % 3 == 0) ||
+                             rand() % 100 == 0;
+
+                frame[y * w + x] = white;
+            }
+        }
+    }
+}
+
+static int32_t load_clip(struct trip_clip *c, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    const uint32_t frame_size = c->extent[0] * c->extent[1];
+
+    fseek(f, 0, SEEK_END);
+    c->frame_count = ftell(f) / frame_size;
+    fseek(f, 0, SEEK_SET);
+
+    c->frames = malloc(c->frame_count * frame_size);
+    c->frame_count = fread(c->frames, frame_size, c->frame_count, f);
+    c->flips = calloc(c->frame_count, sizeof(*c->flips));
+
+    fclose(f);
+    return c->frame_count ? 0 : -1;
+}
+
+/* round trip */
+
+static bool pixel_at(struct bv_stream *s, const uint8_t *fb, uint32_t x, uint32_t y) {
+    // the fb wraps around its origin
+    const uint16_t *origin = bv_stream_active_origin(s);
+    x = (x + origin[0]) % s->extent[0];
+    y = (y + origin[1]) % s->extent[1];
+
+    switch (s->fb_format) {
+    case BV_FB_8BPP:
+        return fb[y * s->fb_stride + x];
+    case BV_FB_4BPP:
+        return (fb[y * s->fb_stride + x / 2] >> ((x % 2) * 4)) & 1;
+    default:
+        return (fb[y * s->fb_stride + x / 8] >> (x % 8)) & 1;
+    }
+}
+
+// decode the whole stream (sliced frames slice by slice when by_slice), returns the first mismatching
+// frame or -1 if they all match
+static int32_t check_decode(struct trip_clip *c, const uint8_t *bv, uint32_t size,
+                            enum bv_fb_format format, bool double_buffer, bool by_slice) {
+    static struct bv_stream s;
+
+    bv_stream_init(&s);
+    bv_stream_set_format(&s, format);
+    bv_stream_attach_memory(&s, bv, size);
+
+    if (bv_stream_configure(&s) < 0 || bv_stream_verify(&s, NULL) < 0)
+        return 0;
+
+    uint8_t *fbs[2] = {calloc(1, s.fb_size), double_buffer ? calloc(1, s.fb_size) : NULL};
+    bv_stream_bind(&s, fbs);
+
+    int32_t bad_frame = -1;
+
+    for (uint32_t f = 0; f < c->frame_count && bad_frame < 0; f++) {
+        // out of order, the slices mustn't depend on each other
+        const int32_t slice_count = by_slice ? bv_stream_slice_frame(&s) : 0;
+        for (int32_t i = slice_count - 1; i >= 0; i--)
+            bv_stream_decslice(&s, i);
+
+        if (bv_stream_decframe(&s) < 0) {
+            bad_frame = f;
+            break;
+        }
+
+        bv_stream_commit_swap(&s);
+
+        const uint8_t *fb = bv_stream_active_fb(&s);
+        const uint8_t *frame = &c->frames[f * c->extent[0] * c->extent[1]];
+
+        for (uint32_t y = 0; y < c->extent[1] && bad_frame < 0; y++) {
+            for (uint32_t x = 0; x < c->extent[0]; x++) {
+                if (pixel_at(&s, fb, x, y) != !!frame[y * c->extent[0] + x]) {
+                    bad_frame = f;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(fbs[0]);
+    free(fbs[1]);
+    bv_stream_deinit(&s);
+
+    return bad_frame;
+}
+
+// encode the clip with the given flips; returns the .bv file (to be freed) or null
+static uint8_t *encode_clip(struct trip_clip *c, int8_t (*flips)[2], uint32_t keyframe_interval,
+                            bool tileset_updates, bool skips, bool coded, uint32_t slices, uint32_t *size, uint64_t *bits) {
+    static struct bv_encoder e;
+    if (bv_encoder_init(&e, c->extent[0], c->extent[1], 30) < 0)
+        return NULL;
+
+    e.keyframe_interval = keyframe_interval;
+    e.tileset_updates = tileset_updates;
+    bv_encoder_set_skips(&e, skips);
+    e.coded = coded;
+    e.slices = slices;
+
+    const uint32_t frame_size = c->extent[0] * c->extent[1];
+
+    for (uint32_t f = 0; f < c->frame_count; f++)
+        bv_encoder_scan_frame(&e, &c->frames[f * frame_size], flips[f]);
+
+    bv_encoder_build_tileset(&e);
+
+    for (uint32_t f = 0; f < c->frame_count; f++)
+        bv_encoder_encode_frame(&e, &c->frames[f * frame_size], flips[f]);
+
+    *size = bv_encoder_output_size(&e);
+    *bits = e.bit_size;
+
+    uint8_t *bv = malloc(*size);
+    bv_encoder_output(&e, bv);
+
+    printf("encode:      %u frames %ux%u, %u keyframes, %u tileset entries, %u updated\n", c->frame_count, c->extent[0], c->extent[1], e.index_count, e.tileset_size, e.tileset_update_count);
+
+    if (slices)
+        printf("slices:      %u/%u frames sliced\n", e.sliced_frame_count, c->frame_count);
+
+    if (coded) {
+        const uint32_t raw_size = (e.bit_size + 7) / 8;
+        printf("coded:       %u -> %u frame bytes (%.1f%% smaller)\n", raw_size, e.coded_size,
+               100.0 * ((double)raw_size - e.coded_size) / raw_size);
+    }
+
+    bv_encoder_deinit(&e);
+    return bv;
+}
+
+int main(int argc, char **argv) {
+    struct trip_clip c = {.extent = {160, 96}, .frame_count = 60};
+    uint32_t keyframe_interval = 300;
+    const char *raw_path = NULL;
+    bool motion = false;
+    bool cuts = false;
+    bool estimate = false;
+    bool static_tileset = false;
+    bool moves = false;
+    bool coded = false;
+    uint32_t slices = 0;
+    const char *out_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            sscanf(argv[++i], "%hux%hu", &c.extent[0], &c.extent[1]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            c.frame_count = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+            keyframe_interval = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-m"))
+            motion = true;
+        else if (!strcmp(argv[i], "-c"))
+            cuts = true;
+        else if (!strcmp(argv[i], "-e"))
+            estimate = true;
+        else if (!strcmp(argv[i], "-t"))
+            static_tileset = true;
+        else if (!strcmp(argv[i], "-x"))
+            moves = true;
+        else if (!strcmp(argv[i], "-z"))
+            coded = true;
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            slices = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            raw_path = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [-s WxH] [-n frames] [-k interval] [-m] [-c] [-e] [-t] [-x] [-z] [-p slices] [-r frames.raw] [-o out.bv]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (raw_path) {
+        if (load_clip(&c, raw_path) < 0) {
+            fprintf(stderr, "bvroundtrip: can't read %s\n", raw_path);
+            return 1;
+        }
+    } else {
+        synth_clip(&c, motion, cuts);
+    }
+
+    uint32_t size;
+    uint64_t bits;
+    uint8_t *bv;
+
+    if (estimate) {
+        // estimate the flips the way bvenc.py does, then compare against no flips at all
+        static struct bv_encoder e;
+        if (bv_encoder_init(&e, c.extent[0], c.extent[1], 30) < 0) {
+            fprintf(stderr, "bvroundtrip: can't encode %ux%u\n", c.extent[0], c.extent[1]);
+            return 1;
+        }
+
+        const uint32_t frame_size = c.extent[0] * c.extent[1];
+        uint32_t hits = 0;
+        uint64_t t = now_ns();
+
+        for (uint32_t f = 1; f < c.frame_count; f++) {
+            int8_t flip[2];
+            bv_encoder_estimate_motion(&e, &c.frames[(f - 1) * frame_size], &c.frames[f * frame_size], flip);
+
+            hits += flip[0] == c.flips[f][0] && flip[1] == c.flips[f][1];
+            c.flips[f][0] = flip[0];
+            c.flips[f][1] = flip[1];
+        }
+
+        t = now_ns() - t;
+        bv_encoder_deinit(&e);
+
+        int8_t (*no_flips)[2] = calloc(c.frame_count, sizeof(*no_flips));
+        uint64_t still_bits;
+
+        free(encode_clip(&c, no_flips, keyframe_interval, true, true, coded, slices, &size, &still_bits));
+        free(no_flips);
+
+        if (!(bv = encode_clip(&c, c.flips, keyframe_interval, true, true, coded, slices, &size, &bits)))
+            return 1;
+
+        printf("motion:      %.1f us/frame, %u/%u flips match the clip's\n", t / 1e3 / c.frame_count, hits, c.frame_count - 1);
+        printf("             %.1f bits/frame saved over no flips (%.1f -> %.1f, %.1f%%)\n",
+               ((double)still_bits - bits) / c.frame_count, (double)still_bits / c.frame_count,
+               (double)bits / c.frame_count, 100.0 * ((double)still_bits - bits) / still_bits);
+    } else {
+        uint64_t t = now_ns();
+
+        if (!(bv = encode_clip(&c, c.flips, keyframe_interval, true, true, coded, slices, &size, &bits))) {
+            fprintf(stderr, "bvroundtrip: can't encode %ux%u\n", c.extent[0], c.extent[1]);
+            return 1;
+        }
+
+        printf("size:        %u bytes, %.1f bits/frame, %.1f ms\n", size, (double)bits / c.frame_count, (now_ns() - t) / 1e6);
+    }
+
+    if (static_tileset) {
+        uint32_t static_size;
+        uint64_t static_bits;
+
+        free(encode_clip(&c, c.flips, keyframe_interval, false, true, coded, slices, &static_size, &static_bits));
+
+        printf("tileset:     %.1f bits/frame saved over the header's tileset (%.1f -> %.1f, %.1f%%)\n",
+               ((double)static_bits - bits) / c.frame_count, (double)static_bits / c.frame_count,
+               (double)bits / c.frame_count, 100.0 * ((double)static_bits - bits) / static_bits);
+    }
+
+    if (moves) {
+        uint32_t move_size;
+        uint64_t move_bits;
+
+        free(encode_clip(&c, c.flips, keyframe_interval, true, false, coded, slices, &move_size, &move_bits));
+
+        printf("skips:       %.1f bits/frame saved over moves (%.1f -> %.1f, %.1f%%)\n",
+               ((double)move_bits - bits) / c.frame_count, (double)move_bits / c.frame_count,
+               (double)bits / c.frame_count, 100.0 * ((double)move_bits - bits) / move_bits);
+    }
+
+    if (out_path) {
+        FILE *f = fopen(out_path, "wb");
+        if (!f || fwrite(bv, 1, size, f) != size) {
+            fprintf(stderr, "bvroundtrip: can't write %s\n", out_path);
+            return 1;
+        }
+
+        fclose(f);
+    }
+
+    // decode in every layout
+
+    static const char *format_names[] = {"8bpp", "4bpp", "1bpp"};
+    uint32_t failures = 0;
+
+    for (uint32_t format = BV_FB_8BPP; format <= BV_FB_1BPP; format++) {
+        for (uint32_t double_buffer = 0; double_buffer < 2; double_buffer++) {
+            for (uint32_t by_slice = 0; by_slice < (slices ? 2 : 1); by_slice++) {
+                const int32_t bad_frame = check_decode(&c, bv, size, format, double_buffer, by_slice);
+
+                if (bad_frame >= 0) {
+                    printf("decode:      %s %s%s, frame %d differs\n", format_names[format], double_buffer ? "double" : "single",
+                           by_slice ? " by slice" : "", bad_frame);
+                    failures += 1;
+                }
+            }
+        }
+    }
+
+    if (!failures)
+        printf("decode:      all frames match in every format\n");
+
+    free(bv);
+    free(c.frames);
+    free(c.flips);
+
+    return failures ? 1 : 0;
+}